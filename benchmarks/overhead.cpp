@@ -0,0 +1,461 @@
+#include <cstdio>
+#include <malunal/tooling.hpp>
+
+using namespace malunal::tooling;
+
+namespace {
+
+/// @brief The number of events recorded into the timelines that are exported.
+constexpr std::size_t k_export_events = 100000;
+
+/// @brief The number of events each thread records in the contention runs.
+constexpr std::size_t k_thread_events = 100000;
+
+/// @brief The options of the probe benchmarks, which also time the probes in
+///        small batches to report their latency next to their throughput.
+constexpr benchmark_options k_probe_options{ .latency_batch = 8 };
+
+/// @brief Keeps a session running for as long as a benchmark needs it,
+///        without keeping any of the events it records.
+struct session_scope final {
+    explicit session_scope(
+        capture_mode capture = capture_mode::events,
+        overflow_policy overflow = overflow_policy::block
+    ) noexcept {
+        profiler::start_session("benchmarks", {
+            .storage       = storage_mode::events,
+            .sink          = nullptr,
+            .retain_events = false,
+            .capture       = capture,
+            .overflow      = overflow
+        });
+    }
+
+    ~session_scope() noexcept {
+        static_cast<void>(profiler::stop_session());
+    }
+};
+
+/// @brief Builds a timeline of nested events spread over a few threads.
+timeline
+make_timeline(storage_mode mode = storage_mode::events) noexcept {
+    timeline result{ mode };
+    std::array<name_id_t, 4> names {
+        name_registry::intern("frame"),
+        name_registry::intern("update"),
+        name_registry::intern("physics \"step\""),
+        name_registry::intern("render")
+    };
+
+    for (std::size_t i = 0; i < k_export_events; i++) {
+        auto depth = static_cast<tick_t>(i % names.size());
+        result.push(timing_event {
+            .name     = names[i % names.size()],
+            .tid      = static_cast<thread_index_t>(i % 8),
+            .flags    = 0,
+            .start    = static_cast<tick_t>(i / names.size()) * 1000 + depth,
+            .duration = 1000 - depth * 2
+        });
+    }
+
+    return result;
+}
+
+} // namespace
+
+MALUNAL_TOOLING_BENCHMARK_WITH(probe_without_session, k_probe_options) {
+    auto name = name_registry::intern("probe");
+    for (auto _ : state) {
+        deferred_timing_probe probe{ name };
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK_WITH(probe_disabled_category, k_probe_options) {
+    session_scope session;
+    auto name = name_registry::intern("probe");
+    for (auto _ : state) {
+        deferred_timing_probe probe{ name, categories::verbose };
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK_WITH(probe_deferred, k_probe_options) {
+    session_scope session;
+    auto name = name_registry::intern("probe");
+    for (auto _ : state) {
+        deferred_timing_probe probe{ name };
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK_WITH(probe_deferred_drop_oldest, k_probe_options) {
+    session_scope session{ capture_mode::events, overflow_policy::drop_oldest };
+    auto name = name_registry::intern("probe");
+    for (auto _ : state) {
+        deferred_timing_probe probe{ name };
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK_WITH(probe_deferred_spill, k_probe_options) {
+    session_scope session{ capture_mode::events, overflow_policy::spill };
+    auto name = name_registry::intern("probe");
+    for (auto _ : state) {
+        deferred_timing_probe probe{ name };
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK_WITH(probe_deferred_tsc, k_probe_options) {
+    session_scope session;
+    auto name = name_registry::intern("probe");
+    for (auto _ : state) {
+        timing_probe<probe_type::deferred, tsc_clock_source> probe{ name };
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK_WITH(probe_static, k_probe_options) {
+    session_scope session;
+    for (auto _ : state) {
+        static_timing_probe<"probe"> probe;
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK_WITH(probe_static_statistics_only, k_probe_options) {
+    session_scope session{ capture_mode::statistics };
+    using policy = probe_policy<probe_storage::statistics>;
+    for (auto _ : state) {
+        static_timing_probe<"probe", policy> probe;
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK_WITH(probe_interned_by_string, k_probe_options) {
+    session_scope session;
+    for (auto _ : state) {
+        deferred_timing_probe probe{ "probe" };
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK_WITH(probe_measure_function_macro, k_probe_options) {
+    session_scope session;
+    for (auto _ : state) {
+        MALUNAL_TOOLING_MEASURE_FUNCTION;
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK_WITH(probe_statistics_only, k_probe_options) {
+    session_scope session{ capture_mode::statistics };
+    auto name = name_registry::intern("probe");
+    for (auto _ : state) {
+        deferred_timing_probe probe{ name };
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK_WITH(probe_sampled_every_100, k_probe_options) {
+    session_scope session;
+    every_nth_sampler sampler{ 100 };
+    auto name = name_registry::intern("probe");
+    for (auto _ : state) {
+        sampled_timing_probe probe{ sampler, name };
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK_WITH(probe_pmu, k_probe_options) {
+    session_scope session;
+    auto name = name_registry::intern("probe");
+    for (auto _ : state) {
+        pmu_timing_probe probe{ name };
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK(export_yaml) {
+    auto source = make_timeline();
+    state.set_items_per_iteration(source.size());
+    for (auto _ : state) {
+        yaml_visitor visitor;
+        source.accept(visitor);
+        do_not_optimize(visitor.dump());
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK(export_yaml_columnar) {
+    auto source = make_timeline(storage_mode::columnar);
+    state.set_items_per_iteration(source.size());
+    for (auto _ : state) {
+        yaml_visitor visitor;
+        source.accept(visitor);
+        do_not_optimize(visitor.dump());
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK(export_chrome_trace) {
+    auto source = make_timeline();
+    state.set_items_per_iteration(source.size());
+    for (auto _ : state) {
+        chrome_trace_visitor visitor;
+        source.accept(visitor);
+        visitor.finish();
+        do_not_optimize(visitor.dump());
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK(export_perfetto) {
+    auto source = make_timeline();
+    state.set_items_per_iteration(source.size());
+    for (auto _ : state) {
+        perfetto_visitor visitor;
+        source.accept(visitor);
+        visitor.finish();
+        do_not_optimize(visitor.dump());
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK(export_binary_capture) {
+    constexpr auto path = "malunal_tooling_benchmark.capture";
+    auto source = make_timeline();
+    std::vector<event_variant_t> events(source.begin(), source.end());
+    state.set_items_per_iteration(events.size());
+    for (auto _ : state) {
+        binary_capture_sink sink{ path };
+        sink.consume(events);
+        sink.flush();
+    }
+
+    std::remove(path);
+}
+
+MALUNAL_TOOLING_BENCHMARK(import_binary_capture) {
+    constexpr auto path = "malunal_tooling_benchmark.capture";
+    auto source = make_timeline();
+    std::vector<event_variant_t> events(source.begin(), source.end());
+    {
+        binary_capture_sink sink{ path };
+        sink.consume(events);
+    }
+
+    state.set_items_per_iteration(events.size());
+    for (auto _ : state) {
+        binary_capture_reader reader{ path };
+        statistics_visitor visitor;
+        reader.accept(visitor);
+        do_not_optimize(visitor);
+    }
+
+    std::remove(path);
+}
+
+MALUNAL_TOOLING_BENCHMARK(import_mapped_capture) {
+    constexpr auto path = "malunal_tooling_benchmark.capture";
+    auto source = make_timeline();
+    std::vector<event_variant_t> events(source.begin(), source.end());
+    {
+        binary_capture_sink sink{ path };
+        sink.consume(events);
+    }
+
+    state.set_items_per_iteration(events.size());
+    for (auto _ : state) {
+        mapped_timeline mapped{ path };
+        statistics_visitor visitor;
+        mapped.accept(visitor);
+        do_not_optimize(visitor);
+    }
+
+    std::remove(path);
+}
+
+MALUNAL_TOOLING_BENCHMARK(export_compressed_capture) {
+    constexpr auto path = "malunal_tooling_benchmark.compressed";
+    auto source = make_timeline();
+    std::vector<event_variant_t> events(source.begin(), source.end());
+    state.set_items_per_iteration(events.size());
+    for (auto _ : state) {
+        compressed_capture_sink sink{ path };
+        sink.consume(events);
+        sink.close();
+    }
+
+    std::remove(path);
+}
+
+MALUNAL_TOOLING_BENCHMARK(import_compressed_capture) {
+    constexpr auto path = "malunal_tooling_benchmark.compressed";
+    auto source = make_timeline();
+    {
+        compressed_capture_sink sink{ path };
+        sink.write(source);
+    }
+
+    state.set_items_per_iteration(source.size());
+    for (auto _ : state) {
+        compressed_capture_reader reader{ path };
+        do_not_optimize(reader.read_timeline(storage_mode::events, 0).size());
+    }
+
+    std::remove(path);
+}
+
+MALUNAL_TOOLING_BENCHMARK(query_timeline_index) {
+    auto source = make_timeline();
+    timeline_index index{ source };
+    auto last = detail::event_start(source.back());
+    tick_t begin = 0;
+    for (auto _ : state) {
+        do_not_optimize(index.query({ begin, begin + 5000 }, 3));
+        begin = (begin + 7919) % last;
+    }
+}
+
+MALUNAL_TOOLING_BENCHMARK(query_mapped_timeline_index) {
+    constexpr auto path = "malunal_tooling_benchmark.capture";
+    auto source = make_timeline();
+    std::vector<event_variant_t> events(source.begin(), source.end());
+    {
+        binary_capture_sink sink{ path };
+        sink.consume(events);
+    }
+
+    {
+        mapped_timeline mapped{ path };
+        mapped_timeline_index index{ mapped };
+        auto last = detail::event_start(source.back());
+        tick_t begin = 0;
+        for (auto _ : state) {
+            do_not_optimize(index.query({ begin, begin + 5000 }, 3));
+            begin = (begin + 7919) % last;
+        }
+    }
+
+    std::remove(path);
+}
+
+MALUNAL_TOOLING_BENCHMARK(export_folded_stacks) {
+    auto source = make_timeline();
+    state.set_items_per_iteration(source.size());
+    for (auto _ : state)
+        do_not_optimize(call_tree::build(source).folded());
+}
+
+MALUNAL_TOOLING_BENCHMARK(export_statistics) {
+    auto source = make_timeline();
+    state.set_items_per_iteration(source.size());
+    for (auto _ : state) {
+        statistics_visitor visitor;
+        source.accept(visitor);
+        do_not_optimize(visitor.statistics);
+    }
+}
+
+/// @brief Registers a run of the given number of threads, all recording
+///        events at the same time.
+static void
+register_contention(std::size_t threads) noexcept {
+    std::string name = "contention_threads_";
+    name += std::to_string(threads);
+
+    benchmark_options options;
+    options.repetitions = 5;
+    options.warmup_time = std::chrono::nanoseconds{ 0 };
+    benchmark_registry::add(std::move(name), [threads](benchmark_state& state) {
+        session_scope session;
+        auto probe_name = name_registry::intern("probe");
+        state.set_items_per_iteration(threads * k_thread_events);
+        for (auto _ : state) {
+            std::vector<std::thread> workers;
+            for (std::size_t t = 0; t < threads; t++)
+                workers.emplace_back([probe_name] {
+                    for (std::size_t i = 0; i < k_thread_events; i++) {
+                        deferred_timing_probe probe{ probe_name };
+                    }
+                });
+            for (auto& worker : workers)
+                worker.join();
+        }
+    }, options);
+}
+
+/// @brief Prints how many bytes each event takes in each kind of storage,
+///        and how many the ring of each thread buffer takes.
+static void
+print_memory_report() noexcept {
+    auto events   = make_timeline();
+    auto columnar = make_timeline(storage_mode::columnar);
+    auto per_event = [](std::size_t bytes, std::size_t count) {
+        return static_cast<double>(bytes) / static_cast<double>(count);
+    };
+
+    std::size_t column_bytes =
+        columnar.columns().names.capacity() * sizeof(name_id_t) +
+        columnar.columns().tids.capacity() * sizeof(thread_index_t) +
+        columnar.columns().flags.capacity() * sizeof(std::uint16_t) +
+        columnar.columns().starts.capacity() * sizeof(tick_t) +
+        columnar.columns().durations.capacity() * sizeof(tick_t);
+
+    std::printf("\nstorage,bytes_per_event\n");
+    std::printf("timing_event,%zu\n", sizeof(timing_event));
+    std::printf("event_variant_t,%zu\n", sizeof(event_variant_t));
+    std::printf("timeline_events,%.3f\n", per_event(
+        events.capacity() * sizeof(event_variant_t), events.size()));
+    std::printf("timeline_columnar,%.3f\n",
+        per_event(column_bytes, columnar.columns().size()));
+
+    // The ring of a thread buffer is allocated in full when the thread first
+    // records, however few events it holds.
+    std::printf("\nstorage,bytes\n");
+    std::printf("thread_buffer_ring,%zu\n",
+        profiler::k_buffer_capacity * sizeof(event_variant_t));
+}
+
+// Writes the repetitions of the benchmarks to a capture, to be compared
+// against by later runs.
+static void
+save_baseline(const timeline& source, const std::string& path) noexcept {
+    binary_capture_sink sink{ path };
+    for (const auto& e : source)
+        sink.consume(std::span{ &e, 1 });
+}
+
+// Compares the repetitions of the benchmarks against those of a capture
+// saved by an earlier run, and prints the report.
+static bool
+compare_baseline(const timeline& source, const std::string& path) noexcept {
+    binary_capture_reader reader{ path };
+    if (!reader.good()) {
+        std::fprintf(stderr, "could not read the baseline %s\n", path.c_str());
+        return false;
+    }
+
+    auto baseline = reader.read_timeline();
+    comparison_options options;
+    options.call_paths = false;
+    auto comparison = timeline_comparison::compare(baseline, source, options);
+    std::printf("\n%s", comparison.json().c_str());
+    return !comparison.regressed();
+}
+
+int
+main(int argc, char** argv) {
+    for (std::size_t threads = 1; threads <= 64; threads *= 2)
+        register_contention(threads);
+
+    // Usage: benchmarks [filter] [--save=path] [--baseline=path]
+    std::string_view filter;
+    std::string save, baseline;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg{ argv[i] };
+        if (arg.starts_with("--save="))
+            save = arg.substr(7);
+        else if (arg.starts_with("--baseline="))
+            baseline = arg.substr(11);
+        else filter = arg;
+    }
+
+    auto results = benchmark_registry::run(filter);
+    print_benchmark_report(results);
+    print_memory_report();
+    if (save.empty() && baseline.empty())
+        return 0;
+
+    auto source = benchmark_timeline(results);
+    if (!save.empty())
+        save_baseline(source, save);
+    if (!baseline.empty() && !compare_baseline(source, baseline))
+        return 1;
+    return 0;
+}
@@ -55,6 +55,15 @@ parser.add_argument(
     help="Configures the build to include the example."
 )
 
+parser.add_argument(
+    "--include-benchmarks",
+    default=False,
+    action="store_true",
+    dest="benchmarks",
+    required=False,
+    help="Configures the build to include the benchmarks."
+)
+
 clargs = parser.parse_args()
 
 arguments: [str] = []
@@ -71,6 +80,8 @@ if (clargs.configure == True):
     cmake_options.append(f"-DCMAKE_BUILD_TYPE={build_type}")
     if (clargs.example == True):
         cmake_options.append(f"-DMALUNAL_TOOLING_BUILD_EXAMPLE=ON")
+    if (clargs.benchmarks == True):
+        cmake_options.append(f"-DMALUNAL_TOOLING_BUILD_BENCHMARKS=ON")
 
     arguments.extend(cmake_options)
     arguments.extend(["-S", ".", "-B", "build"])
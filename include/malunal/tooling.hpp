@@ -4,31 +4,274 @@
 /// @copyright 2024 Malunal Studios, LLC.
 #pragma once
 #include "tooling/common.hpp"
+#include "tooling/names.hpp"
 #include "tooling/events.hpp"
+#include "tooling/clocks.hpp"
+#include "tooling/stats.hpp"
+#include "tooling/storage.hpp"
+#include "tooling/parallel.hpp"
 #include "tooling/timeline.hpp"
+#include "tooling/buffers.hpp"
+#include "tooling/output.hpp"
 #include "tooling/visitors.hpp"
+#include "tooling/call_tree.hpp"
+#include "tooling/compare.hpp"
+#include "tooling/sinks.hpp"
+#include "tooling/capture.hpp"
+#include "tooling/compressed.hpp"
+#include "tooling/mapped.hpp"
+#include "tooling/index.hpp"
 #include "tooling/profiler.hpp"
+#include "tooling/allocations.hpp"
 #include "tooling/probes.hpp"
+#include "tooling/pmu.hpp"
+#include "tooling/async.hpp"
+#include "tooling/sampling.hpp"
+#include "tooling/static_probes.hpp"
 #include "tooling/utilities.hpp"
+#include "tooling/benchmark.hpp"
 
 /// @def     MALUNAL_TOOLING_MEASURE_SCOPE(name)
 /// @brief   Measures the timing of an arbitrary scope.
 /// @details Calls into the tooling library to capture the timing for the given
 ///          scope and provides it to the tooling library profiler when the
-///          scope closes.
+///          scope closes. A string literal name is interned once per call
+///          site, while any other name is interned every time the scope
+///          opens, see `MALUNAL_TOOLING_CALL_SITE_NAME`.
 /// @param   name The string name provided for the scope.
 /// @remarks MALUNAL_TOOLING_ENABLE_MACROS must be defined in order for this to
 ///          work, otherwise nothing will happen as the definition will expand
 ///          to nothing.
 
+/// @def     MALUNAL_TOOLING_MEASURE_FUNCTION
+/// @brief   Measures the timing of the enclosing function.
+/// @details The source location of the function is interned once, the first
+///          time the function runs, so later calls don't build any strings.
+/// @remarks MALUNAL_TOOLING_ENABLE_MACROS must be defined in order for this to
+///          work, otherwise nothing will happen as the definition will expand
+///          to nothing.
+
+/// @def     MALUNAL_TOOLING_MEASURE_SCOPE_IN(category, name)
+/// @brief   Measures the timing of an arbitrary scope, filed under the given
+///          categories.
+/// @details Nothing is measured unless one of the categories is enabled on the
+///          profiler when the scope opens. The name is interned the same way
+///          as by `MALUNAL_TOOLING_MEASURE_SCOPE`.
+/// @param   category The categories of the scope.
+/// @param   name The string name provided for the scope.
+/// @remarks MALUNAL_TOOLING_ENABLE_MACROS must be defined in order for this to
+///          work, otherwise nothing will happen as the definition will expand
+///          to nothing.
+
+/// @def     MALUNAL_TOOLING_MEASURE_FUNCTION_IN(category)
+/// @brief   Measures the timing of the enclosing function, filed under the
+///          given categories.
+/// @param   category The categories of the function.
+/// @remarks MALUNAL_TOOLING_ENABLE_MACROS must be defined in order for this to
+///          work, otherwise nothing will happen as the definition will expand
+///          to nothing.
+
+/// @def     MALUNAL_TOOLING_MEASURE_SCOPE_STATIC(name)
+/// @brief   Measures the timing of an arbitrary scope with a probe whose name
+///          is fixed at compile time.
+/// @details The name is interned before `main`, so measuring the scope costs
+///          no more than reading the clock twice and recording the event.
+/// @param   name The string literal name provided for the scope.
+/// @remarks MALUNAL_TOOLING_ENABLE_MACROS must be defined in order for this to
+///          work, otherwise nothing will happen as the definition will expand
+///          to nothing.
+
+/// @def     MALUNAL_TOOLING_MEASURE_SCOPE_EVERY(n, name)
+/// @brief   Measures the timing of one in every N runs of an arbitrary scope,
+///          on each thread.
+/// @details The name is interned the same way as by
+///          `MALUNAL_TOOLING_MEASURE_SCOPE`.
+/// @param   n The number of runs each measurement stands for.
+/// @param   name The string name provided for the scope.
+/// @remarks MALUNAL_TOOLING_ENABLE_MACROS must be defined in order for this to
+///          work, otherwise nothing will happen as the definition will expand
+///          to nothing.
+
+/// @def     MALUNAL_TOOLING_MEASURE_SCOPE_SAMPLED(probability, name)
+/// @brief   Measures the timing of an arbitrary scope with the given
+///          probability.
+/// @details The name is interned the same way as by
+///          `MALUNAL_TOOLING_MEASURE_SCOPE`.
+/// @param   probability The chance of each run being measured.
+/// @param   name The string name provided for the scope.
+/// @remarks MALUNAL_TOOLING_ENABLE_MACROS must be defined in order for this to
+///          work, otherwise nothing will happen as the definition will expand
+///          to nothing.
+
+/// @def     MALUNAL_TOOLING_MEASURE_SCOPE_LIMITED(per_second, name)
+/// @brief   Measures the timing of an arbitrary scope at most the given
+///          number of times per second, across every thread.
+/// @details The name is interned the same way as by
+///          `MALUNAL_TOOLING_MEASURE_SCOPE`.
+/// @param   per_second The number of runs that may be measured each second.
+/// @param   name The string name provided for the scope.
+/// @remarks MALUNAL_TOOLING_ENABLE_MACROS must be defined in order for this to
+///          work, otherwise nothing will happen as the definition will expand
+///          to nothing.
+
+/// @def     MALUNAL_TOOLING_COUNTER(name, value)
+/// @brief   Records the current value of a counter, or a gauge.
+/// @details A string literal name is interned once per call site, the first
+///          time it runs, while any other name is interned on every call, see
+///          `MALUNAL_TOOLING_CALL_SITE_NAME`.
+/// @param   name The string name provided for the counter.
+/// @param   value The value of the counter at this time.
+/// @remarks MALUNAL_TOOLING_ENABLE_MACROS must be defined in order for this to
+///          work, otherwise nothing will happen as the definition will expand
+///          to nothing.
+
+/// @def     MALUNAL_TOOLING_INSTANT(name)
+/// @brief   Records that something happened at this point in time.
+/// @details The name is interned the same way as by
+///          `MALUNAL_TOOLING_COUNTER`.
+/// @param   name The string name provided for the instant.
+/// @remarks MALUNAL_TOOLING_ENABLE_MACROS must be defined in order for this to
+///          work, otherwise nothing will happen as the definition will expand
+///          to nothing.
+
+/// @def     MALUNAL_TOOLING_FLOW_BEGIN(name, id)
+/// @brief   Records that the piece of work with the given identifier has
+///          started on this thread.
+/// @details `MALUNAL_TOOLING_FLOW_STEP` and `MALUNAL_TOOLING_FLOW_END` take the
+///          same arguments, and record the piece of work reaching a thread and
+///          finishing on it. The name is interned the same way as by
+///          `MALUNAL_TOOLING_COUNTER`.
+/// @param   name The string name provided for the flow.
+/// @param   id The identifier shared by every step of the piece of work.
+/// @remarks MALUNAL_TOOLING_ENABLE_MACROS must be defined in order for this to
+///          work, otherwise nothing will happen as the definition will expand
+///          to nothing.
+
+/// @def     MALUNAL_TOOLING_BENCHMARK(fn)
+/// @brief   Defines a benchmark and registers it with the benchmark registry.
+/// @details The macro starts the definition of a function taking the state of
+///          the benchmark, and is followed by its body:
+///
+///          @code{.cpp}
+///          MALUNAL_TOOLING_BENCHMARK(bm_parse) {
+///              for (auto _ : state)
+///                  malunal::tooling::do_not_optimize(parse(input));
+///          }
+///          @endcode
+/// @param   fn The name of the benchmark function.
+/// @remarks Unlike the measuring macros, this is defined whether or not
+///          MALUNAL_TOOLING_ENABLE_MACROS is, since benchmarks are never
+///          compiled into the code being measured.
+#define MALUNAL_TOOLING_BENCHMARK(fn)                                     \
+    static void fn(malunal::tooling::benchmark_state& state);             \
+    [[maybe_unused]] static const bool fn##_registered =                  \
+        malunal::tooling::benchmark_registry::add(#fn, fn);               \
+    static void fn([[maybe_unused]] malunal::tooling::benchmark_state& state)
+
+/// @def     MALUNAL_TOOLING_BENCHMARK_WITH(fn, options)
+/// @brief   Defines a benchmark like `MALUNAL_TOOLING_BENCHMARK`, run with the
+///          given options.
+/// @param   fn The name of the benchmark function.
+/// @param   options The `benchmark_options` the benchmark is run with.
+#define MALUNAL_TOOLING_BENCHMARK_WITH(fn, options)                       \
+    static void fn(malunal::tooling::benchmark_state& state);             \
+    [[maybe_unused]] static const bool fn##_registered =                  \
+        malunal::tooling::benchmark_registry::add(#fn, fn, options);      \
+    static void fn([[maybe_unused]] malunal::tooling::benchmark_state& state)
+
+/// @def     MALUNAL_TOOLING_CALL_SITE_NAME(name)
+/// @brief   Gets the name a measuring macro should give its probe.
+/// @details A string literal is interned once per call site, into a function
+///          local static, and its identifier is given instead. Any other name,
+///          such as a `std::string` or a `const char*`, is given as it is on
+///          every call, since it may be different each time.
+/// @remarks Any array of constant characters is taken for a literal, so an
+///          array on the stack whose contents change from call to call should
+///          be given as a `std::string_view` instead.
+/// @param   name The name given to the measuring macro.
+#define MALUNAL_TOOLING_CALL_SITE_NAME(name)                              \
+    []<typename dtp_name_t>(dtp_name_t&& dtp_name) noexcept               \
+        -> decltype(auto) {                                               \
+        if constexpr (malunal::tooling::detail::LiteralName<dtp_name_t&&>) { \
+            static const malunal::tooling::detail::literal_name           \
+                dtp_literal{ dtp_name };                                  \
+            return dtp_literal.resolve(dtp_name);                         \
+        } else {                                                          \
+            return std::forward<dtp_name_t>(dtp_name);                    \
+        }                                                                 \
+    }(name)
+
 #ifdef MALUNAL_TOOLING_ENABLE_MACROS
-#define MALUNAL_TOOLING_MEASURE_SCOPE(name) \
-    malunal::tooling::deferred_timing_probe dtp(name)
+#define MALUNAL_TOOLING_MEASURE_SCOPE(name)      \
+    malunal::tooling::deferred_timing_probe dtp( \
+        MALUNAL_TOOLING_CALL_SITE_NAME(name))
+
+#define MALUNAL_TOOLING_MEASURE_FUNCTION            \
+    static const auto dtp_name =                    \
+        malunal::tooling::intern_source_location(); \
+    malunal::tooling::deferred_timing_probe dtp(dtp_name)
+
+#define MALUNAL_TOOLING_MEASURE_SCOPE_IN(category, name) \
+    malunal::tooling::deferred_timing_probe dtp(          \
+        MALUNAL_TOOLING_CALL_SITE_NAME(name), category)
+
+#define MALUNAL_TOOLING_MEASURE_FUNCTION_IN(category) \
+    static const auto dtp_name =                      \
+        malunal::tooling::intern_source_location();   \
+    malunal::tooling::deferred_timing_probe dtp(dtp_name, category)
+
+#define MALUNAL_TOOLING_MEASURE_SCOPE_STATIC(name) \
+    malunal::tooling::static_timing_probe<name> dtp
+
+#define MALUNAL_TOOLING_MEASURE_SCOPE_EVERY(n, name)                 \
+    static thread_local malunal::tooling::every_nth_sampler           \
+        dtp_sampler{ n };                                             \
+    malunal::tooling::sampled_timing_probe dtp(                       \
+        dtp_sampler, MALUNAL_TOOLING_CALL_SITE_NAME(name))
+
+#define MALUNAL_TOOLING_MEASURE_SCOPE_SAMPLED(probability, name)     \
+    static const malunal::tooling::probability_sampler                \
+        dtp_sampler{ probability };                                   \
+    malunal::tooling::sampled_timing_probe dtp(                       \
+        dtp_sampler, MALUNAL_TOOLING_CALL_SITE_NAME(name))
+
+#define MALUNAL_TOOLING_MEASURE_SCOPE_LIMITED(per_second, name)      \
+    static malunal::tooling::token_bucket_sampler                     \
+        dtp_sampler{ per_second };                                    \
+    malunal::tooling::sampled_timing_probe dtp(                       \
+        dtp_sampler, MALUNAL_TOOLING_CALL_SITE_NAME(name))
+
+#define MALUNAL_TOOLING_COUNTER(name, value)                         \
+    malunal::tooling::counter_probe<>{                                \
+        MALUNAL_TOOLING_CALL_SITE_NAME(name) }.record(value)
+
+#define MALUNAL_TOOLING_INSTANT(name)                                \
+    malunal::tooling::instant_probe<>{                                \
+        MALUNAL_TOOLING_CALL_SITE_NAME(name) }.record()
+
+#define MALUNAL_TOOLING_FLOW_BEGIN(name, id)                         \
+    malunal::tooling::flow_probe<>{                                   \
+        MALUNAL_TOOLING_CALL_SITE_NAME(name) }.begin(id)
+
+#define MALUNAL_TOOLING_FLOW_STEP(name, id)                          \
+    malunal::tooling::flow_probe<>{                                   \
+        MALUNAL_TOOLING_CALL_SITE_NAME(name) }.step(id)
 
-#define MALUNAL_TOOLING_MEASURE_FUNCTION    \
-    malunal::tooling::deferred_timing_probe \
-        dtp(malunal::tooling::current_source_location())
+#define MALUNAL_TOOLING_FLOW_END(name, id)                           \
+    malunal::tooling::flow_probe<>{                                   \
+        MALUNAL_TOOLING_CALL_SITE_NAME(name) }.end(id)
 #else
 #define MALUNAL_TOOLING_MEASURE_SCOPE(name)
 #define MALUNAL_TOOLING_MEASURE_FUNCTION
+#define MALUNAL_TOOLING_MEASURE_SCOPE_IN(category, name)
+#define MALUNAL_TOOLING_MEASURE_FUNCTION_IN(category)
+#define MALUNAL_TOOLING_MEASURE_SCOPE_STATIC(name)
+#define MALUNAL_TOOLING_MEASURE_SCOPE_EVERY(n, name)
+#define MALUNAL_TOOLING_MEASURE_SCOPE_SAMPLED(probability, name)
+#define MALUNAL_TOOLING_MEASURE_SCOPE_LIMITED(per_second, name)
+#define MALUNAL_TOOLING_COUNTER(name, value)
+#define MALUNAL_TOOLING_INSTANT(name)
+#define MALUNAL_TOOLING_FLOW_BEGIN(name, id)
+#define MALUNAL_TOOLING_FLOW_STEP(name, id)
+#define MALUNAL_TOOLING_FLOW_END(name, id)
 #endif /* MALUNAL_TOOLING_ENABLE_MACROS */
@@ -0,0 +1,374 @@
+/// @file   allocations.hpp
+/// @brief  Contains the tracking of heap allocations made by measured scopes.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+namespace detail {
+
+/// @brief   The number of allocations made by a thread, and their size.
+struct allocation_counters final {
+    std::uint64_t count;
+    std::uint64_t bytes;
+};
+
+/// @brief   Gets the allocation counters of the calling thread.
+/// @returns The counters of the calling thread.
+inline allocation_counters&
+local_allocations() noexcept {
+    static thread_local allocation_counters counters{ 0, 0 };
+    return counters;
+}
+
+/// @brief   Counts an allocation made by the calling thread.
+/// @details Called by the allocation hooks, for every allocation.
+/// @param   size The number of bytes that were asked for.
+inline void
+note_allocation(std::size_t size) noexcept {
+    auto& counters = local_allocations();
+    counters.count++;
+    counters.bytes += size;
+}
+
+#ifdef MALUNAL_TOOLING_TRACK_ALLOCATIONS
+/// @brief   Tracks the allocations made within the scope of a timing probe.
+/// @details The live scopes of each thread form a chain, innermost first. When
+///          a scope ends it hands everything it counted to the scope around
+///          it, which leaves those allocations out of its own, so each one is
+///          only attributed to the innermost scope it was made in. The scopes
+///          of a thread must therefore end in the reverse order they began,
+///          as they do when the probes are local variables.
+class allocation_scope final {
+public:
+    /// @brief   Makes this the innermost scope of the calling thread.
+    void
+    begin() noexcept {
+        // Create the buffer of the thread now, so it isn't counted as one of
+        // the allocations of the scope.
+        static_cast<void>(profiler::thread_index());
+        parent_ = current();
+        current() = this;
+        start_ = local_allocations();
+    }
+
+    /// @brief   Ends this scope, recording its timing event and then the
+    ///          allocations attributed to it, if there were any.
+    /// @param   timing The timing event of the scope.
+    void
+    record(const timing_event& timing) noexcept {
+        auto counters = local_allocations();
+        auto count = counters.count - start_.count;
+        auto bytes = counters.bytes - start_.bytes;
+        current() = parent_;
+        if (parent_ != nullptr) {
+            parent_->nested_.count += count;
+            parent_->nested_.bytes += bytes;
+        }
+
+        count -= nested_.count;
+        bytes -= nested_.bytes;
+        auto& tool = profiler::instance();
+        tool.record_event(timing);
+        if (count != 0) {
+            constexpr std::uint64_t k_max = std::numeric_limits<std::uint32_t>::max();
+            auto flags = timing.flags;
+            if (count > k_max || bytes > k_max)
+                flags |= event_flags::saturated;
+
+            tool.record_event(allocation_event {
+                .name  = timing.name,
+                .tid   = timing.tid,
+                .flags = flags,
+                .when  = timing.start,
+                .count = static_cast<std::uint32_t>(std::min(count, k_max)),
+                .bytes = static_cast<std::uint32_t>(std::min(bytes, k_max))
+            });
+        }
+
+        // Whatever the profiler allocated to record the events belongs to
+        // none of the scopes.
+        if (parent_ != nullptr) {
+            auto after = local_allocations();
+            parent_->nested_.count += after.count - counters.count;
+            parent_->nested_.bytes += after.bytes - counters.bytes;
+        }
+    }
+
+private:
+    static allocation_scope*&
+    current() noexcept {
+        static thread_local allocation_scope* scope = nullptr;
+        return scope;
+    }
+
+    allocation_scope* parent_{ nullptr };
+    allocation_counters start_{ 0, 0 };
+    allocation_counters nested_{ 0, 0 };
+};
+#else
+/// @brief   Stands in for the tracking of allocations when it isn't enabled,
+///          and takes no space in the probes.
+struct allocation_scope final {
+    void
+    begin() noexcept { }
+
+    void
+    record(const timing_event& timing) noexcept {
+        profiler::instance().record_event(timing);
+    }
+};
+#endif /* MALUNAL_TOOLING_TRACK_ALLOCATIONS */
+
+/// @brief   Allocates memory for the allocation hooks, counting it first.
+/// @param   size The number of bytes to allocate.
+/// @param   alignment The alignment of the memory, or zero for the default.
+/// @returns The memory, or null if it couldn't be allocated.
+inline void*
+try_allocate(std::size_t size, std::size_t alignment = 0) noexcept {
+    note_allocation(size);
+    if (size == 0)
+        size = 1;
+    if (alignment == 0)
+        return std::malloc(size);
+
+#if defined(_MSC_VER)
+    return _aligned_malloc(size, alignment);
+#else
+    // The size given to aligned_alloc must be a multiple of the alignment.
+    size = (size + alignment - 1) / alignment * alignment;
+    return std::aligned_alloc(alignment, size);
+#endif
+}
+
+/// @brief   Allocates memory for the allocation hooks, calling the new handler
+///          until it succeeds, as `operator new` must.
+/// @param   size The number of bytes to allocate.
+/// @param   alignment The alignment of the memory, or zero for the default.
+/// @returns The memory.
+/// @remarks This throws `std::bad_alloc` when there's no new handler left.
+inline void*
+allocate(std::size_t size, std::size_t alignment = 0) {
+    while (true) {
+        if (auto memory = try_allocate(size, alignment))
+            return memory;
+
+        auto handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc{ };
+        handler();
+    }
+}
+
+/// @brief   Frees memory allocated by the allocation hooks.
+/// @param   memory The memory to free.
+/// @param   aligned Whether the memory was allocated with an alignment.
+inline void
+deallocate(void* memory, bool aligned = false) noexcept {
+#if defined(_MSC_VER)
+    if (aligned) {
+        _aligned_free(memory);
+        return;
+    }
+#endif
+    static_cast<void>(aligned);
+    std::free(memory);
+}
+
+} // namespace malunal::tooling::detail
+
+/// @brief   The heap allocations of every scope of the same name, added up.
+struct allocation_totals final {
+    /// @brief   The number of scopes that allocated at all.
+    std::uint64_t scopes{ 0 };
+
+    /// @brief   The number of scopes left out of the totals because their
+    ///          count or bytes saturated.
+    std::uint64_t saturated{ 0 };
+
+    /// @brief   The number of allocations made by the scopes.
+    std::uint64_t count{ 0 };
+
+    /// @brief   The number of bytes the scopes asked to allocate.
+    std::uint64_t bytes{ 0 };
+
+    /// @brief   Gets the average size of the allocations.
+    /// @returns The average number of bytes of each allocation, or zero if
+    ///          nothing was allocated.
+    double
+    average_size() const noexcept {
+        if (count == 0)
+            return 0.0;
+        return static_cast<double>(bytes) / static_cast<double>(count);
+    }
+};
+
+/// @brief   A visitor which adds up the allocations of every scope, by name.
+struct allocation_statistics_visitor final {
+    /// @brief   The totals of the allocations, keyed by the name of the scopes.
+    std::unordered_map<name_id_t, allocation_totals> totals;
+
+    /// @brief   Adds a visited allocation event to the totals of its name.
+    /// @param   timeline_event The event being visited.
+    void
+    visit(const event_variant_t& timeline_event) noexcept {
+        auto allocation = std::get_if<allocation_event>(&timeline_event);
+        if (allocation == nullptr)
+            return;
+
+        auto& entry = totals[allocation->name];
+        if (allocation->flags & event_flags::saturated) {
+            entry.saturated++;
+            return;
+        }
+
+        entry.scopes++;
+        entry.count += allocation->count;
+        entry.bytes += allocation->bytes;
+    }
+
+    /// @brief   Adds the totals of another visitor into this one.
+    /// @param   other The visitor which visited another part of the timeline.
+    void
+    merge(allocation_statistics_visitor&& other) noexcept {
+        for (const auto& [name, entry] : other.totals) {
+            auto& into = totals[name];
+            into.scopes    += entry.scopes;
+            into.saturated += entry.saturated;
+            into.count     += entry.count;
+            into.bytes     += entry.bytes;
+        }
+    }
+};
+
+} // namespace malunal::tooling
+
+/// @def     MALUNAL_TOOLING_DEFINE_ALLOCATION_HOOKS
+/// @brief   Replaces the global `operator new` and `operator delete` with ones
+///          that count every allocation for the probes.
+/// @details Define this before including the tooling in exactly one source
+///          file of the program, and define `MALUNAL_TOOLING_TRACK_ALLOCATIONS`
+///          everywhere to have the deferred timing probes record the
+///          allocations of their scopes. The hooks allocate with `malloc`.
+#ifdef MALUNAL_TOOLING_DEFINE_ALLOCATION_HOOKS
+void*
+operator new(std::size_t size) {
+    return malunal::tooling::detail::allocate(size);
+}
+
+void*
+operator new[](std::size_t size) {
+    return malunal::tooling::detail::allocate(size);
+}
+
+void*
+operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return malunal::tooling::detail::try_allocate(size);
+}
+
+void*
+operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return malunal::tooling::detail::try_allocate(size);
+}
+
+void*
+operator new(std::size_t size, std::align_val_t alignment) {
+    return malunal::tooling::detail::allocate(
+        size, static_cast<std::size_t>(alignment));
+}
+
+void*
+operator new[](std::size_t size, std::align_val_t alignment) {
+    return malunal::tooling::detail::allocate(
+        size, static_cast<std::size_t>(alignment));
+}
+
+void*
+operator new(
+    std::size_t size,
+    std::align_val_t alignment,
+    const std::nothrow_t&
+) noexcept {
+    return malunal::tooling::detail::try_allocate(
+        size, static_cast<std::size_t>(alignment));
+}
+
+void*
+operator new[](
+    std::size_t size,
+    std::align_val_t alignment,
+    const std::nothrow_t&
+) noexcept {
+    return malunal::tooling::detail::try_allocate(
+        size, static_cast<std::size_t>(alignment));
+}
+
+void
+operator delete(void* memory) noexcept {
+    malunal::tooling::detail::deallocate(memory);
+}
+
+void
+operator delete[](void* memory) noexcept {
+    malunal::tooling::detail::deallocate(memory);
+}
+
+void
+operator delete(void* memory, std::size_t) noexcept {
+    malunal::tooling::detail::deallocate(memory);
+}
+
+void
+operator delete[](void* memory, std::size_t) noexcept {
+    malunal::tooling::detail::deallocate(memory);
+}
+
+void
+operator delete(void* memory, const std::nothrow_t&) noexcept {
+    malunal::tooling::detail::deallocate(memory);
+}
+
+void
+operator delete[](void* memory, const std::nothrow_t&) noexcept {
+    malunal::tooling::detail::deallocate(memory);
+}
+
+void
+operator delete(void* memory, std::align_val_t) noexcept {
+    malunal::tooling::detail::deallocate(memory, true);
+}
+
+void
+operator delete[](void* memory, std::align_val_t) noexcept {
+    malunal::tooling::detail::deallocate(memory, true);
+}
+
+void
+operator delete(void* memory, std::size_t, std::align_val_t) noexcept {
+    malunal::tooling::detail::deallocate(memory, true);
+}
+
+void
+operator delete[](void* memory, std::size_t, std::align_val_t) noexcept {
+    malunal::tooling::detail::deallocate(memory, true);
+}
+
+void
+operator delete(
+    void* memory,
+    std::align_val_t,
+    const std::nothrow_t&
+) noexcept {
+    malunal::tooling::detail::deallocate(memory, true);
+}
+
+void
+operator delete[](
+    void* memory,
+    std::align_val_t,
+    const std::nothrow_t&
+) noexcept {
+    malunal::tooling::detail::deallocate(memory, true);
+}
+#endif /* MALUNAL_TOOLING_DEFINE_ALLOCATION_HOOKS */
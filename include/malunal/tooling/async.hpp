@@ -0,0 +1,450 @@
+/// @file   async.hpp
+/// @brief  Contains the probes for measuring coroutines across suspensions.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+namespace detail {
+
+/// @brief   Hands out the identifiers of async tasks.
+/// @returns The next identifier, never zero.
+inline std::uint32_t
+next_task_id() noexcept {
+    static std::atomic<std::uint32_t> next{ 1 };
+    auto id = next.fetch_add(1, std::memory_order_relaxed);
+    return id != 0 ? id : next.fetch_add(1, std::memory_order_relaxed);
+}
+
+/// @brief   Gets the awaiter of the given awaitable, the same way `co_await`
+///          does when there's no `await_transform` in the way.
+/// @tparam  Awaitable The type of the awaitable.
+/// @param   awaitable The awaitable to get the awaiter of.
+/// @returns The result of its `operator co_await`, or the awaitable itself if
+///          it doesn't have one.
+template<typename Awaitable>
+decltype(auto)
+get_awaiter(Awaitable&& awaitable) {
+    if constexpr (requires { std::forward<Awaitable>(awaitable).operator co_await(); })
+        return std::forward<Awaitable>(awaitable).operator co_await();
+    else if constexpr (requires { operator co_await(std::forward<Awaitable>(awaitable)); })
+        return operator co_await(std::forward<Awaitable>(awaitable));
+    else
+        return std::forward<Awaitable>(awaitable);
+}
+
+/// @brief   Wraps an awaiter so the given probe stops measuring while the
+///          coroutine is suspended on it.
+/// @details The probe is told before the awaiter gets to suspend, since by the
+///          time its `await_suspend` returns the coroutine may already have
+///          been resumed elsewhere, or even finished.
+/// @tparam  Awaiter The type of the awaiter; a reference when it's the operand
+///          of `co_await` itself, which lives until the coroutine resumes.
+/// @tparam  Probe The type of the probe.
+template<typename Awaiter, typename Probe>
+struct timed_awaiter {
+    Probe& probe;
+    Awaiter awaiter;
+
+    bool
+    await_ready() noexcept(noexcept(awaiter.await_ready())) {
+        return awaiter.await_ready();
+    }
+
+    template<typename Promise>
+    decltype(auto)
+    await_suspend(std::coroutine_handle<Promise> handle)
+        noexcept(noexcept(awaiter.await_suspend(handle))) {
+        probe.suspend();
+        return awaiter.await_suspend(handle);
+    }
+
+    decltype(auto)
+    await_resume() noexcept(noexcept(awaiter.await_resume())) {
+        probe.resume();
+        return awaiter.await_resume();
+    }
+};
+
+} // namespace malunal::tooling::detail
+
+/// @brief   A timing probe for a coroutine, or any other task that suspends and
+///          resumes, possibly on another thread.
+/// @details The time a task runs between two suspensions is a segment, and
+///          each segment is recorded as a timing event on the thread it ran on,
+///          flagged with `event_flags::async`. The segments of a task are
+///          linked by flow events carrying the identifier of the task, which
+///          begin with its first segment, step through the start of each later
+///          one, and end with the end of its last one. So the time spent on
+///          the CPU is the sum of its segments, and the wall time is the span
+///          of its flow; `async_task_visitor` works out both.
+///
+///          The probe starts its first segment as it is created and ends the
+///          task when destroyed. Awaiting through `timed` tells it about each
+///          suspension, as does deriving the promise of a coroutine from
+///          `timed_promise`.
+/// @tparam  Clock The clock source the probe reads time from.
+/// @remarks The probe is not thread safe; it relies on the suspensions and
+///          resumptions of the task being ordered, as they are for coroutines.
+template<detail::ClockSource Clock = default_clock_source>
+class async_timing_probe final {
+public:
+    /// @brief   Creates a new probe for a task, and starts its first segment.
+    /// @param   name The interned name of the task.
+    /// @param   category The categories the task is filed under; it is only
+    ///          recorded if one of them is enabled when the probe is created.
+    async_timing_probe(
+        name_id_t name,
+        category_t category = categories::general
+    ) noexcept
+        : name_{ name }
+        , active_{ profiler::enabled(category) }
+        , id_{ active_ ? detail::next_task_id() : 0 }
+    {
+        resume();
+    }
+
+    /// @brief   Creates a new probe for a task, and starts its first segment.
+    /// @param   name The name of the task; it will be interned if it hasn't
+    ///          been already, and the probe is enabled.
+    /// @param   category The categories the task is filed under; it is only
+    ///          recorded if one of them is enabled when the probe is created.
+    async_timing_probe(
+        std::string_view name,
+        category_t category = categories::general
+    ) noexcept
+        : name_{ 0 }
+        , active_{ profiler::enabled(category) }
+        , id_{ active_ ? detail::next_task_id() : 0 }
+    {
+        if (!active_)
+            return;
+
+        name_ = name_registry::intern(name);
+        resume();
+    }
+
+    /// @brief   Ends the task, if it hasn't been already.
+    ~async_timing_probe() noexcept {
+        finish();
+    }
+
+    async_timing_probe(const async_timing_probe&) = delete;
+    async_timing_probe& operator=(const async_timing_probe&) = delete;
+
+    /// @brief   Ends the current segment, as the task is about to suspend.
+    void
+    suspend() noexcept {
+        if (!running_)
+            return;
+
+        // Pull this immediately to correctly represent timing.
+        auto end = Clock::now();
+        running_ = false;
+        last_end_ = end;
+        profiler::instance().record_event(timing_event {
+            .name     = name_,
+            .tid      = tid_,
+            .flags    = static_cast<std::uint16_t>(Clock::k_flags | event_flags::async),
+            .start    = start_,
+            .duration = end - start_
+        });
+    }
+
+    /// @brief   Starts a new segment on the calling thread, as the task has
+    ///          just resumed on it.
+    void
+    resume() noexcept {
+        if (!active_ || running_ || finished_)
+            return;
+
+        tid_ = profiler::thread_index();
+        start_ = Clock::now();
+        running_ = true;
+        record_flow(begun_ ? flow_phase::step : flow_phase::begin, start_);
+        begun_ = true;
+    }
+
+    /// @brief   Ends the current segment and the task; the probe records nothing
+    ///          else afterwards.
+    void
+    finish() noexcept {
+        if (!active_ || finished_)
+            return;
+
+        suspend();
+        finished_ = true;
+        if (begun_)
+            record_flow(flow_phase::end, last_end_);
+    }
+
+    /// @brief   Gets the identifier of the task.
+    /// @returns The identifier carried by the flow events of the task, or zero
+    ///          if the probe isn't recording.
+    std::uint32_t
+    id() const noexcept {
+        return id_;
+    }
+
+    /// @brief   Checks if a segment of the task is running.
+    /// @returns True if the task has resumed and not suspended since; false
+    ///          otherwise.
+    bool
+    running() const noexcept {
+        return running_;
+    }
+
+private:
+    void
+    record_flow(flow_phase phase, tick_t when) noexcept {
+        profiler::instance().record_event(flow_event {
+            .name  = name_,
+            .tid   = tid_,
+            .flags = static_cast<std::uint16_t>(Clock::k_flags | event_flags::async),
+            .when  = when,
+            .id    = id_,
+            .phase = phase
+        });
+    }
+
+    name_id_t name_;
+    bool active_;
+    bool running_{ false };
+    bool begun_{ false };
+    bool finished_{ false };
+    thread_index_t tid_{ 0 };
+    std::uint32_t id_;
+    tick_t start_{ 0 };
+    tick_t last_end_{ 0 };
+};
+
+/// @brief   Awaits the given awaitable, telling the given probe when the task
+///          suspends and resumes on it.
+/// @details Used as `co_await timed(probe, socket.read())`.
+/// @tparam  Clock The clock source of the probe.
+/// @tparam  Awaitable The type of the awaitable.
+/// @param   probe The probe of the task that is awaiting.
+/// @param   awaitable The awaitable the task awaits.
+/// @returns An awaiter which forwards to the awaiter of the awaitable.
+template<detail::ClockSource Clock, typename Awaitable>
+auto
+timed(async_timing_probe<Clock>& probe, Awaitable&& awaitable) {
+    using awaiter_t = decltype(detail::get_awaiter(std::forward<Awaitable>(awaitable)));
+    return detail::timed_awaiter<awaiter_t, async_timing_probe<Clock>> {
+        probe, detail::get_awaiter(std::forward<Awaitable>(awaitable))
+    };
+}
+
+/// @brief   A base for the promise type of a coroutine, which measures the
+///          coroutine with an async timing probe.
+/// @details Every `co_await` in the coroutine goes through `await_transform`,
+///          which ends the segment before it suspends and starts another when
+///          it resumes. The first segment starts when the promise is created,
+///          so a lazily started coroutine should wrap its initial suspension
+///          with `timed`, as should one that stays suspended at its end, so the
+///          time spent waiting there isn't counted:
+///
+///          @code{.cpp}
+///          struct promise_type : malunal::tooling::timed_promise<> {
+///              promise_type() : timed_promise{ "fetch" } { }
+///              auto initial_suspend() { return timed(std::suspend_always{ }); }
+///              auto final_suspend() noexcept { return timed(std::suspend_always{ }); }
+///              // ...
+///          };
+///          @endcode
+/// @tparam  Clock The clock source the probe reads time from.
+template<detail::ClockSource Clock = default_clock_source>
+class timed_promise {
+public:
+    /// @brief   Creates the promise, and starts measuring the coroutine.
+    /// @param   name The interned name of the coroutine.
+    /// @param   category The categories the coroutine is filed under.
+    explicit timed_promise(
+        name_id_t name,
+        category_t category = categories::general
+    ) noexcept
+        : probe_{ name, category }
+    { }
+
+    /// @brief   Creates the promise, and starts measuring the coroutine.
+    /// @param   name The name of the coroutine.
+    /// @param   category The categories the coroutine is filed under.
+    explicit timed_promise(
+        std::string_view name,
+        category_t category = categories::general
+    ) noexcept
+        : probe_{ name, category }
+    { }
+
+    /// @brief   Measures around every suspension of the coroutine.
+    /// @tparam  Awaitable The type of the awaitable.
+    /// @param   awaitable The awaitable the coroutine awaits.
+    /// @returns An awaiter which forwards to the awaiter of the awaitable.
+    template<typename Awaitable>
+    auto
+    await_transform(Awaitable&& awaitable) {
+        return timed(std::forward<Awaitable>(awaitable));
+    }
+
+    /// @brief   Measures around the given awaitable, for the awaits that don't
+    ///          go through `await_transform`.
+    /// @tparam  Awaitable The type of the awaitable.
+    /// @param   awaitable The awaitable the coroutine awaits.
+    /// @returns An awaiter which forwards to the awaiter of the awaitable.
+    template<typename Awaitable>
+    auto
+    timed(Awaitable&& awaitable) {
+        return tooling::timed(probe_, std::forward<Awaitable>(awaitable));
+    }
+
+    /// @brief   Gets the probe measuring the coroutine.
+    /// @returns The probe of the coroutine.
+    async_timing_probe<Clock>&
+    probe() noexcept {
+        return probe_;
+    }
+
+private:
+    async_timing_probe<Clock> probe_;
+};
+
+/// @brief   The time spent by every task of the same name, added up.
+struct async_totals final {
+    /// @brief   The number of tasks that finished.
+    std::uint64_t tasks{ 0 };
+
+    /// @brief   The number of segments the tasks ran in.
+    std::uint64_t segments{ 0 };
+
+    /// @brief   The time from the start of each task to its end, in ticks of
+    ///          `perf_clock_t`.
+    tick_t wall{ 0 };
+
+    /// @brief   The time the tasks were running, in ticks of `perf_clock_t`.
+    tick_t active{ 0 };
+
+    /// @brief   Gets the time the tasks spent suspended.
+    /// @returns The wall time of the tasks less the time they were running.
+    tick_t
+    waiting() const noexcept {
+        return wall - active;
+    }
+};
+
+/// @brief   A visitor which works out the wall time and running time of every
+///          task measured by an async timing probe.
+/// @details The segments of a task are matched with its flow events by their
+///          thread and start, so the totals are only worked out when asked for,
+///          after everything has been visited. Tasks without the end of their
+///          flow are still running, and left out.
+class async_task_visitor final {
+public:
+    /// @brief   Collects a visited segment or flow event of an async task.
+    /// @param   timeline_event The event being visited.
+    void
+    visit(const event_variant_t& timeline_event) noexcept {
+        if (auto timing = std::get_if<timing_event>(&timeline_event)) {
+            if (timing->flags & event_flags::async)
+                segments_[{ timing->tid, timing->start }] = timing->duration;
+            return;
+        }
+
+        auto flow = std::get_if<flow_event>(&timeline_event);
+        if (flow == nullptr || !(flow->flags & event_flags::async))
+            return;
+
+        auto& entry = tasks_[flow->id];
+        entry.name = flow->name;
+        switch (flow->phase) {
+            case flow_phase::begin:
+                entry.begin = flow->when;
+                entry.begun = true;
+                entry.starts.push_back({ flow->tid, flow->when });
+                break;
+            case flow_phase::step:
+                entry.starts.push_back({ flow->tid, flow->when });
+                break;
+            case flow_phase::end:
+                entry.end = flow->when;
+                entry.ended = true;
+                break;
+        }
+    }
+
+    /// @brief   Adds the events collected by another visitor into this one.
+    /// @param   other The visitor which visited another part of the timeline.
+    void
+    merge(async_task_visitor&& other) noexcept {
+        segments_.merge(other.segments_);
+        for (auto& [id, entry] : other.tasks_) {
+            auto& into = tasks_[id];
+            into.name = entry.name;
+            if (entry.begun) {
+                into.begin = entry.begin;
+                into.begun = true;
+            }
+            if (entry.ended) {
+                into.end = entry.end;
+                into.ended = true;
+            }
+            into.starts.insert(into.starts.end(),
+                entry.starts.begin(), entry.starts.end());
+        }
+    }
+
+    /// @brief   Works out the totals of every finished task, by name.
+    /// @returns The totals, keyed by the name of the tasks.
+    std::unordered_map<name_id_t, async_totals>
+    totals() const noexcept {
+        std::unordered_map<name_id_t, async_totals> result;
+        for (const auto& [id, entry] : tasks_) {
+            if (!entry.begun || !entry.ended)
+                continue;
+
+            auto& into = result[entry.name];
+            into.tasks++;
+            into.wall += entry.end - entry.begin;
+            for (const auto& start : entry.starts) {
+                auto segment = segments_.find(start);
+                if (segment == segments_.end())
+                    continue;
+
+                into.segments++;
+                into.active += segment->second;
+            }
+        }
+
+        return result;
+    }
+
+private:
+    struct segment_key final {
+        thread_index_t tid;
+        tick_t start;
+
+        bool operator==(const segment_key&) const noexcept = default;
+    };
+
+    struct segment_hash final {
+        std::size_t
+        operator()(const segment_key& key) const noexcept {
+            return std::hash<tick_t>{ }(key.start) ^
+                (std::size_t{ key.tid } * 0x9e3779b97f4a7c15ull);
+        }
+    };
+
+    struct task final {
+        name_id_t name{ 0 };
+        tick_t begin{ 0 };
+        tick_t end{ 0 };
+        bool begun{ false };
+        bool ended{ false };
+        std::vector<segment_key> starts;
+    };
+
+    std::unordered_map<segment_key, tick_t, segment_hash> segments_;
+    std::unordered_map<std::uint32_t, task> tasks_;
+};
+
+} // namespace malunal::tooling
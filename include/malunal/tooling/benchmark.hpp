@@ -0,0 +1,695 @@
+/// @file   benchmark.hpp
+/// @brief  Contains the microbenchmark harness of the performance tooling.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+
+/// @brief   Keeps the compiler from optimizing away the computation of the
+///          given value.
+/// @details The value is treated as if it were read by something the compiler
+///          cannot see, so the code producing it has to run.
+/// @tparam  T The type of the value.
+/// @param   value The value that must be computed.
+template<typename T>
+inline void
+do_not_optimize(const T& value) noexcept {
+#if defined(_MSC_VER) && !defined(__clang__)
+    auto address = reinterpret_cast<const volatile char*>(&value);
+    static_cast<void>(*address);
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+/// @brief   Keeps the compiler from assuming anything about memory across this
+///          point.
+/// @details Every write before this call has to actually happen, and every
+///          read after it has to actually go to memory.
+inline void
+clobber_memory() noexcept {
+#if defined(_MSC_VER) && !defined(__clang__)
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : : "memory");
+#endif
+}
+
+/// @brief   Options that control how a benchmark is run.
+struct benchmark_options final {
+    /// @brief   How long each repetition should take; the number of
+    ///          iterations is scaled until it takes at least this long.
+    std::chrono::nanoseconds repetition_time{ std::chrono::milliseconds{ 10 } };
+
+    /// @brief   How long to keep running the benchmark, after scaling, before
+    ///          measuring anything.
+    std::chrono::nanoseconds warmup_time{ std::chrono::milliseconds{ 20 } };
+
+    /// @brief   How many repetitions are measured.
+    std::size_t repetitions{ 20 };
+
+    /// @brief   How many interquartile ranges a repetition may be away from
+    ///          the quartiles before it is rejected as an outlier.
+    /// @details Zero keeps every repetition.
+    double outlier_fence{ 1.5 };
+
+    /// @brief   The most iterations a single repetition may run.
+    std::uint64_t max_iterations{ 1'000'000'000 };
+
+    /// @brief   How many iterations are timed together when measuring the
+    ///          latency of each iteration.
+    /// @details When set, every repetition is run a second time with the
+    ///          clock read after each batch of this many iterations, and the
+    ///          time per iteration of every batch is counted in the latency
+    ///          histogram of the results. Each batch includes one read of the
+    ///          clock, so small batches show more of the tail but also more
+    ///          of the clock. Zero only measures the throughput.
+    std::uint64_t latency_batch{ 0 };
+};
+
+/// @brief   The state given to a benchmark while it runs.
+/// @details A benchmark loops over its state, and only the loop is timed:
+///
+///          @code{.cpp}
+///          void my_benchmark(benchmark_state& state) {
+///              auto data = setup();
+///              for (auto _ : state)
+///                  do_not_optimize(work(data));
+///          }
+///          @endcode
+struct benchmark_state final {
+    /// @brief   What the loop over the state yields for each iteration.
+    struct [[maybe_unused]] value final { };
+
+    /// @brief   Marks the end of the loop over the state.
+    struct sentinel final { };
+
+    /// @brief   Counts down the iterations of the loop over the state, and
+    ///          stops the timer when they run out.
+    struct iterator final {
+        value
+        operator*() const noexcept {
+            return { };
+        }
+
+        iterator&
+        operator++() noexcept {
+            --remaining;
+            if (state->latencies_ != nullptr && --state->batch_left_ == 0)
+                state->record_batch();
+            return *this;
+        }
+
+        bool
+        operator!=(sentinel) noexcept {
+            if (remaining != 0)
+                return true;
+
+            state->stop();
+            return false;
+        }
+
+        benchmark_state* state;
+        std::uint64_t remaining;
+    };
+
+    /// @brief   Creates the state of a run with the given number of
+    ///          iterations.
+    /// @param   iterations The number of times the loop should run.
+    explicit benchmark_state(std::uint64_t iterations) noexcept
+        : iterations_{ iterations }
+    { }
+
+    /// @brief   Starts the timer and the loop.
+    /// @returns The first iteration of the loop.
+    iterator
+    begin() noexcept {
+        started_ = true;
+        start_ = perf_clock_t::now();
+        first_start_ = start_;
+        batch_start_ = start_;
+        batch_left_ = batch_;
+        return { this, iterations_ };
+    }
+
+    /// @brief   Gets the end of the loop.
+    /// @returns The sentinel of the loop.
+    sentinel
+    end() const noexcept {
+        return { };
+    }
+
+    /// @brief   Stops the timer, for work inside the loop that shouldn't be
+    ///          measured.
+    void
+    pause_timing() noexcept {
+        elapsed_ += perf_clock_t::now() - start_;
+        paused_ = true;
+    }
+
+    /// @brief   Starts the timer again after `pause_timing`.
+    /// @remarks When measuring latencies, the batch interrupted by the pause
+    ///          is not counted.
+    void
+    resume_timing() noexcept {
+        paused_ = false;
+        start_ = perf_clock_t::now();
+        batch_start_ = start_;
+        batch_left_ = batch_;
+    }
+
+    /// @brief   Times every batch of the given number of iterations of the
+    ///          loop, and counts the time per iteration of each into the
+    ///          given histogram.
+    /// @param   histogram The histogram the latencies are counted in, which
+    ///          must outlive the loop.
+    /// @param   batch How many iterations are timed together.
+    void
+    measure_latency(latency_histogram& histogram, std::uint64_t batch) noexcept {
+        latencies_ = batch == 0 ? nullptr : &histogram;
+        batch_ = batch;
+    }
+
+    /// @brief   Sets how many items each iteration processes, to report the
+    ///          throughput of the benchmark.
+    /// @param   items The number of items per iteration.
+    void
+    set_items_per_iteration(std::uint64_t items) noexcept {
+        items_ = items;
+    }
+
+    /// @brief   Sets how many bytes each iteration processes, to report the
+    ///          throughput of the benchmark.
+    /// @param   bytes The number of bytes per iteration.
+    void
+    set_bytes_per_iteration(std::uint64_t bytes) noexcept {
+        bytes_ = bytes;
+    }
+
+    /// @brief   Gets the number of iterations of the loop.
+    /// @returns The number of iterations.
+    std::uint64_t
+    iterations() const noexcept {
+        return iterations_;
+    }
+
+    /// @brief   Gets how long the loop took, excluding paused time.
+    /// @returns The time measured.
+    perf_clock_t::duration
+    elapsed() const noexcept {
+        return elapsed_;
+    }
+
+    /// @brief   Checks whether the benchmark looped over the state at all.
+    /// @returns True if the loop was started; false otherwise.
+    bool
+    started() const noexcept {
+        return started_;
+    }
+
+    /// @brief   Gets the time the loop started.
+    /// @returns The time point the timer was first started.
+    time_point_t
+    start_time() const noexcept {
+        return first_start_;
+    }
+
+    /// @brief   Gets how many items each iteration processes.
+    /// @returns The number of items per iteration.
+    std::uint64_t
+    items_per_iteration() const noexcept {
+        return items_;
+    }
+
+    /// @brief   Gets how many bytes each iteration processes.
+    /// @returns The number of bytes per iteration.
+    std::uint64_t
+    bytes_per_iteration() const noexcept {
+        return bytes_;
+    }
+
+private:
+    void
+    stop() noexcept {
+        if (!paused_)
+            elapsed_ += perf_clock_t::now() - start_;
+    }
+
+    void
+    record_batch() noexcept {
+        auto now = perf_clock_t::now();
+        batch_left_ = batch_;
+        if (!paused_) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                now - batch_start_);
+            latencies_->record(static_cast<std::uint64_t>(elapsed.count()) /
+                batch_);
+        }
+
+        batch_start_ = now;
+    }
+
+private:
+    std::uint64_t iterations_;
+    std::uint64_t items_{ 0 };
+    std::uint64_t bytes_{ 0 };
+    time_point_t start_{ };
+    time_point_t first_start_{ };
+    perf_clock_t::duration elapsed_{ 0 };
+    latency_histogram* latencies_{ nullptr };
+    std::uint64_t batch_{ 0 };
+    std::uint64_t batch_left_{ 0 };
+    time_point_t batch_start_{ };
+    bool started_{ false };
+    bool paused_{ false };
+};
+
+/// @brief   A single measured repetition of a benchmark.
+struct benchmark_sample final {
+    /// @brief   When the repetition started.
+    time_point_t start;
+
+    /// @brief   The time each iteration took, on average, in nanoseconds.
+    double nanoseconds;
+
+    /// @brief   Whether the repetition was rejected as an outlier.
+    bool outlier;
+};
+
+/// @brief   The results of running a benchmark.
+struct benchmark_result final {
+    /// @brief   The name of the benchmark.
+    std::string name;
+
+    /// @brief   The number of iterations of each repetition.
+    std::uint64_t iterations{ 0 };
+
+    /// @brief   The items processed by each iteration.
+    std::uint64_t items_per_iteration{ 0 };
+
+    /// @brief   The bytes processed by each iteration.
+    std::uint64_t bytes_per_iteration{ 0 };
+
+    /// @brief   Every repetition, in the order they ran.
+    std::vector<benchmark_sample> samples;
+
+    /// @brief   The time per iteration of the repetitions that weren't
+    ///          rejected, in nanoseconds, sorted.
+    std::vector<double> kept;
+
+    /// @brief   The time per iteration of every batch timed on its own, in
+    ///          nanoseconds, if the benchmark was run with a latency batch.
+    latency_histogram latencies;
+
+    /// @brief   Checks whether the latency of the iterations was measured.
+    /// @returns True if the latency histogram counted anything.
+    bool
+    measured_latency() const noexcept {
+        return latencies.total != 0;
+    }
+
+    /// @brief   Gets the number of repetitions rejected as outliers.
+    /// @returns The number of outliers.
+    std::size_t
+    outliers() const noexcept {
+        return samples.size() - kept.size();
+    }
+
+    /// @brief   Gets the mean time per iteration.
+    /// @returns The mean, in nanoseconds, or zero if nothing was kept.
+    double
+    mean() const noexcept {
+        if (kept.empty())
+            return 0.0;
+
+        double sum = 0.0;
+        for (auto value : kept)
+            sum += value;
+        return sum / static_cast<double>(kept.size());
+    }
+
+    /// @brief   Gets the sample standard deviation of the time per iteration.
+    /// @returns The standard deviation, in nanoseconds.
+    double
+    stddev() const noexcept {
+        if (kept.size() < 2)
+            return 0.0;
+
+        auto m = mean();
+        double sum = 0.0;
+        for (auto value : kept)
+            sum += (value - m) * (value - m);
+        return std::sqrt(sum / static_cast<double>(kept.size() - 1));
+    }
+
+    /// @brief   Gets the time per iteration at the given percentile of the
+    ///          repetitions, interpolating between neighbours.
+    /// @param   percentile The percentile, between 0 and 100.
+    /// @returns The time per iteration, in nanoseconds.
+    double
+    percentile(double percentile) const noexcept {
+        if (kept.empty())
+            return 0.0;
+
+        auto rank = std::clamp(percentile, 0.0, 100.0) / 100.0 *
+                    static_cast<double>(kept.size() - 1);
+        auto lower = static_cast<std::size_t>(rank);
+        auto upper = std::min(lower + 1, kept.size() - 1);
+        auto fraction = rank - static_cast<double>(lower);
+        return kept[lower] + (kept[upper] - kept[lower]) * fraction;
+    }
+
+    /// @brief   Gets the fastest time per iteration that was kept.
+    /// @returns The minimum, in nanoseconds.
+    double
+    min() const noexcept {
+        return kept.empty() ? 0.0 : kept.front();
+    }
+
+    /// @brief   Gets the slowest time per iteration that was kept.
+    /// @returns The maximum, in nanoseconds.
+    double
+    max() const noexcept {
+        return kept.empty() ? 0.0 : kept.back();
+    }
+
+    /// @brief   Gets the number of items processed per second.
+    /// @returns The throughput, or zero if no items were set.
+    double
+    items_per_second() const noexcept {
+        auto m = mean();
+        if (m <= 0.0)
+            return 0.0;
+        return static_cast<double>(items_per_iteration) * 1e9 / m;
+    }
+
+    /// @brief   Gets the number of bytes processed per second.
+    /// @returns The throughput, or zero if no bytes were set.
+    double
+    bytes_per_second() const noexcept {
+        auto m = mean();
+        if (m <= 0.0)
+            return 0.0;
+        return static_cast<double>(bytes_per_iteration) * 1e9 / m;
+    }
+};
+
+/// @brief   The function a benchmark runs, looping over its state.
+using benchmark_function = std::function<void(benchmark_state&)>;
+
+namespace detail {
+
+inline double
+nanoseconds_per_iteration(const benchmark_state& state) noexcept {
+    auto elapsed = std::chrono::duration<double, std::nano>(state.elapsed());
+    return elapsed.count() / static_cast<double>(state.iterations());
+}
+
+/// @brief   Rejects the samples outside of the fences around the quartiles,
+///          and keeps the others.
+inline void
+reject_outliers(benchmark_result& result, double fence) noexcept {
+    std::vector<double> sorted;
+    for (const auto& sample : result.samples)
+        sorted.push_back(sample.nanoseconds);
+    std::sort(sorted.begin(), sorted.end());
+    result.kept = sorted;
+    if (fence <= 0.0 || sorted.size() < 4)
+        return;
+
+    auto q1  = result.percentile(25.0);
+    auto q3  = result.percentile(75.0);
+    auto iqr = q3 - q1;
+    auto low  = q1 - fence * iqr;
+    auto high = q3 + fence * iqr;
+
+    result.kept.clear();
+    for (auto& sample : result.samples) {
+        sample.outlier = sample.nanoseconds < low || sample.nanoseconds > high;
+        if (!sample.outlier)
+            result.kept.push_back(sample.nanoseconds);
+    }
+
+    std::sort(result.kept.begin(), result.kept.end());
+}
+
+} // namespace malunal::tooling::detail
+
+/// @brief   Runs the given benchmark.
+/// @details The number of iterations starts at one and grows until a single
+///          run of the benchmark takes the repetition time. The benchmark is
+///          then run for the warmup time without being measured, and finally
+///          measured for every repetition. Repetitions outside the outlier
+///          fence are rejected before computing the results. With a latency
+///          batch, the repetitions are run once more to time the batches of
+///          iterations on their own. A benchmark that doesn't loop over its
+///          state is measured as a single iteration.
+/// @param   name The name of the benchmark.
+/// @param   fn The benchmark to run.
+/// @param   options The options controlling how the benchmark is run.
+/// @returns The results of the benchmark.
+inline benchmark_result
+run_benchmark(
+    std::string_view name,
+    const benchmark_function& fn,
+    const benchmark_options& options = { }
+) noexcept {
+    benchmark_result result;
+    result.name = name;
+
+    // Scale the iterations until a run takes long enough to measure.
+    std::uint64_t iterations = 1;
+    for (;;) {
+        benchmark_state state{ iterations };
+        fn(state);
+        if (!state.started())
+            break;
+
+        auto elapsed = state.elapsed();
+        if (elapsed >= options.repetition_time ||
+            iterations >= options.max_iterations)
+            break;
+
+        auto ratio = elapsed.count() <= 0 ? 10.0 :
+            static_cast<double>(options.repetition_time.count()) /
+            static_cast<double>(std::chrono::duration_cast<
+                std::chrono::nanoseconds>(elapsed).count());
+        auto multiplier = std::clamp(ratio * 1.4, 1.1, 10.0);
+        iterations = std::min(options.max_iterations, std::max(iterations + 1,
+            static_cast<std::uint64_t>(static_cast<double>(iterations) *
+                multiplier)));
+    }
+
+    auto warmup_end = perf_clock_t::now() + options.warmup_time;
+    while (perf_clock_t::now() < warmup_end) {
+        benchmark_state state{ iterations };
+        fn(state);
+    }
+
+    result.iterations = iterations;
+    for (std::size_t r = 0; r < std::max<std::size_t>(options.repetitions, 1); r++) {
+        benchmark_state state{ iterations };
+        fn(state);
+        result.items_per_iteration = state.items_per_iteration();
+        result.bytes_per_iteration = state.bytes_per_iteration();
+        result.samples.push_back(benchmark_sample {
+            .start       = state.start_time(),
+            .nanoseconds = detail::nanoseconds_per_iteration(state),
+            .outlier     = false
+        });
+    }
+
+    // Time the batches in runs of their own, so the reads of the clock don't
+    // slow down the repetitions above.
+    if (options.latency_batch != 0) {
+        for (std::size_t r = 0; r < std::max<std::size_t>(options.repetitions, 1); r++) {
+            benchmark_state state{ iterations };
+            state.measure_latency(result.latencies, options.latency_batch);
+            fn(state);
+        }
+    }
+
+    detail::reject_outliers(result, options.outlier_fence);
+    return result;
+}
+
+/// @brief   Holds every benchmark registered with the harness.
+/// @details Benchmarks are usually registered at static initialization time,
+///          through `MALUNAL_TOOLING_BENCHMARK`, then run all at once from
+///          `main`.
+struct benchmark_registry final {
+    /// @brief   A benchmark registered with the harness.
+    struct entry final {
+        std::string name;
+        benchmark_function function;
+        benchmark_options options;
+    };
+
+    /// @brief   Registers the given benchmark.
+    /// @param   name The name of the benchmark.
+    /// @param   fn The benchmark to run.
+    /// @param   options The options controlling how the benchmark is run.
+    /// @returns Always true, so it can initialize a static variable.
+    static bool
+    add(
+        std::string name,
+        benchmark_function fn,
+        benchmark_options options = { }
+    ) noexcept {
+        auto& inst = instance();
+        std::lock_guard<std::mutex> lock(inst.mutex_);
+        inst.entries_.push_back(entry {
+            .name     = std::move(name),
+            .function = std::move(fn),
+            .options  = options
+        });
+        return true;
+    }
+
+    /// @brief   Runs the registered benchmarks, in the order they were
+    ///          registered.
+    /// @param   filter Only benchmarks whose name contains this are run.
+    /// @returns The results of each benchmark that was run.
+    static std::vector<benchmark_result>
+    run(std::string_view filter = { }) noexcept {
+        std::vector<entry> entries;
+        {
+            auto& inst = instance();
+            std::lock_guard<std::mutex> lock(inst.mutex_);
+            entries = inst.entries_;
+        }
+
+        std::vector<benchmark_result> results;
+        for (const auto& e : entries)
+            if (e.name.find(filter) != std::string::npos)
+                results.push_back(run_benchmark(e.name, e.function, e.options));
+        return results;
+    }
+
+    /// @brief   Gets the number of registered benchmarks.
+    /// @returns The number of benchmarks.
+    static std::size_t
+    size() noexcept {
+        auto& inst = instance();
+        std::lock_guard<std::mutex> lock(inst.mutex_);
+        return inst.entries_.size();
+    }
+
+private:
+    static benchmark_registry&
+    instance() noexcept {
+        static benchmark_registry k_instance;
+        return k_instance;
+    }
+
+    std::mutex mutex_;
+    std::vector<entry> entries_;
+};
+
+/// @brief   Writes a table of the given benchmark results.
+/// @param   results The results that should be reported.
+/// @param   output The buffer the table is written to.
+inline void
+write_benchmark_report(
+    std::span<const benchmark_result> results,
+    detail::output_buffer& output
+) noexcept {
+    output.append("benchmark,iterations,mean_ns,p50_ns,p90_ns,p99_ns,"
+        "stddev_ns,outliers,items_per_second,bytes_per_second,"
+        "latency_p50_ns,latency_p99_ns\n");
+    for (const auto& result : results) {
+        output.append(result.name);
+        output.append(',');
+        output.append_integer(result.iterations);
+        for (auto value : { result.mean(), result.percentile(50.0),
+                result.percentile(90.0), result.percentile(99.0),
+                result.stddev() }) {
+            output.append(',');
+            output.append_fixed(value);
+        }
+
+        output.append(',');
+        output.append_integer(result.outliers());
+        output.append(',');
+        output.append_fixed(result.items_per_second(), 0);
+        output.append(',');
+        output.append_fixed(result.bytes_per_second(), 0);
+        output.append(',');
+        if (result.measured_latency())
+            output.append_integer(result.latencies.percentile(50.0));
+        output.append(',');
+        if (result.measured_latency())
+            output.append_integer(result.latencies.percentile(99.0));
+        output.append('\n');
+    }
+}
+
+/// @brief   Formats a table of the given benchmark results.
+/// @details The table is written as comma separated values, one benchmark per
+///          line, with times in nanoseconds per iteration. The p50 and p99
+///          are of the repetitions, while the latency columns are of the
+///          batches timed on their own, and are left empty for benchmarks run
+///          without a latency batch.
+/// @param   results The results that should be reported.
+/// @returns The table.
+inline std::string
+benchmark_report(std::span<const benchmark_result> results) noexcept {
+    detail::output_buffer output;
+    write_benchmark_report(results, output);
+    return std::string{ output.view() };
+}
+
+/// @brief   Writes a table of the given benchmark results to a file.
+/// @param   results The results that should be reported.
+/// @param   file The file the table is written to.
+inline void
+print_benchmark_report(
+    std::span<const benchmark_result> results,
+    std::FILE* file = stdout
+) noexcept {
+    detail::output_buffer output{ file };
+    write_benchmark_report(results, output);
+    output.flush();
+}
+
+/// @brief   Converts the given benchmark results into a timeline.
+/// @details Each repetition that was kept becomes a timing event named after
+///          its benchmark, starting when the repetition started and lasting
+///          as long as one iteration took on average, so any visitor can
+///          export the results. The percentiles `statistics_visitor` finds
+///          for them come from its histogram, and are only accurate to within
+///          12.5 percent of those of the results themselves.
+/// @param   results The results that should be converted.
+/// @param   mode How the timeline should store its events.
+/// @returns The timeline of the results.
+inline timeline
+benchmark_timeline(
+    std::span<const benchmark_result> results,
+    storage_mode mode = storage_mode::events
+) noexcept {
+    timeline result{ mode };
+    for (const auto& benchmark : results) {
+        auto name = name_registry::intern(benchmark.name);
+        for (const auto& sample : benchmark.samples) {
+            if (sample.outlier)
+                continue;
+
+            auto duration = std::chrono::duration_cast<perf_clock_t::duration>(
+                std::chrono::duration<double, std::nano>(sample.nanoseconds));
+            result.push(timing_event {
+                .name     = name,
+                .tid      = 0,
+                .flags    = 0,
+                .start    = to_ticks(sample.start),
+                .duration = duration.count()
+            });
+        }
+    }
+
+    return result;
+}
+
+} // namespace malunal::tooling
@@ -0,0 +1,473 @@
+/// @file   buffers.hpp
+/// @brief  Contains the event buffers used by the performance tooling.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+namespace detail {
+
+/// @brief   The assumed size of a cache line on the target machine.
+/// @details Used to keep the producer and consumer sides of a buffer on
+///          separate cache lines so they don't invalidate each other every
+///          time one of them moves.
+inline constexpr std::size_t k_cache_line_size = 64;
+
+/// @brief   A bounded, lock-free, single producer single consumer ring buffer.
+/// @details Each thread that records events owns one of these and is the only
+///          thread that ever pushes into it. The profiling thread is the only
+///          thread that ever pops from it. Because of that, neither side needs
+///          a lock, and the only synchronization is a pair of acquire and
+///          release operations on the head and tail indices. The producer may
+///          also make room by dropping the oldest element, so each slot is
+///          stored as atomic words, and the consumer only keeps what it copied
+///          out if it still owns the slots once it moves the tail.
+/// @tparam  T The type of the elements stored in the ring.
+template<typename T>
+struct spsc_ring final {
+    static_assert(std::is_trivially_copyable_v<T> &&
+                  sizeof(T) % sizeof(std::uint64_t) == 0,
+        "Elements must be trivially copyable and made of whole words.");
+
+    /// @brief   Creates a ring that can hold at least the given number of
+    ///          elements.
+    /// @param   capacity The requested capacity, rounded up to the next power
+    ///          of two so that indices can be masked rather than divided.
+    /// @remarks The slots are allocated without throwing, check `allocated`
+    ///          before using the ring.
+    explicit spsc_ring(std::size_t capacity) noexcept
+        : mask_{ std::bit_ceil(capacity < 2 ? 2 : capacity) - 1 }
+        , slots_{ new (std::nothrow) slot[mask_ + 1] }
+    { }
+
+    /// @brief   Checks if the slots of the ring could be allocated.
+    /// @returns True if the ring can be used; false otherwise.
+    bool
+    allocated() const noexcept {
+        return slots_ != nullptr;
+    }
+
+    /// @brief   Attempts to push the given value into the ring.
+    /// @details Must only be called from the producing thread.
+    /// @param   value The value that should be pushed.
+    /// @returns True if the value was pushed; false if the ring was full.
+    bool
+    try_push(const T& value) noexcept {
+        auto head = head_.load(std::memory_order_relaxed);
+        if (head - cached_tail_ > mask_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head - cached_tail_ > mask_)
+                return false;
+        }
+
+        store(slots_[head & mask_], value);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief   Pushes the given value into the ring, dropping the oldest
+    ///          element if the ring is full.
+    /// @details Must only be called from the producing thread. Never waits on
+    ///          the consumer.
+    /// @param   value The value that should be pushed.
+    /// @returns True if the oldest element was dropped to make room; false
+    ///          otherwise.
+    bool
+    push_overwrite(const T& value) noexcept {
+        auto head = head_.load(std::memory_order_relaxed);
+        auto dropped = false;
+        if (head - cached_tail_ > mask_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            while (head - cached_tail_ > mask_) {
+                // Fails if the consumer moved the tail first, which leaves
+                // room without dropping anything.
+                if (tail_.compare_exchange_weak(cached_tail_, cached_tail_ + 1,
+                        std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    cached_tail_++;
+                    dropped = true;
+                }
+            }
+        }
+
+        store(slots_[head & mask_], value);
+        head_.store(head + 1, std::memory_order_release);
+        return dropped;
+    }
+
+    /// @brief   Pops up to the given number of elements out of the ring.
+    /// @details Must only be called from the consuming thread. Elements are
+    ///          copied out in chunks, and only given to the consumer once the
+    ///          tail has moved past them, so any the producer dropped in the
+    ///          meantime are left out.
+    /// @tparam  Consumer The type of the callable receiving each element.
+    /// @param   consumer Called with each element that was popped, in the
+    ///          order they were pushed.
+    /// @param   max The maximum number of elements that should be popped.
+    /// @returns The number of elements that were popped.
+    template<typename Consumer>
+    std::size_t
+    pop(Consumer&& consumer, std::size_t max = SIZE_MAX) noexcept {
+        std::array<T, k_pop_chunk> chunk;
+        std::size_t popped = 0;
+        while (popped < max) {
+            auto tail  = tail_.load(std::memory_order_acquire);
+            auto head  = head_.load(std::memory_order_acquire);
+            auto count = std::min<std::size_t>(
+                { head - tail, max - popped, k_pop_chunk });
+            if (count == 0)
+                break;
+
+            for (std::size_t i = 0; i < count; i++)
+                load(slots_[(tail + i) & mask_], chunk[i]);
+
+            auto first = tail;
+            auto end   = tail + count;
+            while (!tail_.compare_exchange_weak(first, end,
+                       std::memory_order_acq_rel, std::memory_order_acquire)) {
+                if (first >= end)
+                    break;
+            }
+
+            // Everything before the tail the producer left was dropped.
+            if (first >= end)
+                continue;
+            for (auto i = first - tail; i < count; i++)
+                consumer(std::move(chunk[i]));
+            popped += end - first;
+        }
+
+        return popped;
+    }
+
+    /// @brief   Gets the number of elements currently held by the ring.
+    /// @returns The number of elements that could be popped right now.
+    std::size_t
+    size() const noexcept {
+        auto tail = tail_.load(std::memory_order_acquire);
+        auto head = head_.load(std::memory_order_acquire);
+        return head - tail;
+    }
+
+    /// @brief   Checks if the ring holds no elements.
+    /// @returns True if the ring is empty; false otherwise.
+    bool
+    empty() const noexcept {
+        return size() == 0;
+    }
+
+    /// @brief   Gets the maximum number of elements the ring can hold.
+    /// @returns The capacity of the ring.
+    std::size_t
+    capacity() const noexcept {
+        return mask_ + 1;
+    }
+
+private:
+    static constexpr std::size_t k_words = sizeof(T) / sizeof(std::uint64_t);
+    static constexpr std::size_t k_pop_chunk = 256;
+
+    struct slot final {
+        std::array<std::atomic<std::uint64_t>, k_words> words;
+    };
+
+    // The words are copied with a fold rather than a loop, since compilers
+    // won't unroll a loop over atomics, and the copy runs for every event.
+    static void
+    store(slot& target, const T& value) noexcept {
+        std::array<std::uint64_t, k_words> words;
+        std::memcpy(words.data(), static_cast<const void*>(&value), sizeof(T));
+        [&]<std::size_t... Index>(std::index_sequence<Index...>) {
+            (target.words[Index].store(
+                words[Index], std::memory_order_relaxed), ...);
+        }(std::make_index_sequence<k_words>{ });
+    }
+
+    static void
+    load(const slot& source, T& value) noexcept {
+        std::array<std::uint64_t, k_words> words;
+        [&]<std::size_t... Index>(std::index_sequence<Index...>) {
+            ((words[Index] = source.words[Index].load(
+                std::memory_order_relaxed)), ...);
+        }(std::make_index_sequence<k_words>{ });
+        std::memcpy(static_cast<void*>(&value), words.data(), sizeof(T));
+    }
+
+private:
+    alignas(k_cache_line_size) std::atomic<std::size_t> head_{0};
+    std::size_t cached_tail_{0};
+    alignas(k_cache_line_size) std::atomic<std::size_t> tail_{0};
+    alignas(k_cache_line_size) std::size_t mask_;
+    std::unique_ptr<slot[]> slots_;
+};
+
+/// @brief   An unbounded, lock-free, single producer single consumer queue
+///          which a thread spills its events into once its ring is full.
+/// @details The queue is a list of fixed size chunks, which the producer
+///          allocates as it needs them without ever throwing, and the consumer
+///          frees once it has read them. Nothing is allocated until the first
+///          element is spilled.
+/// @tparam  T The type of the elements stored in the queue.
+template<typename T>
+struct spill_queue final {
+    spill_queue() noexcept = default;
+
+    ~spill_queue() noexcept {
+        auto current = head_ != nullptr
+            ? head_ : first_.load(std::memory_order_acquire);
+        while (current != nullptr) {
+            auto next = current->next.load(std::memory_order_acquire);
+            delete current;
+            current = next;
+        }
+    }
+
+    spill_queue(const spill_queue&) = delete;
+    spill_queue& operator=(const spill_queue&) = delete;
+
+    /// @brief   Attempts to push the given value into the queue.
+    /// @details Must only be called from the producing thread.
+    /// @param   value The value that should be pushed.
+    /// @param   limit The most elements the queue may hold at once.
+    /// @returns True if the value was pushed; false if the queue already held
+    ///          the limit, or a chunk couldn't be allocated.
+    bool
+    try_push(const T& value, std::size_t limit) noexcept {
+        if (pushed_local_ - cached_popped_ >= limit) {
+            cached_popped_ = popped_.load(std::memory_order_acquire);
+            if (pushed_local_ - cached_popped_ >= limit)
+                return false;
+        }
+
+        if (tail_ == nullptr || tail_size_ == k_chunk_size) {
+            auto next = new (std::nothrow) chunk;
+            if (next == nullptr)
+                return false;
+
+            if (tail_ == nullptr)
+                first_.store(next, std::memory_order_release);
+            else tail_->next.store(next, std::memory_order_release);
+            tail_ = next;
+            tail_size_ = 0;
+        }
+
+        tail_->slots[tail_size_++] = value;
+        tail_->size.store(tail_size_, std::memory_order_release);
+        pushed_.store(++pushed_local_, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief   Checks if the consumer has popped everything pushed so far.
+    /// @details Must only be called from the producing thread.
+    /// @returns True if nothing is waiting in the queue; false otherwise.
+    bool
+    drained() noexcept {
+        if (pushed_local_ == cached_popped_)
+            return true;
+
+        cached_popped_ = popped_.load(std::memory_order_acquire);
+        return pushed_local_ == cached_popped_;
+    }
+
+    /// @brief   Gets the number of elements pushed into the queue so far.
+    /// @details Used by the consumer to pop no further than a point in time.
+    /// @returns The number of elements ever pushed.
+    std::size_t
+    pushed() const noexcept {
+        return pushed_.load(std::memory_order_acquire);
+    }
+
+    /// @brief   Pops up to the given number of elements out of the queue.
+    /// @details Must only be called from the consuming thread.
+    /// @tparam  Consumer The type of the callable receiving each element.
+    /// @param   consumer Called with each element that was popped, in the
+    ///          order they were pushed.
+    /// @param   max The maximum number of elements that should be popped.
+    /// @returns The number of elements that were popped.
+    template<typename Consumer>
+    std::size_t
+    pop(Consumer&& consumer, std::size_t max = SIZE_MAX) noexcept {
+        if (head_ == nullptr)
+            head_ = first_.load(std::memory_order_acquire);
+
+        std::size_t popped = 0;
+        while (head_ != nullptr && popped < max) {
+            auto size = head_->size.load(std::memory_order_acquire);
+            while (read_ < size && popped < max) {
+                consumer(std::move(head_->slots[read_++]));
+                popped++;
+            }
+
+            // The producer is done with a chunk once it has linked the next.
+            auto next = read_ == k_chunk_size
+                ? head_->next.load(std::memory_order_acquire) : nullptr;
+            if (next == nullptr)
+                break;
+
+            delete head_;
+            head_ = next;
+            read_ = 0;
+        }
+
+        if (popped != 0)
+            popped_.fetch_add(popped, std::memory_order_release);
+        return popped;
+    }
+
+    /// @brief   Gets the number of elements popped out of the queue so far.
+    /// @returns The number of elements ever popped.
+    std::size_t
+    popped() const noexcept {
+        return popped_.load(std::memory_order_acquire);
+    }
+
+    /// @brief   Checks if the queue holds no elements.
+    /// @returns True if the queue is empty; false otherwise.
+    bool
+    empty() const noexcept {
+        return pushed_.load(std::memory_order_acquire) ==
+               popped_.load(std::memory_order_acquire);
+    }
+
+private:
+    static constexpr std::size_t k_chunk_size = 4096;
+
+    struct chunk final {
+        std::array<T, k_chunk_size> slots;
+        std::atomic<std::size_t> size{0};
+        std::atomic<chunk*> next{nullptr};
+    };
+
+private:
+    // Owned by the producer.
+    chunk* tail_{ nullptr };
+    std::size_t tail_size_{0};
+    std::size_t pushed_local_{0};
+    std::size_t cached_popped_{0};
+
+    // Owned by the consumer.
+    alignas(k_cache_line_size) chunk* head_{ nullptr };
+    std::size_t read_{0};
+
+    alignas(k_cache_line_size) std::atomic<chunk*> first_{ nullptr };
+    std::atomic<std::size_t> pushed_{0};
+    alignas(k_cache_line_size) std::atomic<std::size_t> popped_{0};
+};
+
+/// @brief   A bounded ring which overwrites its oldest elements once full.
+/// @details Used by the flight recorder to keep the most recent events of each
+///          thread in a fixed amount of memory. Only the profiling thread ever
+///          touches one, so it needs no synchronization of its own.
+/// @tparam  T The type of the elements stored in the ring.
+template<typename T>
+struct history_ring final {
+    /// @brief   Drops every element and changes the capacity of the ring.
+    /// @param   capacity The number of elements the ring keeps, or zero to
+    ///          release its memory.
+    /// @remarks If the memory can't be allocated, the ring keeps nothing.
+    void
+    reset(std::size_t capacity) noexcept {
+        slots_.reset();
+        if (capacity != 0)
+            slots_.reset(new (std::nothrow) T[capacity]);
+        capacity_ = slots_ != nullptr ? capacity : 0;
+        size_ = 0;
+        next_ = 0;
+    }
+
+    /// @brief   Pushes the given value, overwriting the oldest one if the ring
+    ///          is full.
+    /// @param   value The value that should be pushed.
+    void
+    push(const T& value) noexcept {
+        if (capacity_ == 0)
+            return;
+
+        slots_[next_] = value;
+        next_ = next_ + 1 == capacity_ ? 0 : next_ + 1;
+        size_ = std::min(size_ + 1, capacity_);
+    }
+
+    /// @brief   Calls the given function with each element, oldest first.
+    /// @tparam  Function The type of the callable receiving each element.
+    /// @param   function Called with each element of the ring.
+    template<typename Function>
+    void
+    for_each(Function&& function) const noexcept {
+        auto first = size_ < capacity_ ? 0 : next_;
+        for (auto i = first; i < size_; i++)
+            function(slots_[i]);
+        for (std::size_t i = 0; i < first; i++)
+            function(slots_[i]);
+    }
+
+    /// @brief   Gets the number of elements held by the ring.
+    /// @returns The number of elements, at most the capacity of the ring.
+    std::size_t
+    size() const noexcept {
+        return size_;
+    }
+
+    /// @brief   Checks if the ring holds no elements.
+    /// @returns True if the ring is empty; false otherwise.
+    bool
+    empty() const noexcept {
+        return size_ == 0;
+    }
+
+    /// @brief   Gets the number of elements the ring keeps.
+    /// @returns The capacity of the ring.
+    std::size_t
+    capacity() const noexcept {
+        return capacity_;
+    }
+
+private:
+    std::unique_ptr<T[]> slots_;
+    std::size_t capacity_{0};
+    std::size_t size_{0};
+    std::size_t next_{0};
+};
+
+/// @brief   The buffer that a single thread records its events into.
+/// @details The buffer is shared between the thread that owns it and the
+///          profiler. When the owning thread exits, it marks the buffer as
+///          retired so the profiler knows it can release it once the last of
+///          its events have been drained.
+struct thread_buffer final {
+    /// @brief Creates a buffer with the given event capacity.
+    /// @param capacity The number of events the buffer can hold.
+    /// @param index The index of the thread that owns the buffer.
+    thread_buffer(std::size_t capacity, thread_index_t index) noexcept
+        : ring{ capacity }
+        , index{ index }
+    { }
+
+    /// @brief The events recorded by the owning thread.
+    spsc_ring<event_variant_t> ring;
+
+    /// @brief The index of the thread that owns the buffer.
+    thread_index_t index;
+
+    /// @brief The events spilled by the owning thread while the ring was
+    ///        full, under the spill overflow policy.
+    spill_queue<event_variant_t> spill;
+
+    /// @brief The statistics aggregated by the owning thread.
+    statistics_shard statistics;
+
+    /// @brief   The number of events the owning thread had to drop.
+    /// @details Only ever written by the owning thread.
+    std::atomic<std::uint64_t> dropped{0};
+
+    /// @brief Whether the owning thread has exited.
+    std::atomic<bool> retired{false};
+
+    /// @brief   The number of events pushed since the owning thread last
+    ///          checked whether the profiler should be woken.
+    /// @details Only ever touched by the owning thread.
+    std::size_t unchecked{0};
+};
+
+} // namespace malunal::tooling::detail
+} // namespace malunal::tooling
@@ -0,0 +1,274 @@
+/// @file   call_tree.hpp
+/// @brief  Contains the reconstruction of call hierarchies from a timeline of
+///         the performance tooling.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+
+/// @brief   A tree of every distinct call path found in a timeline.
+/// @details The tree is built from the timing events of a timeline by sorting
+///          them by thread and start time, then walking each thread once with
+///          a stack of the events that are still open. An event is the child
+///          of the innermost open event that contains it. Events with the
+///          same name under the same parent are merged into one node, no
+///          matter which thread they came from, so each node represents a
+///          call path rather than a single call. Building the tree is
+///          `O(n log n)` in the number of events.
+struct call_tree final {
+    /// @brief   The index of the root node, which represents no call at all
+    ///          and is the parent of every outermost event.
+    static constexpr std::uint32_t k_root = 0;
+
+    /// @brief   A single call path in the tree.
+    struct node final {
+        /// @brief   The name of the innermost call of the path.
+        name_id_t name;
+
+        /// @brief   The index of the parent node; the root is its own parent.
+        std::uint32_t parent;
+
+        /// @brief   How many events were merged into this node.
+        std::uint64_t count;
+
+        /// @brief   The total time spent in this call path, including the time
+        ///          spent in any of its children, in ticks.
+        tick_t inclusive;
+
+        /// @brief   The total time spent in this call path, excluding the time
+        ///          spent in any of its children, in ticks.
+        tick_t exclusive;
+
+        /// @brief   The indices of the children of this node.
+        std::vector<std::uint32_t> children;
+    };
+
+    /// @brief   Creates an empty tree, made up of just the root.
+    call_tree() noexcept {
+        nodes_.push_back(node {
+            .name      = 0,
+            .parent    = k_root,
+            .count     = 0,
+            .inclusive = 0,
+            .exclusive = 0,
+            .children  = { }
+        });
+    }
+
+    /// @brief   Builds the tree of the given timeline.
+    /// @param   source The timeline that should be reconstructed.
+    /// @param   workers The number of threads used to sort the events, or zero
+    ///          for one per hardware thread.
+    /// @returns The tree of every call path in the timeline.
+    static call_tree
+    build(const timeline& source, std::size_t workers = 1) noexcept {
+        auto events = source.timing_events();
+        return build(events, workers);
+    }
+
+    /// @brief   Builds the tree of the given timing events.
+    /// @param   events The events that should be reconstructed, which will be
+    ///          sorted in place.
+    /// @param   workers The number of threads used to sort the events, or zero
+    ///          for one per hardware thread.
+    /// @returns The tree of every call path in the events.
+    static call_tree
+    build(std::span<timing_event> events, std::size_t workers = 1) noexcept {
+        return build(events, [](const timing_event&, std::uint32_t) { },
+            workers);
+    }
+
+    /// @brief   Builds the tree of the given timing events, telling the given
+    ///          function which node each event was merged into.
+    /// @details This lets callers aggregate more about each call path than the
+    ///          tree keeps, such as the distribution of its durations, in the
+    ///          same pass.
+    /// @tparam  Function The type of the function.
+    /// @param   events The events that should be reconstructed, which will be
+    ///          sorted in place.
+    /// @param   on_event Called with each event and the index of its node.
+    /// @param   workers The number of threads used to sort the events, or zero
+    ///          for one per hardware thread.
+    /// @returns The tree of every call path in the events.
+    template<typename Function>
+        requires std::invocable<Function&, const timing_event&, std::uint32_t>
+    static call_tree
+    build(
+        std::span<timing_event> events,
+        Function&& on_event,
+        std::size_t workers = 1
+    ) noexcept {
+        // Outer events sort before the events they contain, which is what
+        // lets a single pass find every parent.
+        parallel_sort(events, workers);
+
+        call_tree result;
+        std::vector<std::pair<tick_t, std::uint32_t>> open;
+        auto tid = thread_index_t{ 0 };
+        for (const auto& e : events) {
+            if (e.tid != tid) {
+                open.clear();
+                tid = e.tid;
+            }
+
+            // Anything that ended before this event, or that this event
+            // outlives, cannot be its parent.
+            while (!open.empty() && open.back().first < e.end())
+                open.pop_back();
+
+            auto parent = open.empty() ? k_root : open.back().second;
+            auto index  = result.child(parent, e.name);
+            auto& child = result.nodes_[index];
+            child.count++;
+            child.inclusive += e.duration;
+            child.exclusive += e.duration;
+            if (parent != k_root)
+                result.nodes_[parent].exclusive -= e.duration;
+            open.emplace_back(e.end(), index);
+            on_event(e, index);
+        }
+
+        return result;
+    }
+
+    /// @brief   Gets the root of the tree.
+    /// @returns The root node.
+    const node&
+    root() const noexcept {
+        return nodes_[k_root];
+    }
+
+    /// @brief   Gets every node of the tree, the root being the first.
+    /// @returns The nodes of the tree, in the order they were created.
+    std::span<const node>
+    nodes() const noexcept {
+        return nodes_;
+    }
+
+    /// @brief   Gets the node at the given index.
+    /// @param   index The index of the node.
+    /// @returns The node at that index.
+    const node&
+    operator[](std::uint32_t index) const noexcept {
+        return nodes_[index];
+    }
+
+    /// @brief   Gets the number of nodes in the tree, including the root.
+    /// @returns The number of nodes.
+    size_t
+    size() const noexcept {
+        return nodes_.size();
+    }
+
+    /// @brief   Finds the child of the given node with the given name.
+    /// @param   parent The index of the parent node.
+    /// @param   name The name of the child.
+    /// @returns The index of the child, if there is one.
+    std::optional<std::uint32_t>
+    find(std::uint32_t parent, name_id_t name) const noexcept {
+        auto it = index_.find(key(parent, name));
+        if (it == index_.end())
+            return std::nullopt;
+        return it->second;
+    }
+
+    /// @brief   Gets the names along the path from the root to the given node.
+    /// @param   index The index of the node.
+    /// @returns The names of the path, outermost first.
+    std::vector<name_id_t>
+    path(std::uint32_t index) const noexcept {
+        std::vector<name_id_t> result;
+        for (; index != k_root; index = nodes_[index].parent)
+            result.push_back(nodes_[index].name);
+        std::reverse(result.begin(), result.end());
+        return result;
+    }
+
+    /// @brief   Writes the tree in the folded stack format used by flame graph
+    ///          tools.
+    /// @details Every node with exclusive time gets a line made up of the names
+    ///          of its path separated by semicolons, followed by its exclusive
+    ///          time in nanoseconds.
+    /// @param   out The buffer the lines should be written into.
+    void
+    write_folded(detail::output_buffer& out) const noexcept {
+        std::string prefix;
+        write_folded(out, k_root, prefix);
+    }
+
+    /// @brief   Writes the tree in the folded stack format to the given stream.
+    /// @param   stream The stream that should be written to.
+    void
+    dump_folded(std::ostream& stream) const noexcept {
+        detail::output_buffer out{ stream };
+        write_folded(out);
+    }
+
+    /// @brief   Gets the tree in the folded stack format.
+    /// @returns The folded stacks of the tree.
+    std::string
+    folded() const noexcept {
+        detail::output_buffer out;
+        write_folded(out);
+        return std::string{ out.view() };
+    }
+
+private:
+    static std::uint64_t
+    key(std::uint32_t parent, name_id_t name) noexcept {
+        return (std::uint64_t{ parent } << 32) | name;
+    }
+
+    std::uint32_t
+    child(std::uint32_t parent, name_id_t name) noexcept {
+        auto [it, inserted] = index_.try_emplace(
+            key(parent, name), static_cast<std::uint32_t>(nodes_.size()));
+        if (!inserted)
+            return it->second;
+
+        nodes_.push_back(node {
+            .name      = name,
+            .parent    = parent,
+            .count     = 0,
+            .inclusive = 0,
+            .exclusive = 0,
+            .children  = { }
+        });
+
+        nodes_[parent].children.push_back(it->second);
+        return it->second;
+    }
+
+    void
+    write_folded(
+        detail::output_buffer& out,
+        std::uint32_t index,
+        std::string& prefix
+    ) const noexcept {
+        const auto& current = nodes_[index];
+        auto length = prefix.size();
+        if (index != k_root) {
+            if (!prefix.empty())
+                prefix += ';';
+            prefix += name_registry::resolve(current.name);
+            if (current.exclusive > 0) {
+                out.append(prefix);
+                out.append(' ');
+                out.append_integer(to_nanoseconds(current.exclusive));
+                out.append('\n');
+            }
+        }
+
+        for (auto child : current.children)
+            write_folded(out, child, prefix);
+        prefix.resize(length);
+    }
+
+private:
+    std::vector<node> nodes_;
+    std::unordered_map<std::uint64_t, std::uint32_t> index_;
+};
+
+} // namespace malunal::tooling
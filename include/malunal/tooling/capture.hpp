@@ -0,0 +1,440 @@
+/// @file   capture.hpp
+/// @brief  Contains the binary capture format of the performance tooling,
+///         along with a sink that writes it and a reader for it.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+namespace detail {
+
+/// @brief   The magic bytes at the start of every binary capture.
+inline constexpr std::array<char, 8> k_capture_magic{
+    'M', 'T', 'C', 'A', 'P', 'T', 'U', 'R'
+};
+
+/// @brief   The version of the binary capture format.
+inline constexpr std::uint32_t k_capture_version = 1;
+
+/// @brief   Written in the header so a reader can tell if the capture was
+///          written by a machine with a different byte order.
+inline constexpr std::uint32_t k_capture_byte_order = 0x01020304;
+
+/// @brief   The header at the start of every binary capture.
+struct capture_header final {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t byte_order;
+};
+
+/// @brief   The kinds of blocks a binary capture is made of.
+/// @details Event blocks are numbered from `events`, offset by the index of
+///          the type of the events in `event_variant_t`. Every event in a
+///          block has the same type, which lets the events be stored as a
+///          plain array of records.
+enum class capture_block : std::uint32_t {
+    /// @brief   A block of names, each stored as its identifier, its length,
+    ///          and then its characters.
+    names = 1,
+
+    /// @brief   A block of events of the first type in `event_variant_t`.
+    events = 16
+};
+
+/// @brief   The header in front of every block of a binary capture.
+/// @details The payload of a block is always padded to a multiple of eight
+///          bytes so that the records in event blocks stay aligned.
+struct capture_block_header final {
+    std::uint32_t kind;
+    std::uint32_t count;
+    std::uint64_t size;
+};
+
+/// @brief   Rounds the given size up to the alignment of capture blocks.
+/// @param   size The size that should be rounded.
+/// @returns The rounded size.
+inline constexpr std::uint64_t
+capture_align(std::uint64_t size) noexcept {
+    return (size + 7) & ~std::uint64_t{ 7 };
+}
+
+} // namespace malunal::tooling::detail
+
+
+/// @brief   A sink which streams events into a binary capture file while the
+///          session is running.
+/// @details Events are collected into blocks of a single event type, and each
+///          block is written out once it is full, so the memory used by the
+///          sink stays bounded no matter how long the session runs. Any name
+///          which an event refers to is written out in a names block before
+///          the first block of events which uses it. The file is flushed after
+///          every block, so if the process crashes, everything but the blocks
+///          that were still being filled can be read back.
+/// @remarks Flushing hands the blocks to the operating system, but doesn't
+///          wait for them to reach the disk, so they may still be lost if the
+///          whole machine goes down.
+struct binary_capture_sink final : event_sink {
+    /// @brief   Opens the file at the given path and writes the header.
+    /// @param   path The path of the file that should be written.
+    /// @param   block_events How many events of one type are collected before
+    ///          they are written out as a block.
+    explicit binary_capture_sink(
+        const std::string& path,
+        std::size_t block_events = 4096
+    ) noexcept
+        : block_events_{ std::max<std::size_t>(block_events, 1) }
+        , file_{ std::fopen(path.c_str(), "wb") }
+    {
+        if (file_ == nullptr)
+            return;
+
+        std::setvbuf(file_, nullptr, _IOFBF, k_file_buffer_size);
+        detail::capture_header header {
+            .magic      = detail::k_capture_magic,
+            .version    = detail::k_capture_version,
+            .byte_order = detail::k_capture_byte_order
+        };
+
+        write(&header, sizeof(header));
+    }
+
+    ~binary_capture_sink() noexcept override {
+        if (file_ == nullptr)
+            return;
+
+        flush();
+        std::fclose(file_);
+    }
+
+    binary_capture_sink(const binary_capture_sink&) = delete;
+    binary_capture_sink& operator=(const binary_capture_sink&) = delete;
+
+    /// @brief   Checks if the file was opened and every write succeeded.
+    /// @returns True if the capture is intact; false otherwise.
+    bool
+    good() const noexcept {
+        return file_ != nullptr && good_;
+    }
+
+    /// @brief   Collects the given events into blocks, writing out any block
+    ///          that fills up.
+    /// @param   events The batch of events drained from one thread buffer.
+    void
+    consume(std::span<const event_variant_t> events) noexcept override {
+        if (file_ == nullptr)
+            return;
+
+        for (const auto& e : events) {
+            std::visit([this](const auto& arg) {
+                using T = std::decay_t<decltype(arg)>;
+                auto& pending = std::get<std::vector<T>>(pending_);
+                pending.push_back(arg);
+                if (pending.size() >= block_events_)
+                    write_block(pending);
+            }, e);
+        }
+    }
+
+    /// @brief   Writes out every block that is still being filled, and flushes
+    ///          the file.
+    void
+    flush() noexcept override {
+        if (file_ == nullptr)
+            return;
+
+        std::apply([this](auto&... pending) {
+            (write_block(pending), ...);
+        }, pending_);
+        if (std::fflush(file_) != 0)
+            good_ = false;
+    }
+
+private:
+    template<typename... Events>
+    using pending_t = std::tuple<std::vector<Events>...>;
+
+    template<typename Variant>
+    struct pending_for;
+
+    template<typename... Events>
+    struct pending_for<std::variant<Events...>> {
+        static_assert((std::is_trivially_copyable_v<Events> && ...),
+            "Every event type must be trivially copyable to be captured.");
+        using type = pending_t<Events...>;
+    };
+
+    static constexpr std::size_t k_file_buffer_size = 1 << 20;
+
+    void
+    write(const void* data, std::size_t size) noexcept {
+        if (std::fwrite(data, 1, size, file_) != size)
+            good_ = false;
+    }
+
+    void
+    write_padding(std::uint64_t size) noexcept {
+        static constexpr std::array<char, 8> k_zeros{ };
+        write(k_zeros.data(), detail::capture_align(size) - size);
+    }
+
+    void
+    write_names() noexcept {
+        auto total = name_registry::size();
+        if (names_written_ >= total)
+            return;
+
+        std::vector<char> payload;
+        for (auto id = names_written_; id < total; id++) {
+            auto name   = name_registry::resolve(static_cast<name_id_t>(id));
+            auto fields = std::array<std::uint32_t, 2>{
+                static_cast<std::uint32_t>(id),
+                static_cast<std::uint32_t>(name.size())
+            };
+
+            auto bytes = reinterpret_cast<const char*>(fields.data());
+            payload.insert(payload.end(), bytes, bytes + sizeof(fields));
+            payload.insert(payload.end(), name.begin(), name.end());
+        }
+
+        detail::capture_block_header header {
+            .kind  = static_cast<std::uint32_t>(detail::capture_block::names),
+            .count = static_cast<std::uint32_t>(total - names_written_),
+            .size  = detail::capture_align(payload.size())
+        };
+
+        write(&header, sizeof(header));
+        write(payload.data(), payload.size());
+        write_padding(payload.size());
+        names_written_ = total;
+    }
+
+    template<typename T>
+    void
+    write_block(std::vector<T>& pending) noexcept {
+        if (pending.empty())
+            return;
+
+        // Names are only ever added, so anything this block refers to was
+        // interned before now.
+        write_names();
+
+        constexpr auto index = detail::variant_index_v<T, event_variant_t>;
+        auto size = sizeof(T) * pending.size();
+        detail::capture_block_header header {
+            .kind  = static_cast<std::uint32_t>(
+                detail::capture_block::events) + index,
+            .count = static_cast<std::uint32_t>(pending.size()),
+            .size  = detail::capture_align(size)
+        };
+
+        write(&header, sizeof(header));
+        write(pending.data(), size);
+        write_padding(size);
+        pending.clear();
+        if (std::fflush(file_) != 0)
+            good_ = false;
+    }
+
+private:
+    std::size_t block_events_;
+    std::size_t names_written_{ 0 };
+    typename pending_for<event_variant_t>::type pending_;
+    std::FILE* file_;
+    bool good_{ true };
+};
+
+
+/// @brief   Reads a binary capture back, one block at a time.
+/// @details Names in the capture are interned into the name registry of this
+///          process as they are read, and the events are given the
+///          identifiers of this process, so the events can be visited and
+///          resolved like any other.
+struct binary_capture_reader final {
+    /// @brief   Opens the capture at the given path and checks its header.
+    /// @param   path The path of the capture that should be read.
+    explicit binary_capture_reader(const std::string& path) noexcept
+        : file_{ std::fopen(path.c_str(), "rb") }
+    {
+        if (file_ == nullptr)
+            return;
+
+        // Sizes in the capture are checked against what is left of the file,
+        // so a corrupt one can't make the reader allocate more than that.
+        if (std::fseek(file_, 0, SEEK_END) == 0) {
+            auto size = std::ftell(file_);
+            remaining_ = size < 0 ? 0 : static_cast<std::uint64_t>(size);
+        }
+
+        std::rewind(file_);
+        detail::capture_header header{ };
+        good_ = read(&header, sizeof(header)) &&
+                header.magic      == detail::k_capture_magic &&
+                header.version    == detail::k_capture_version &&
+                header.byte_order == detail::k_capture_byte_order;
+    }
+
+    ~binary_capture_reader() noexcept {
+        if (file_ != nullptr)
+            std::fclose(file_);
+    }
+
+    binary_capture_reader(const binary_capture_reader&) = delete;
+    binary_capture_reader& operator=(const binary_capture_reader&) = delete;
+
+    /// @brief   Checks if the capture was opened, has a valid header, and
+    ///          hasn't failed to read.
+    /// @returns True if the capture can be read; false otherwise.
+    bool
+    good() const noexcept {
+        return file_ != nullptr && good_;
+    }
+
+    /// @brief   Streams every event in the rest of the capture into the given
+    ///          visitor, without holding more than a block in memory.
+    /// @tparam  Visitor The type of the visitor.
+    /// @param   visitor The visitor that should visit each event.
+    /// @returns True if the capture was read to its end; false if it was
+    ///          corrupt or truncated. A capture cut short by a crash will
+    ///          still have visited every complete block.
+    template<detail::TimelineVisitor Visitor>
+    bool
+    accept(Visitor& visitor) noexcept {
+        return read_blocks([&visitor](const event_variant_t& e) {
+            visitor.visit(e);
+        });
+    }
+
+    /// @brief   Reads the rest of the capture into a timeline.
+    /// @param   mode How the timeline should store timing events.
+    /// @returns The timeline of every event in the capture.
+    timeline
+    read_timeline(storage_mode mode = storage_mode::events) noexcept {
+        timeline result(mode);
+        read_blocks([&result](const event_variant_t& e) {
+            result.push(e);
+        });
+        return result;
+    }
+
+private:
+    bool
+    read(void* data, std::size_t size) noexcept {
+        if (size > remaining_ || std::fread(data, 1, size, file_) != size)
+            return false;
+        remaining_ -= size;
+        return true;
+    }
+
+    template<typename Consumer>
+    bool
+    read_blocks(Consumer&& consumer) noexcept {
+        if (!good())
+            return false;
+
+        detail::capture_block_header header{ };
+        while (read(&header, sizeof(header))) {
+            if (header.size > remaining_)
+                return good_ = false;
+
+            block_.resize(header.size);
+            if (!read(block_.data(), block_.size()))
+                return good_ = false;
+            if (!read_block(header, consumer))
+                return good_ = false;
+        }
+
+        return remaining_ == 0;
+    }
+
+    template<typename Consumer>
+    bool
+    read_block(
+        const detail::capture_block_header& header,
+        Consumer& consumer
+    ) noexcept {
+        using detail::capture_block;
+        auto first = static_cast<std::uint32_t>(capture_block::events);
+        if (header.kind == static_cast<std::uint32_t>(capture_block::names))
+            return read_names(header);
+        if (header.kind < first)
+            return true; // Skip blocks this version doesn't understand.
+
+        return read_events(header.kind - first, header, consumer,
+            std::make_index_sequence<std::variant_size_v<event_variant_t>>{});
+    }
+
+    bool
+    read_names(const detail::capture_block_header& header) noexcept {
+        // Names are written with consecutive identifiers, so none of them can
+        // be past the ones this block adds.
+        std::array<std::uint32_t, 2> fields;
+        if (header.count > block_.size() / sizeof(fields))
+            return false;
+
+        auto limit = names_.size() + header.count;
+        std::size_t offset = 0;
+        for (std::uint32_t i = 0; i < header.count; i++) {
+            if (offset + sizeof(fields) > block_.size())
+                return false;
+
+            std::memcpy(fields.data(), block_.data() + offset, sizeof(fields));
+            offset += sizeof(fields);
+            if (offset + fields[1] > block_.size())
+                return false;
+
+            auto name = std::string_view(block_.data() + offset, fields[1]);
+            offset += fields[1];
+            if (fields[0] >= limit)
+                return false;
+            if (fields[0] >= names_.size())
+                names_.resize(fields[0] + 1, 0);
+            names_[fields[0]] = name_registry::intern(name);
+        }
+
+        return true;
+    }
+
+    template<typename Consumer, std::size_t... Index>
+    bool
+    read_events(
+        std::uint32_t index,
+        const detail::capture_block_header& header,
+        Consumer& consumer,
+        std::index_sequence<Index...>
+    ) noexcept {
+        auto known = false;
+        auto valid = ((index == Index &&
+            (known = true, read_events<Index>(header, consumer))) || ...);
+        return valid || !known;
+    }
+
+    template<std::size_t Index, typename Consumer>
+    bool
+    read_events(
+        const detail::capture_block_header& header,
+        Consumer& consumer
+    ) noexcept {
+        using T = std::variant_alternative_t<Index, event_variant_t>;
+        if (header.count * sizeof(T) > block_.size())
+            return false;
+
+        for (std::uint32_t i = 0; i < header.count; i++) {
+            T record;
+            std::memcpy(&record, block_.data() + i * sizeof(T), sizeof(T));
+            record.name = record.name < names_.size() ? names_[record.name] : 0;
+            consumer(event_variant_t{ std::in_place_index<Index>, record });
+        }
+
+        return true;
+    }
+
+private:
+    std::vector<name_id_t> names_;
+    std::vector<char> block_;
+    std::uint64_t remaining_{ 0 };
+    std::FILE* file_;
+    bool good_{ false };
+};
+
+} // namespace malunal::tooling
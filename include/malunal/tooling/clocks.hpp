@@ -0,0 +1,182 @@
+/// @file   clocks.hpp
+/// @brief  Contains the clock sources probes can read time from.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+namespace detail {
+
+/// @brief   Defines a type constraint that assures the given type can be used
+///          by probes to read the current time.
+/// @details The flags of a clock source are set on every event recorded with
+///          it, which is how the profiler knows whether the time stamps need
+///          to be converted into `perf_clock_t` ticks.
+/// @tparam  Clock The type of the clock source.
+template<typename Clock>
+concept ClockSource = requires {
+    { Clock::now() } noexcept -> std::same_as<tick_t>;
+    { Clock::k_flags } -> std::convertible_to<std::uint16_t>;
+};
+
+} // namespace malunal::tooling::detail
+
+
+/// @brief   Reads time from `perf_clock_t`.
+/// @details This is the portable clock source and the default one. On most
+///          systems reading it costs a call into the kernel's vDSO.
+struct steady_clock_source final {
+    static constexpr std::uint16_t k_flags = 0;
+
+    /// @brief   Reads the current time.
+    /// @returns The number of `perf_clock_t` ticks since its epoch.
+    static tick_t
+    now() noexcept {
+        return to_ticks(perf_clock_t::now());
+    }
+};
+
+/// @brief   Reads time straight from the invariant time stamp counter of the
+///          processor.
+/// @details On x86 this reads the TSC and on ARM it reads the virtual counter
+///          `cntvct_el0`, both of which take a handful of cycles, which makes
+///          it possible to measure scopes that only run for a few hundred
+///          nanoseconds. The raw ticks are converted into `perf_clock_t` ticks
+///          by the profiler using the calibration it takes at the start of
+///          each session. On any other architecture this falls back to
+///          reading `perf_clock_t`.
+/// @remarks This assumes the counter is invariant and synchronized between
+///          cores, which is true of every x86 processor of the last decade
+///          and every ARMv8 processor, but not guaranteed by older ones.
+struct tsc_clock_source final {
+#if defined(__x86_64__) || defined(__i386__) || \
+    defined(_M_X64) || defined(_M_IX86) || defined(__aarch64__)
+    static constexpr bool k_supported = true;
+    static constexpr std::uint16_t k_flags = event_flags::raw_ticks;
+#else
+    static constexpr bool k_supported = false;
+    static constexpr std::uint16_t k_flags = 0;
+#endif
+
+    /// @brief   Reads the current value of the counter.
+    /// @returns The raw counter ticks, or `perf_clock_t` ticks if the counter
+    ///          is not supported on this architecture.
+    static tick_t
+    now() noexcept {
+#if defined(__x86_64__) || defined(__i386__) || \
+    defined(_M_X64) || defined(_M_IX86)
+        return static_cast<tick_t>(__rdtsc());
+#elif defined(__aarch64__)
+        std::uint64_t value;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+        return static_cast<tick_t>(value);
+#else
+        return steady_clock_source::now();
+#endif
+    }
+};
+
+/// @brief   The clock source probes use when none is specified.
+/// @details Define `MALUNAL_TOOLING_USE_TSC_CLOCK` to have every probe read
+///          the time stamp counter instead of `perf_clock_t`.
+#ifdef MALUNAL_TOOLING_USE_TSC_CLOCK
+using default_clock_source = tsc_clock_source;
+#else
+using default_clock_source = steady_clock_source;
+#endif /* MALUNAL_TOOLING_USE_TSC_CLOCK */
+
+
+/// @brief   Maps raw counter ticks onto `perf_clock_t` ticks.
+/// @details The calibration is anchored by sampling both clocks at the same
+///          moment, and its rate is refined every time it is sampled again.
+///          Because the rate is always measured across the whole span since
+///          the anchor, the error of a converted time stamp stays within the
+///          error of a single sample, no matter how long the session runs.
+struct clock_calibration final {
+    /// @brief   Samples both clocks to anchor a new calibration.
+    /// @details Spins for a short window so that the initial rate is usable
+    ///          before the first time it's refined.
+    /// @returns The new calibration.
+    static clock_calibration
+    anchor() noexcept {
+        clock_calibration result;
+        if constexpr (!tsc_clock_source::k_supported)
+            return result;
+
+        result.sample(result.raw_base_, result.base_);
+        auto window = std::chrono::duration_cast<perf_clock_t::duration>(
+            k_anchor_window);
+        auto deadline = result.base_ + window.count();
+        auto anchor_end = result.base_;
+        while (anchor_end < deadline)
+            anchor_end = steady_clock_source::now();
+        result.refine();
+        return result;
+    }
+
+    /// @brief   Samples both clocks again and updates the rate.
+    void
+    refine() noexcept {
+        if constexpr (!tsc_clock_source::k_supported)
+            return;
+
+        tick_t raw = 0, steady = 0;
+        sample(raw, steady);
+        if (raw <= raw_base_ || steady <= base_)
+            return;
+        rate_ = static_cast<double>(steady - base_) /
+                static_cast<double>(raw - raw_base_);
+    }
+
+    /// @brief   Converts a raw time stamp into `perf_clock_t` ticks.
+    /// @param   raw The raw counter ticks of the time stamp.
+    /// @returns The `perf_clock_t` ticks of the time stamp.
+    tick_t
+    time(tick_t raw) const noexcept {
+        return base_ + duration(raw - raw_base_);
+    }
+
+    /// @brief   Converts a raw span of time into `perf_clock_t` ticks.
+    /// @param   raw The raw counter ticks of the span.
+    /// @returns The `perf_clock_t` ticks of the span.
+    tick_t
+    duration(tick_t raw) const noexcept {
+        return static_cast<tick_t>(static_cast<double>(raw) * rate_);
+    }
+
+    /// @brief   Gets the number of `perf_clock_t` ticks per raw tick.
+    /// @returns The calibrated rate.
+    double
+    rate() const noexcept {
+        return rate_;
+    }
+
+private:
+    static constexpr std::chrono::microseconds k_anchor_window{ 500 };
+
+    // Brackets a steady clock sample between two raw samples and keeps the
+    // tightest of a few attempts, so that preemption doesn't skew it.
+    static void
+    sample(tick_t& raw, tick_t& steady) noexcept {
+        auto best = std::numeric_limits<tick_t>::max();
+        for (int attempt = 0; attempt < 5; attempt++) {
+            auto before = tsc_clock_source::now();
+            auto now    = steady_clock_source::now();
+            auto after  = tsc_clock_source::now();
+            if (after - before >= best)
+                continue;
+
+            best   = after - before;
+            raw    = before + (after - before) / 2;
+            steady = now;
+        }
+    }
+
+private:
+    tick_t raw_base_{ 0 };
+    tick_t base_{ 0 };
+    double rate_{ 1.0 };
+};
+
+} // namespace malunal::tooling
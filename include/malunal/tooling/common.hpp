@@ -3,20 +3,73 @@
 /// @author John Christman sorakatadzuma@gmail.com
 /// @copyright 2024 Malunal Studios, LLC.
 #pragma once
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
 #include <chrono>
 #include <concepts>
 #include <condition_variable>
+#include <coroutine>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <functional>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <optional>
+#include <ostream>
 #include <queue>
+#include <shared_mutex>
 #include <thread>
+#include <tuple>
+#include <type_traits>
 #include <source_location>
+#include <span>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <variant>
+#include <vector>
+
+#if __has_include(<unistd.h>)
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#define MALUNAL_TOOLING_HAS_PERF_EVENTS 1
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#if __has_include(<sys/mman.h>) && __has_include(<sys/stat.h>) && \
+    __has_include(<fcntl.h>)
+#define MALUNAL_TOOLING_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef MALUNAL_TOOLING_USE_ZSTD
+#include <zstd.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 
 namespace malunal::tooling {
@@ -42,4 +95,43 @@ using perf_clock_t = std::chrono::steady_clock;
 ///          given timing event.
 using time_point_t = perf_clock_t::time_point;
 
+/// @brief   The raw type of a count of `perf_clock_t` ticks.
+/// @details Events store their time stamps as a count of ticks since the epoch
+///          of the clock rather than as a `time_point_t`, which keeps them
+///          trivially copyable and compact. Use `to_time_point` to convert
+///          them back.
+using tick_t = perf_clock_t::rep;
+
+/// @brief   A small, dense index identifying the thread an event came from.
+/// @details Each thread is assigned the next index the first time it records
+///          an event, which is much cheaper to store, compare, and hash than
+///          a `std::thread::id`.
+using thread_index_t = std::uint16_t;
+
+/// @brief   Converts the given time point into a count of ticks.
+/// @param   time The time point that should be converted.
+/// @returns The number of ticks since the epoch of `perf_clock_t`.
+inline constexpr tick_t
+to_ticks(time_point_t time) noexcept {
+    return time.time_since_epoch().count();
+}
+
+/// @brief   Converts the given count of ticks into a time point.
+/// @param   ticks The number of ticks since the epoch of `perf_clock_t`.
+/// @returns The time point the ticks represent.
+inline constexpr time_point_t
+to_time_point(tick_t ticks) noexcept {
+    return time_point_t{ perf_clock_t::duration{ ticks } };
+}
+
+/// @brief   Converts the given count of ticks into nanoseconds.
+/// @param   ticks The number of `perf_clock_t` ticks.
+/// @returns The number of nanoseconds the ticks represent.
+inline constexpr std::int64_t
+to_nanoseconds(tick_t ticks) noexcept {
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    return duration_cast<nanoseconds>(perf_clock_t::duration{ ticks }).count();
+}
+
 } // namespace malunal::tooling
@@ -0,0 +1,498 @@
+/// @file   compare.hpp
+/// @brief  Contains the comparison of two timelines, for finding performance
+///         regressions between captures.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+
+/// @brief   The verdict on a single name or call path of a comparison.
+enum class comparison_verdict : std::uint8_t {
+    /// @brief   No significant change was found.
+    unchanged,
+
+    /// @brief   The candidate is significantly faster than the baseline.
+    improved,
+
+    /// @brief   The candidate is significantly slower than the baseline.
+    regressed,
+
+    /// @brief   Only the candidate has events of this name or call path.
+    added,
+
+    /// @brief   Only the baseline has events of this name or call path.
+    removed
+};
+
+/// @brief   Options that control how two timelines are compared.
+struct comparison_options final {
+    /// @brief   The largest p-value at which a difference in means counts as
+    ///          significant.
+    double significance{ 0.05 };
+
+    /// @brief   The smallest relative change of the mean that counts as an
+    ///          improvement or regression, once it is significant.
+    /// @details Keeps differences that are real, but too small to matter, such
+    ///          as those found by comparing millions of events, from failing a
+    ///          merge.
+    double threshold{ 0.05 };
+
+    /// @brief   Whether each call path should be compared as well as each name.
+    bool call_paths{ true };
+
+    /// @brief   The number of threads used to sort the events of each timeline,
+    ///          or zero for one per hardware thread.
+    std::size_t workers{ 1 };
+};
+
+/// @brief   A summary of the durations of one name or call path in one of the
+///          compared timelines.
+/// @details All of the times are in nanoseconds. The percentiles are
+///          estimated from the latency histogram, so they are only accurate
+///          to within 12.5 percent.
+struct comparison_side final {
+    std::uint64_t count{ 0 };
+    double mean{ 0.0 };
+    double stddev{ 0.0 };
+    std::uint64_t p50{ 0 };
+    std::uint64_t p95{ 0 };
+    std::uint64_t p99{ 0 };
+
+    /// @brief   Summarizes the given statistics.
+    /// @param   stats The statistics of the name or call path.
+    /// @returns The summary.
+    static comparison_side
+    of(const name_statistics& stats) noexcept {
+        return comparison_side {
+            .count  = stats.count,
+            .mean   = stats.mean(),
+            .stddev = std::sqrt(stats.variance()),
+            .p50    = stats.percentile(50.0),
+            .p95    = stats.percentile(95.0),
+            .p99    = stats.percentile(99.0)
+        };
+    }
+};
+
+/// @brief   The comparison of one name or call path between two timelines.
+struct comparison_entry final {
+    /// @brief   The name, or the call path as names joined by semicolons,
+    ///          outermost first.
+    std::string key;
+
+    /// @brief   The durations in the baseline.
+    comparison_side baseline;
+
+    /// @brief   The durations in the candidate.
+    comparison_side candidate;
+
+    /// @brief   The statistic of Welch's t-test on the means.
+    double t_statistic{ 0.0 };
+
+    /// @brief   The degrees of freedom of Welch's t-test.
+    double degrees_of_freedom{ 0.0 };
+
+    /// @brief   The two sided p-value of Welch's t-test; the chance of seeing a
+    ///          difference at least this large if the means were the same.
+    double p_value{ 1.0 };
+
+    /// @brief   The verdict on the difference.
+    comparison_verdict verdict{ comparison_verdict::unchanged };
+
+    /// @brief   Gets the relative change of the mean.
+    /// @returns The change of the mean in proportion to the baseline, or zero
+    ///          if the baseline has no duration.
+    double
+    mean_change() const noexcept {
+        if (baseline.mean <= 0.0)
+            return 0.0;
+        return (candidate.mean - baseline.mean) / baseline.mean;
+    }
+};
+
+namespace detail {
+
+/// @brief   Evaluates the continued fraction of the incomplete beta function,
+///          with the modified Lentz method.
+inline double
+beta_fraction(double a, double b, double x) noexcept {
+    constexpr int k_iterations = 200;
+    constexpr double k_epsilon = 1e-14;
+    constexpr double k_tiny = 1e-300;
+    auto guard = [](double value) {
+        return std::abs(value) < k_tiny ? k_tiny : value;
+    };
+
+    auto c = 1.0;
+    auto d = 1.0 / guard(1.0 - (a + b) * x / (a + 1.0));
+    auto result = d;
+    for (int m = 1; m <= k_iterations; m++) {
+        auto m2 = 2.0 * m;
+        auto even = m * (b - m) * x / ((a + m2 - 1.0) * (a + m2));
+        d = 1.0 / guard(1.0 + even * d);
+        c = guard(1.0 + even / c);
+        result *= d * c;
+
+        auto odd = -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1.0));
+        d = 1.0 / guard(1.0 + odd * d);
+        c = guard(1.0 + odd / c);
+        auto step = d * c;
+        result *= step;
+        if (std::abs(step - 1.0) < k_epsilon)
+            break;
+    }
+
+    return result;
+}
+
+/// @brief   Evaluates the regularized incomplete beta function.
+/// @param   a The first shape parameter.
+/// @param   b The second shape parameter.
+/// @param   x The point at which the function is evaluated, between 0 and 1.
+/// @returns The value of the function.
+inline double
+regularized_beta(double a, double b, double x) noexcept {
+    if (x <= 0.0)
+        return 0.0;
+    if (x >= 1.0)
+        return 1.0;
+
+    auto front = std::exp(std::lgamma(a + b) - std::lgamma(a) -
+        std::lgamma(b) + a * std::log(x) + b * std::log1p(-x));
+    if (x < (a + 1.0) / (a + b + 2.0))
+        return front * beta_fraction(a, b, x) / a;
+    return 1.0 - front * beta_fraction(b, a, 1.0 - x) / b;
+}
+
+/// @brief   Runs Welch's t-test on the means of two sets of statistics, and
+///          gives the verdict of the comparison.
+/// @param   entry The entry holding both sides, which receives the results.
+/// @param   before The statistics of the baseline.
+/// @param   after The statistics of the candidate.
+/// @param   options The options of the comparison.
+inline void
+welch_test(
+    comparison_entry& entry,
+    const name_statistics& before,
+    const name_statistics& after,
+    const comparison_options& options
+) noexcept {
+    if (before.count == 0 || after.count == 0) {
+        entry.verdict = before.count == 0 ? comparison_verdict::added
+                                          : comparison_verdict::removed;
+        return;
+    }
+
+    // Without at least two events on each side there is no variance to test
+    // against, so nothing can be significant.
+    if (before.count < 2 || after.count < 2)
+        return;
+
+    auto n1 = static_cast<double>(before.count);
+    auto n2 = static_cast<double>(after.count);
+    auto e1 = before.variance() / n1;
+    auto e2 = after.variance() / n2;
+    auto difference = after.mean() - before.mean();
+    if (e1 + e2 <= 0.0) {
+        entry.p_value = difference == 0.0 ? 1.0 : 0.0;
+    } else {
+        auto t  = difference / std::sqrt(e1 + e2);
+        auto df = (e1 + e2) * (e1 + e2) /
+            (e1 * e1 / (n1 - 1.0) + e2 * e2 / (n2 - 1.0));
+        entry.t_statistic = t;
+        entry.degrees_of_freedom = df;
+        entry.p_value = regularized_beta(df / 2.0, 0.5, df / (df + t * t));
+    }
+
+    if (entry.p_value >= options.significance)
+        return;
+
+    auto change = entry.mean_change();
+    if (change > options.threshold)
+        entry.verdict = comparison_verdict::regressed;
+    else if (change < -options.threshold)
+        entry.verdict = comparison_verdict::improved;
+}
+
+/// @brief   The statistics of every name and call path of a timeline, keyed by
+///          their text, so that timelines from different processes line up.
+struct capture_profile final {
+    std::unordered_map<std::string, name_statistics> names;
+    std::unordered_map<std::string, name_statistics> paths;
+};
+
+/// @brief   Aggregates the timing events of a timeline by name and call path.
+/// @details Timelines which only hold the statistics of a session, and no
+///          events, are profiled by name from those statistics.
+/// @param   source The timeline that should be profiled.
+/// @param   options The options of the comparison.
+/// @returns The statistics of each name and call path.
+inline capture_profile
+profile_capture(
+    const timeline& source,
+    const comparison_options& options
+) noexcept {
+    capture_profile result;
+    auto events = source.timing_events();
+    if (events.empty()) {
+        for (const auto& [name, stats] : source.statistics())
+            result.names[std::string{ name_registry::resolve(name) }]
+                .merge(stats);
+        return result;
+    }
+
+    std::vector<name_statistics> nodes;
+    auto tree = call_tree::build(events,
+        [&nodes](const timing_event& e, std::uint32_t index) {
+            if (index >= nodes.size())
+                nodes.resize(index + 1);
+            nodes[index].record(static_cast<std::uint64_t>(
+                std::max<std::int64_t>(to_nanoseconds(e.duration), 0)));
+        }, options.workers);
+
+    std::string path;
+    for (std::uint32_t i = 1; i < nodes.size(); i++) {
+        if (nodes[i].count == 0)
+            continue;
+
+        auto name = std::string{ name_registry::resolve(tree[i].name) };
+        result.names[name].merge(nodes[i]);
+        if (!options.call_paths)
+            continue;
+
+        path.clear();
+        for (auto part : tree.path(i)) {
+            if (!path.empty())
+                path += ';';
+            path += name_registry::resolve(part);
+        }
+        result.paths[path].merge(nodes[i]);
+    }
+
+    return result;
+}
+
+/// @brief   Compares the statistics of every key found in either profile.
+/// @returns The entries, sorted by key.
+inline std::vector<comparison_entry>
+compare_profiles(
+    const std::unordered_map<std::string, name_statistics>& before,
+    const std::unordered_map<std::string, name_statistics>& after,
+    const comparison_options& options
+) noexcept {
+    static const name_statistics k_empty{ };
+    auto find = [](const auto& profile, const std::string& key)
+        -> const name_statistics& {
+        auto it = profile.find(key);
+        return it == profile.end() ? k_empty : it->second;
+    };
+
+    std::vector<comparison_entry> result;
+    auto add = [&](const std::string& key) {
+        const auto& base = find(before, key);
+        const auto& cand = find(after, key);
+        comparison_entry entry {
+            .key       = key,
+            .baseline  = comparison_side::of(base),
+            .candidate = comparison_side::of(cand)
+        };
+
+        welch_test(entry, base, cand, options);
+        result.push_back(std::move(entry));
+    };
+
+    for (const auto& [key, stats] : before)
+        add(key);
+    for (const auto& [key, stats] : after) {
+        if (!before.contains(key))
+            add(key);
+    }
+
+    std::sort(result.begin(), result.end(),
+        [](const comparison_entry& lhs, const comparison_entry& rhs) {
+            return lhs.key < rhs.key;
+        });
+    return result;
+}
+
+} // namespace malunal::tooling::detail
+
+/// @brief   The comparison of a candidate timeline against a baseline, by name
+///          and by call path.
+/// @details Each name and call path is tested for a difference in its mean
+///          duration with Welch's t-test, which doesn't assume both captures
+///          have the same variance. A difference is only called a regression
+///          or improvement when it is both significant and larger than the
+///          threshold of the options. The report can be written as JSON, to
+///          gate merges on from a script.
+/// @remarks Sampled events are compared as they were recorded, which is fair
+///          as long as both captures sampled the same way.
+struct timeline_comparison final {
+    /// @brief   Compares the candidate timeline against the baseline.
+    /// @param   baseline The timeline captured before the change.
+    /// @param   candidate The timeline captured after the change.
+    /// @param   options The options of the comparison.
+    /// @returns The comparison of every name and call path.
+    static timeline_comparison
+    compare(
+        const timeline& baseline,
+        const timeline& candidate,
+        const comparison_options& options = { }
+    ) noexcept {
+        auto before = detail::profile_capture(baseline, options);
+        auto after  = detail::profile_capture(candidate, options);
+        timeline_comparison result;
+        result.options = options;
+        result.names = detail::compare_profiles(
+            before.names, after.names, options);
+        result.paths = detail::compare_profiles(
+            before.paths, after.paths, options);
+        return result;
+    }
+
+    /// @brief   Checks whether any name or call path regressed.
+    /// @returns True if one did; false otherwise.
+    bool
+    regressed() const noexcept {
+        auto regression = [](const comparison_entry& entry) {
+            return entry.verdict == comparison_verdict::regressed;
+        };
+
+        return std::any_of(names.begin(), names.end(), regression) ||
+               std::any_of(paths.begin(), paths.end(), regression);
+    }
+
+    /// @brief   Writes the comparison as a JSON document.
+    /// @param   out The buffer the document should be written to.
+    void
+    write_json(detail::output_buffer& out) const noexcept {
+        out.append("{\"significance\":");
+        out.append_number(options.significance);
+        out.append(",\"threshold\":");
+        out.append_number(options.threshold);
+        out.append(",\"regressed\":");
+        out.append(regressed() ? "true" : "false");
+        out.append(",\n\"names\":[");
+        write_entries(out, names);
+        out.append("],\n\"paths\":[");
+        write_entries(out, paths);
+        out.append("]}\n");
+    }
+
+    /// @brief   Writes the comparison as a JSON document to the given stream.
+    /// @param   stream The stream the document should be written to.
+    void
+    dump_json(std::ostream& stream) const noexcept {
+        detail::output_buffer out{ stream };
+        write_json(out);
+    }
+
+    /// @brief   Gets the comparison as a JSON document.
+    /// @returns The JSON document.
+    std::string
+    json() const noexcept {
+        detail::output_buffer out;
+        write_json(out);
+        return std::string{ out.view() };
+    }
+
+    /// @brief   The options the timelines were compared with.
+    comparison_options options;
+
+    /// @brief   The comparison of each name, sorted by name.
+    std::vector<comparison_entry> names;
+
+    /// @brief   The comparison of each call path, sorted by path.
+    std::vector<comparison_entry> paths;
+
+private:
+    static std::string_view
+    verdict_name(comparison_verdict verdict) noexcept {
+        switch (verdict) {
+        case comparison_verdict::improved:  return "improved";
+        case comparison_verdict::regressed: return "regressed";
+        case comparison_verdict::added:     return "added";
+        case comparison_verdict::removed:   return "removed";
+        default:                            return "unchanged";
+        }
+    }
+
+    static void
+    write_side(
+        detail::output_buffer& out,
+        const comparison_side& side
+    ) noexcept {
+        out.append("{\"count\":");
+        out.append_integer(side.count);
+        out.append(",\"mean\":");
+        out.append_number(side.mean);
+        out.append(",\"stddev\":");
+        out.append_number(side.stddev);
+        out.append(",\"p50\":");
+        out.append_integer(side.p50);
+        out.append(",\"p95\":");
+        out.append_integer(side.p95);
+        out.append(",\"p99\":");
+        out.append_integer(side.p99);
+        out.append('}');
+    }
+
+    static void
+    write_delta(
+        detail::output_buffer& out,
+        const comparison_side& before,
+        const comparison_side& after
+    ) noexcept {
+        auto signed_delta = [](std::uint64_t lhs, std::uint64_t rhs) {
+            return static_cast<std::int64_t>(rhs) -
+                   static_cast<std::int64_t>(lhs);
+        };
+
+        out.append("{\"count\":");
+        out.append_integer(signed_delta(before.count, after.count));
+        out.append(",\"mean\":");
+        out.append_number(after.mean - before.mean);
+        out.append(",\"p50\":");
+        out.append_integer(signed_delta(before.p50, after.p50));
+        out.append(",\"p95\":");
+        out.append_integer(signed_delta(before.p95, after.p95));
+        out.append(",\"p99\":");
+        out.append_integer(signed_delta(before.p99, after.p99));
+        out.append('}');
+    }
+
+    static void
+    write_entries(
+        detail::output_buffer& out,
+        std::span<const comparison_entry> entries
+    ) noexcept {
+        bool first = true;
+        for (const auto& entry : entries) {
+            out.append(first ? "\n" : ",\n");
+            first = false;
+            out.append("{\"key\":\"");
+            out.append_escaped(entry.key);
+            out.append("\",\"verdict\":\"");
+            out.append(verdict_name(entry.verdict));
+            out.append("\",\"baseline\":");
+            write_side(out, entry.baseline);
+            out.append(",\"candidate\":");
+            write_side(out, entry.candidate);
+            out.append(",\"delta\":");
+            write_delta(out, entry.baseline, entry.candidate);
+            out.append(",\"mean_change\":");
+            out.append_number(entry.mean_change());
+            out.append(",\"t\":");
+            out.append_number(entry.t_statistic);
+            out.append(",\"df\":");
+            out.append_number(entry.degrees_of_freedom);
+            out.append(",\"p\":");
+            out.append_number(entry.p_value);
+            out.append('}');
+        }
+    }
+};
+
+} // namespace malunal::tooling
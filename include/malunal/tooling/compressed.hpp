@@ -0,0 +1,867 @@
+/// @file   compressed.hpp
+/// @brief  Contains the compressed capture format of the performance tooling,
+///         along with a sink that writes it and a reader for it.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+
+/// @brief   The ways the payload of a block in a compressed capture can be
+///          stored.
+enum class compression_codec : std::uint32_t {
+    /// @brief   The encoded events are stored as they are.
+    none = 0,
+
+    /// @brief   The encoded events are compressed with zstd, which is only
+    ///          available when built with `MALUNAL_TOOLING_USE_ZSTD`.
+    zstd = 1
+};
+
+/// @brief   Describes one block of a compressed capture, as kept in the index
+///          at the end of the capture.
+struct compressed_block_info final {
+    /// @brief   Where the header of the block starts in the capture.
+    std::uint64_t offset;
+
+    /// @brief   The number of events in the block.
+    std::uint32_t count;
+
+    /// @brief   The number of names in the dictionary of the block.
+    std::uint32_t names;
+
+    /// @brief   The earliest time any event of the block starts at.
+    tick_t first;
+
+    /// @brief   The latest time any event of the block ends at.
+    tick_t last;
+};
+
+namespace detail {
+
+/// @brief   The magic bytes at the start of every compressed capture.
+inline constexpr std::array<char, 8> k_compressed_magic{
+    'M', 'T', 'C', 'O', 'M', 'P', 'R', 'S'
+};
+
+/// @brief   The magic bytes at the very end of a compressed capture which was
+///          closed, and so has an index.
+inline constexpr std::array<char, 8> k_compressed_index_magic{
+    'M', 'T', 'C', 'I', 'N', 'D', 'E', 'X'
+};
+
+/// @brief   The version of the compressed capture format.
+inline constexpr std::uint32_t k_compressed_version = 1;
+
+/// @brief   Written at the start of every block, so a capture without an
+///          index can still be scanned block by block.
+inline constexpr std::uint32_t k_compressed_block_magic = 0x4B4C4254;
+
+/// @brief   The largest payload a block may decode into, which keeps a
+///          corrupt capture from asking for an absurd allocation.
+inline constexpr std::uint64_t k_compressed_max_block = std::uint64_t{ 1 } << 30;
+
+/// @brief   The header at the start of every compressed capture.
+struct compressed_header final {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t byte_order;
+};
+
+/// @brief   The header in front of every block of a compressed capture.
+/// @details The payload of a block starts with its dictionary, holding the
+///          length and characters of each name the block refers to, followed
+///          by its events. Each event is written as variable length integers:
+///          the index of its type in `event_variant_t`, the index of its name
+///          in the dictionary, its thread, its flags, and the difference
+///          between its time and that of the previous event of its thread in
+///          the block, followed by the fields of its type. Nothing refers
+///          outside of the block, so every block can be decoded on its own.
+struct compressed_block_header final {
+    std::uint32_t magic;
+    std::uint32_t codec;
+    std::uint32_t count;
+    std::uint32_t names;
+    std::uint64_t stored_size;
+    std::uint64_t raw_size;
+    tick_t first;
+    tick_t last;
+};
+
+/// @brief   The trailer at the very end of a compressed capture which was
+///          closed, pointing at the index of its blocks.
+struct compressed_trailer final {
+    std::uint64_t index_offset;
+    std::uint64_t block_count;
+    std::array<char, 8> magic;
+};
+
+/// @brief   Appends the given value as a variable length integer, seven bits
+///          at a time.
+/// @param   out The bytes the value should be appended to.
+/// @param   value The value that should be appended.
+inline void
+put_varint(std::vector<std::uint8_t>& out, std::uint64_t value) noexcept {
+    while (value >= 0x80) {
+        out.push_back(static_cast<std::uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+
+    out.push_back(static_cast<std::uint8_t>(value));
+}
+
+/// @brief   Maps a signed value onto an unsigned one, so that values close to
+///          zero stay small whatever their sign.
+/// @param   value The signed value.
+/// @returns The unsigned value.
+inline constexpr std::uint64_t
+zigzag_encode(std::int64_t value) noexcept {
+    return (static_cast<std::uint64_t>(value) << 1) ^
+           static_cast<std::uint64_t>(value >> 63);
+}
+
+/// @brief   Maps a value given by `zigzag_encode` back onto the signed one.
+/// @param   value The unsigned value.
+/// @returns The signed value.
+inline constexpr std::int64_t
+zigzag_decode(std::uint64_t value) noexcept {
+    return static_cast<std::int64_t>(value >> 1) ^
+           -static_cast<std::int64_t>(value & 1);
+}
+
+/// @brief   Reads variable length integers and raw bytes out of a payload,
+///          remembering if it ever ran past the end.
+struct varint_reader final {
+    /// @brief   Reads the next variable length integer.
+    /// @returns The value, or zero if the payload was cut short.
+    std::uint64_t
+    next() noexcept {
+        std::uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (at == end)
+                break;
+
+            auto byte = *at++;
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+                return value;
+        }
+
+        good = false;
+        return 0;
+    }
+
+    /// @brief   Reads the given number of raw bytes.
+    /// @param   size The number of bytes.
+    /// @returns The bytes, or an empty span if the payload was cut short.
+    std::span<const std::uint8_t>
+    bytes(std::uint64_t size) noexcept {
+        if (size > static_cast<std::uint64_t>(end - at)) {
+            good = false;
+            return { };
+        }
+
+        auto result = std::span<const std::uint8_t>(at, size);
+        at += size;
+        return result;
+    }
+
+    const std::uint8_t* at;
+    const std::uint8_t* end;
+    bool good{ true };
+};
+
+/// @brief   Gets the time the given event starts at.
+/// @param   e The event.
+/// @returns The start of a timing event, or when any other event happened.
+template<typename T>
+tick_t
+time_of(const T& e) noexcept {
+    if constexpr (std::is_same_v<T, timing_event>)
+        return e.start;
+    else return e.when;
+}
+
+/// @brief   Sets the time the given event starts at.
+/// @param   e The event.
+/// @param   time The start of a timing event, or when any other event
+///          happened.
+template<typename T>
+void
+set_time_of(T& e, tick_t time) noexcept {
+    if constexpr (std::is_same_v<T, timing_event>)
+        e.start = time;
+    else e.when = time;
+}
+
+/// @brief   Gets the time the given event ends at.
+/// @param   e The event.
+/// @returns The end of a timing event, or when any other event happened.
+template<typename T>
+tick_t
+end_time_of(const T& e) noexcept {
+    if constexpr (std::is_same_v<T, timing_event>)
+        return e.end();
+    else return e.when;
+}
+
+/// @brief   Appends the fields which only events of the given type have.
+/// @param   out The bytes the fields should be appended to.
+/// @param   e The event.
+template<typename T>
+void
+encode_fields(std::vector<std::uint8_t>& out, const T& e) noexcept {
+    if constexpr (std::is_same_v<T, timing_event>) {
+        put_varint(out, zigzag_encode(e.duration));
+    } else if constexpr (std::is_same_v<T, counter_event>) {
+        std::array<std::uint8_t, sizeof(double)> bytes;
+        std::memcpy(bytes.data(), &e.value, sizeof(double));
+        out.insert(out.end(), bytes.begin(), bytes.end());
+    } else if constexpr (std::is_same_v<T, flow_event>) {
+        put_varint(out, e.id);
+        put_varint(out, static_cast<std::uint32_t>(e.phase));
+    } else if constexpr (std::is_same_v<T, pmu_event>) {
+        put_varint(out, static_cast<std::uint32_t>(e.counter));
+        put_varint(out, e.value);
+    } else if constexpr (std::is_same_v<T, allocation_event>) {
+        put_varint(out, e.count);
+        put_varint(out, e.bytes);
+    } else {
+        static_assert(std::is_same_v<T, instant_event>,
+            "Every event type must be encoded by the compressed capture.");
+    }
+}
+
+/// @brief   Reads the fields which only events of the given type have.
+/// @param   in The reader of the payload.
+/// @param   e The event the fields should be read into.
+template<typename T>
+void
+decode_fields(varint_reader& in, T& e) noexcept {
+    if constexpr (std::is_same_v<T, timing_event>) {
+        e.duration = zigzag_decode(in.next());
+    } else if constexpr (std::is_same_v<T, counter_event>) {
+        auto bytes = in.bytes(sizeof(double));
+        if (!bytes.empty())
+            std::memcpy(&e.value, bytes.data(), sizeof(double));
+    } else if constexpr (std::is_same_v<T, flow_event>) {
+        e.id    = static_cast<std::uint32_t>(in.next());
+        e.phase = static_cast<flow_phase>(in.next());
+    } else if constexpr (std::is_same_v<T, pmu_event>) {
+        e.counter = static_cast<pmu_counter>(in.next());
+        e.value   = static_cast<std::uint32_t>(in.next());
+    } else if constexpr (std::is_same_v<T, allocation_event>) {
+        e.count = static_cast<std::uint32_t>(in.next());
+        e.bytes = static_cast<std::uint32_t>(in.next());
+    }
+}
+
+/// @brief   Encodes events into the payload of a single block.
+/// @details Names are collected into the dictionary of the block as they are
+///          first used, and times are kept as the difference from the
+///          previous event of the same thread, which keeps the integers of a
+///          busy thread down to a byte or two.
+struct block_encoder final {
+    /// @brief   Appends the given event to the block.
+    /// @param   e The event that should be appended.
+    void
+    push(const event_variant_t& e) noexcept {
+        put_varint(events, e.index());
+        std::visit([this](const auto& arg) {
+            auto time = time_of(arg);
+            auto [it, inserted] = dictionary.try_emplace(
+                arg.name, static_cast<std::uint32_t>(names.size()));
+            if (inserted)
+                names.push_back(arg.name);
+
+            auto& previous = times[arg.tid];
+            put_varint(events, it->second);
+            put_varint(events, arg.tid);
+            put_varint(events, arg.flags);
+            put_varint(events, zigzag_encode(static_cast<std::int64_t>(
+                static_cast<std::uint64_t>(time) -
+                static_cast<std::uint64_t>(previous))));
+            encode_fields(events, arg);
+            previous = time;
+
+            first = count == 0 ? time : std::min(first, time);
+            last  = count == 0 ? end_time_of(arg)
+                                 : std::max(last, end_time_of(arg));
+        }, e);
+        count++;
+    }
+
+    /// @brief   Writes the dictionary and the events of the block into the
+    ///          given payload.
+    /// @param   payload The bytes the block should be written to.
+    void
+    finish(std::vector<std::uint8_t>& payload) const noexcept {
+        payload.clear();
+        for (auto id : names) {
+            auto name = name_registry::resolve(id);
+            put_varint(payload, name.size());
+            payload.insert(payload.end(), name.begin(), name.end());
+        }
+
+        payload.insert(payload.end(), events.begin(), events.end());
+    }
+
+    /// @brief   Empties the block, keeping its memory.
+    void
+    clear() noexcept {
+        dictionary.clear();
+        names.clear();
+        times.clear();
+        events.clear();
+        count = 0;
+    }
+
+    std::unordered_map<name_id_t, std::uint32_t> dictionary;
+    std::unordered_map<thread_index_t, tick_t> times;
+    std::vector<name_id_t> names;
+    std::vector<std::uint8_t> events;
+    std::uint32_t count{ 0 };
+    tick_t first{ 0 };
+    tick_t last{ 0 };
+};
+
+/// @brief   Decodes the events of the given type, whose index in
+///          `event_variant_t` was already read.
+template<std::size_t Index>
+event_variant_t
+decode_event(
+    varint_reader& in,
+    std::span<const name_id_t> names,
+    std::unordered_map<thread_index_t, tick_t>& times
+) noexcept {
+    using T = std::variant_alternative_t<Index, event_variant_t>;
+    T record{ };
+    auto name  = in.next();
+    record.name  = name < names.size() ? names[name] : 0;
+    record.tid   = static_cast<thread_index_t>(in.next());
+    record.flags = static_cast<std::uint16_t>(in.next());
+
+    auto& previous = times[record.tid];
+    previous = static_cast<tick_t>(static_cast<std::uint64_t>(previous) +
+        static_cast<std::uint64_t>(zigzag_decode(in.next())));
+    set_time_of(record, previous);
+    decode_fields(in, record);
+    return event_variant_t{ std::in_place_index<Index>, record };
+}
+
+/// @brief   Decodes the payload of a block, giving each of its events to the
+///          consumer in the order they were written.
+/// @details The names in the dictionary of the block are interned into the
+///          name registry of this process, which may be done from several
+///          threads at once.
+/// @param   header The header of the block.
+/// @param   stored The payload of the block, as it was stored.
+/// @param   scratch Holds the payload once it is decompressed.
+/// @param   consumer Called with each event of the block.
+/// @returns True if the block was decoded; false if it was corrupt, or was
+///          compressed with a codec this build doesn't support.
+template<typename Consumer>
+bool
+decode_block(
+    const compressed_block_header& header,
+    std::span<const std::uint8_t> stored,
+    std::vector<std::uint8_t>& scratch,
+    Consumer& consumer
+) noexcept {
+    auto raw = stored;
+    if (header.codec == static_cast<std::uint32_t>(compression_codec::zstd)) {
+#ifdef MALUNAL_TOOLING_USE_ZSTD
+        if (header.raw_size > k_compressed_max_block)
+            return false;
+
+        scratch.resize(header.raw_size);
+        auto size = ZSTD_decompress(scratch.data(), scratch.size(),
+            stored.data(), stored.size());
+        if (ZSTD_isError(size) || size != header.raw_size)
+            return false;
+        raw = scratch;
+#else
+        static_cast<void>(scratch);
+        return false;
+#endif
+    } else if (header.codec != static_cast<std::uint32_t>(compression_codec::none)) {
+        return false;
+    }
+
+    // Every name takes at least a byte for its length, so a block claiming
+    // more names than it has bytes is corrupt.
+    if (header.names > raw.size())
+        return false;
+
+    varint_reader in{ .at = raw.data(), .end = raw.data() + raw.size() };
+    std::vector<name_id_t> names(header.names);
+    for (auto& id : names) {
+        auto name = in.bytes(in.next());
+        id = name_registry::intern(std::string_view(
+            reinterpret_cast<const char*>(name.data()), name.size()));
+    }
+
+    constexpr auto k_types = std::variant_size_v<event_variant_t>;
+    std::unordered_map<thread_index_t, tick_t> times;
+    for (std::uint32_t i = 0; i < header.count && in.good; i++) {
+        auto index = in.next();
+        if (index >= k_types)
+            return false;
+
+        auto e = [&]<std::size_t... Index>(std::index_sequence<Index...>) {
+            event_variant_t result;
+            static_cast<void>(((index == Index &&
+                (result = decode_event<Index>(in, names, times), true)) || ...));
+            return result;
+        }(std::make_index_sequence<k_types>{});
+        if (in.good)
+            consumer(std::as_const(e));
+    }
+
+    return in.good;
+}
+
+} // namespace malunal::tooling::detail
+
+
+/// @brief   A sink which streams events into a compressed capture file while
+///          the session is running.
+/// @details Events of every type are encoded into the same block as they
+///          arrive, and each block is written out once it is full, so the
+///          memory used by the sink stays bounded no matter how long the
+///          session runs. Each block carries its own dictionary of names, so
+///          any block can be decoded on its own, and an index of every block
+///          is written at the end once the sink is closed. The file is
+///          flushed after every block, so if the process crashes, a reader
+///          scans the blocks that made it to the file instead, and only the
+///          block still being filled is lost.
+/// @remarks The blocks are compressed with zstd when built with
+///          `MALUNAL_TOOLING_USE_ZSTD`; otherwise, or when compressing
+///          wouldn't make a block smaller, only the encoding of the events
+///          shrinks them.
+struct compressed_capture_sink final : event_sink {
+    /// @brief   Opens the file at the given path and writes the header.
+    /// @param   path The path of the file that should be written.
+    /// @param   block_events How many events are collected before they are
+    ///          written out as a block.
+    /// @param   level The compression level given to zstd, if it is used.
+    explicit compressed_capture_sink(
+        const std::string& path,
+        std::size_t block_events = 16384,
+        int level = 3
+    ) noexcept
+        : block_events_{ std::clamp<std::size_t>(block_events, 1,
+              std::numeric_limits<std::uint32_t>::max()) }
+        , level_{ level }
+        , file_{ std::fopen(path.c_str(), "wb") }
+    {
+        if (file_ == nullptr)
+            return;
+
+        std::setvbuf(file_, nullptr, _IOFBF, k_file_buffer_size);
+        detail::compressed_header header {
+            .magic      = detail::k_compressed_magic,
+            .version    = detail::k_compressed_version,
+            .byte_order = detail::k_capture_byte_order
+        };
+
+        write(&header, sizeof(header));
+    }
+
+    ~compressed_capture_sink() noexcept override {
+        close();
+    }
+
+    compressed_capture_sink(const compressed_capture_sink&) = delete;
+    compressed_capture_sink& operator=(const compressed_capture_sink&) = delete;
+
+    /// @brief   Checks if the file was opened and every write succeeded.
+    /// @returns True if the capture is intact; false otherwise.
+    bool
+    good() const noexcept {
+        return file_ != nullptr && good_;
+    }
+
+    /// @brief   Encodes the given events into the current block, writing it
+    ///          out whenever it fills up.
+    /// @param   events The batch of events drained from one thread buffer.
+    void
+    consume(std::span<const event_variant_t> events) noexcept override {
+        if (file_ == nullptr)
+            return;
+
+        for (const auto& e : events) {
+            encoder_.push(e);
+            if (encoder_.count >= block_events_)
+                write_block();
+        }
+    }
+
+    /// @brief   Writes every event of the given timeline into the capture.
+    /// @param   source The timeline that should be written.
+    void
+    write(const timeline& source) noexcept {
+        struct writer final {
+            void
+            visit(const event_variant_t& e) noexcept {
+                sink.consume(std::span<const event_variant_t>(&e, 1));
+            }
+
+            compressed_capture_sink& sink;
+        } visitor{ *this };
+
+        source.accept(visitor);
+    }
+
+    /// @brief   Writes out the block that is still being filled, and flushes
+    ///          the file.
+    void
+    flush() noexcept override {
+        if (file_ == nullptr)
+            return;
+
+        write_block();
+        if (std::fflush(file_) != 0)
+            good_ = false;
+    }
+
+    /// @brief   Writes out the block that is still being filled, followed by
+    ///          the index of every block, and closes the file.
+    /// @details Nothing more is written once the sink is closed.
+    void
+    close() noexcept {
+        if (file_ == nullptr)
+            return;
+
+        write_block();
+        detail::compressed_trailer trailer {
+            .index_offset = offset_,
+            .block_count  = index_.size(),
+            .magic        = detail::k_compressed_index_magic
+        };
+
+        write(index_.data(), index_.size() * sizeof(compressed_block_info));
+        write(&trailer, sizeof(trailer));
+        if (std::fclose(file_) != 0)
+            good_ = false;
+        file_ = nullptr;
+    }
+
+private:
+    static constexpr std::size_t k_file_buffer_size = 1 << 20;
+
+    void
+    write(const void* data, std::size_t size) noexcept {
+        if (std::fwrite(data, 1, size, file_) != size)
+            good_ = false;
+        offset_ += size;
+    }
+
+    void
+    write_block() noexcept {
+        if (encoder_.count == 0)
+            return;
+
+        encoder_.finish(payload_);
+        auto codec  = compression_codec::none;
+        auto stored = std::span<const std::uint8_t>(payload_);
+#ifdef MALUNAL_TOOLING_USE_ZSTD
+        compressed_.resize(ZSTD_compressBound(payload_.size()));
+        auto size = ZSTD_compress(compressed_.data(), compressed_.size(),
+            payload_.data(), payload_.size(), level_);
+        if (!ZSTD_isError(size) && size < payload_.size()) {
+            codec  = compression_codec::zstd;
+            stored = std::span<const std::uint8_t>(compressed_.data(), size);
+        }
+#endif
+
+        detail::compressed_block_header header {
+            .magic       = detail::k_compressed_block_magic,
+            .codec       = static_cast<std::uint32_t>(codec),
+            .count       = encoder_.count,
+            .names       = static_cast<std::uint32_t>(encoder_.names.size()),
+            .stored_size = stored.size(),
+            .raw_size    = payload_.size(),
+            .first       = encoder_.first,
+            .last        = encoder_.last
+        };
+
+        index_.push_back(compressed_block_info {
+            .offset = offset_,
+            .count  = header.count,
+            .names  = header.names,
+            .first  = header.first,
+            .last   = header.last
+        });
+
+        write(&header, sizeof(header));
+        write(stored.data(), stored.size());
+        encoder_.clear();
+        if (std::fflush(file_) != 0)
+            good_ = false;
+    }
+
+private:
+    std::size_t block_events_;
+    [[maybe_unused]] int level_;
+    detail::block_encoder encoder_;
+    std::vector<std::uint8_t> payload_;
+    std::vector<std::uint8_t> compressed_;
+    std::vector<compressed_block_info> index_;
+    std::uint64_t offset_{ 0 };
+    std::FILE* file_;
+    bool good_{ true };
+};
+
+
+/// @brief   Reads a compressed capture back, one block at a time or all at
+///          once across several threads.
+/// @details The index at the end of the capture is read when it is opened,
+///          so any block can be read without reading the ones before it. A
+///          capture that was never closed has no index, and its blocks are
+///          found by scanning it instead. Names are interned into the name
+///          registry of this process as each block is decoded.
+struct compressed_capture_reader final {
+    /// @brief   Opens the capture at the given path, checks its header and
+    ///          finds its blocks.
+    /// @param   path The path of the capture that should be read.
+    explicit compressed_capture_reader(const std::string& path) noexcept
+        : file_{ std::fopen(path.c_str(), "rb") }
+    {
+        if (file_ == nullptr)
+            return;
+
+        detail::compressed_header header{ };
+        good_ = read(&header, sizeof(header)) &&
+                header.magic      == detail::k_compressed_magic &&
+                header.version    == detail::k_compressed_version &&
+                header.byte_order == detail::k_capture_byte_order;
+        if (good_ && !read_index())
+            scan_blocks();
+    }
+
+    ~compressed_capture_reader() noexcept {
+        if (file_ != nullptr)
+            std::fclose(file_);
+    }
+
+    compressed_capture_reader(const compressed_capture_reader&) = delete;
+    compressed_capture_reader& operator=(const compressed_capture_reader&) = delete;
+
+    /// @brief   Checks if the capture was opened, has a valid header, and
+    ///          hasn't failed to read.
+    /// @returns True if the capture can be read; false otherwise.
+    bool
+    good() const noexcept {
+        return file_ != nullptr && good_;
+    }
+
+    /// @brief   Checks if the capture was closed, and so its blocks were
+    ///          found from its index rather than by scanning it.
+    /// @returns True if the capture has an index; false otherwise.
+    bool
+    indexed() const noexcept {
+        return indexed_;
+    }
+
+    /// @brief   Gets the blocks of the capture, in the order they were
+    ///          written.
+    /// @returns The description of each block.
+    std::span<const compressed_block_info>
+    blocks() const noexcept {
+        return blocks_;
+    }
+
+    /// @brief   Streams the events of the block at the given index into the
+    ///          given consumer.
+    /// @tparam  Consumer The type of the callable receiving each event.
+    /// @param   index The index of the block, into `blocks`.
+    /// @param   consumer Called with each event of the block, in order.
+    /// @returns True if the block was read; false if it was corrupt.
+    template<typename Consumer>
+    bool
+    read_block(std::size_t index, Consumer&& consumer) noexcept {
+        detail::compressed_block_header header{ };
+        if (!good() || index >= blocks_.size() ||
+            !load(blocks_[index], header, stored_))
+            return false;
+        return detail::decode_block(header, stored_, scratch_, consumer);
+    }
+
+    /// @brief   Streams every event in the capture into the given visitor,
+    ///          without holding more than a block in memory.
+    /// @tparam  Visitor The type of the visitor.
+    /// @param   visitor The visitor that should visit each event.
+    /// @returns True if every block was read; false if one was corrupt. The
+    ///          blocks before it will still have been visited.
+    template<detail::TimelineVisitor Visitor>
+    bool
+    accept(Visitor& visitor) noexcept {
+        auto consumer = [&visitor](const event_variant_t& e) {
+            visitor.visit(e);
+        };
+
+        for (std::size_t i = 0; i < blocks_.size(); i++) {
+            if (!read_block(i, consumer))
+                return false;
+        }
+
+        return good();
+    }
+
+    /// @brief   Reads the capture into a timeline.
+    /// @details The blocks are read from the file in order, then decoded
+    ///          across the given number of threads, and the events are pushed
+    ///          into the timeline in the order they were written. Blocks that
+    ///          fail to decode are left out.
+    /// @param   mode How the timeline should store timing events.
+    /// @param   workers The number of threads to decode with, or zero for one
+    ///          per hardware thread.
+    /// @returns The timeline of every event in the capture.
+    timeline
+    read_timeline(
+        storage_mode mode = storage_mode::events,
+        std::size_t workers = 1
+    ) noexcept {
+        timeline result(mode);
+        if (!good())
+            return result;
+
+        std::uint64_t total = 0;
+        std::vector<detail::compressed_block_header> headers(blocks_.size());
+        std::vector<std::vector<std::uint8_t>> stored(blocks_.size());
+        for (std::size_t i = 0; i < blocks_.size(); i++) {
+            if (!load(blocks_[i], headers[i], stored[i]))
+                headers[i].count = 0;
+            total += headers[i].count;
+        }
+
+        std::vector<std::vector<event_variant_t>> decoded(blocks_.size());
+        workers = std::min(detail::resolve_workers(workers, total),
+            std::max<std::size_t>(blocks_.size(), 1));
+        detail::parallel_for(blocks_.size(), workers,
+            [&](std::size_t, std::size_t first, std::size_t last) {
+                std::vector<std::uint8_t> scratch;
+                for (auto i = first; i < last; i++) {
+                    auto& events   = decoded[i];
+                    auto consumer  = [&events](const event_variant_t& e) {
+                        events.push_back(e);
+                    };
+
+                    // Only a hint, so a corrupt count can't ask for more than
+                    // the block could possibly hold.
+                    events.reserve(std::min<std::size_t>(
+                        headers[i].count, stored[i].size()));
+                    if (!detail::decode_block(headers[i], stored[i], scratch, consumer))
+                        events.clear();
+                    std::vector<std::uint8_t>{ }.swap(stored[i]);
+                }
+            });
+
+        for (const auto& events : decoded)
+            result.push(std::span<const event_variant_t>(events));
+        return result;
+    }
+
+private:
+    bool
+    read(void* data, std::size_t size) noexcept {
+        return std::fread(data, 1, size, file_) == size;
+    }
+
+    bool
+    seek(std::uint64_t offset) noexcept {
+        return std::fseek(file_, static_cast<long>(offset), SEEK_SET) == 0;
+    }
+
+    std::uint64_t
+    file_size() noexcept {
+        if (std::fseek(file_, 0, SEEK_END) != 0)
+            return 0;
+
+        auto size = std::ftell(file_);
+        return size < 0 ? 0 : static_cast<std::uint64_t>(size);
+    }
+
+    bool
+    read_index() noexcept {
+        detail::compressed_trailer trailer{ };
+        auto size = file_size();
+        if (size < sizeof(detail::compressed_header) + sizeof(trailer) ||
+            !seek(size - sizeof(trailer)) || !read(&trailer, sizeof(trailer)) ||
+            trailer.magic != detail::k_compressed_index_magic)
+            return false;
+
+        auto end = size - sizeof(trailer);
+        if (trailer.index_offset > end ||
+            (end - trailer.index_offset) / sizeof(compressed_block_info) !=
+                trailer.block_count)
+            return false;
+
+        blocks_.resize(trailer.block_count);
+        if (!seek(trailer.index_offset) ||
+            !read(blocks_.data(), blocks_.size() * sizeof(compressed_block_info))) {
+            blocks_.clear();
+            return false;
+        }
+
+        return indexed_ = true;
+    }
+
+    void
+    scan_blocks() noexcept {
+        auto size   = file_size();
+        auto offset = std::uint64_t{ sizeof(detail::compressed_header) };
+        detail::compressed_block_header header{ };
+        while (offset + sizeof(header) <= size && seek(offset) &&
+               read(&header, sizeof(header)) &&
+               header.magic == detail::k_compressed_block_magic &&
+               header.stored_size <= size - offset - sizeof(header)) {
+            blocks_.push_back(compressed_block_info {
+                .offset = offset,
+                .count  = header.count,
+                .names  = header.names,
+                .first  = header.first,
+                .last   = header.last
+            });
+
+            offset += sizeof(header) + header.stored_size;
+        }
+    }
+
+    bool
+    load(
+        const compressed_block_info& block,
+        detail::compressed_block_header& header,
+        std::vector<std::uint8_t>& stored
+    ) noexcept {
+        // The payload has to fit in the rest of the file, and each event
+        // takes at least a byte for its type, which bounds what decoding the
+        // block may allocate.
+        auto size = file_size();
+        if (block.offset > size || size - block.offset < sizeof(header) ||
+            !seek(block.offset) || !read(&header, sizeof(header)) ||
+            header.magic != detail::k_compressed_block_magic ||
+            header.stored_size > size - block.offset - sizeof(header) ||
+            header.stored_size > detail::k_compressed_max_block ||
+            header.raw_size > detail::k_compressed_max_block ||
+            header.count > header.raw_size ||
+            (header.codec == static_cast<std::uint32_t>(compression_codec::none) &&
+             header.raw_size != header.stored_size))
+            return false;
+
+        stored.resize(header.stored_size);
+        return read(stored.data(), stored.size());
+    }
+
+private:
+    std::vector<compressed_block_info> blocks_;
+    std::vector<std::uint8_t> stored_;
+    std::vector<std::uint8_t> scratch_;
+    std::FILE* file_;
+    bool good_{ false };
+    bool indexed_{ false };
+};
+
+} // namespace malunal::tooling
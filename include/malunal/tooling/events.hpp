@@ -7,6 +7,37 @@
 
 namespace malunal::tooling {
 
+/// @brief   Contains the flags that may be set on recorded events.
+namespace event_flags {
+
+/// @brief   The time stamps of the event are raw ticks of a counter which is
+///          not `perf_clock_t`.
+/// @details The profiler converts them into `perf_clock_t` ticks, using the
+///          calibration of the session, before they reach the timeline and
+///          clears this flag.
+inline constexpr std::uint16_t raw_ticks = 1 << 0;
+
+/// @brief   The event was recorded by a sampled probe, and stands for more
+///          events than just itself.
+/// @details How many is given by the sampling weight of its name, see
+///          `timeline::sampling_weight`.
+inline constexpr std::uint16_t sampled = 1 << 1;
+
+/// @brief   The event was recorded by an async timing probe.
+/// @details Its timing events are the segments of a task that ran between two
+///          suspensions, and its flow events link the segments of each task by
+///          the identifier of the task.
+inline constexpr std::uint16_t async = 1 << 2;
+
+/// @brief   A count of the event was larger than its field can hold, and was
+///          clamped to the largest value the field can.
+/// @details PMU probes set it on every counter of the scope when any of them
+///          was clamped, so the scope can be left out of the totals as a whole,
+///          and allocation tracking sets it when the count or bytes were.
+inline constexpr std::uint16_t saturated = 1 << 3;
+
+} // namespace malunal::tooling::event_flags
+
 /// @brief   Represents the event of a timing measurement taking place.
 /// @details Timing events are primarily performed by a timing probe. The probe
 ///          will capture the thread ID, start, and end time for the event and
@@ -15,26 +46,53 @@ namespace malunal::tooling {
 ///          break the event into two nodes and interleave all events with each
 ///          other based on their start and end times.
 struct timing_event final {
-    /// @brief   The name of the event that took place.
+    /// @brief   The interned name of the event that took place.
     /// @details This will likely be provided by a probe but can be set manually
-    ///          when providing events manually to the profiler.
-    std::string name;
+    ///          when providing events manually to the profiler. The name itself
+    ///          can be obtained from `name_registry::resolve`.
+    name_id_t name;
 
-    /// @brief   The ID of the thread that the event took place on.
+    /// @brief   The index of the thread that the event took place on.
     /// @details It's important for the timeline to know what thread the event
     ///          took place on, at least for the display of the timeline.
-    std::thread::id tid;
+    thread_index_t tid;
 
-    /// @brief   When the event started.
+    /// @brief   Flags describing how the event was recorded.
+    /// @details A combination of the values in `event_flags`; zero for a plain
+    ///          timing event.
+    std::uint16_t flags;
+
+    /// @brief   When the event started, in ticks of `perf_clock_t`.
     /// @details This will be one node in the timeline. All events that start
     ///          after it will be children of that node.
-    time_point_t start;
+    tick_t start;
+
+    /// @brief   How long the event took, in ticks of `perf_clock_t`.
+    /// @details The end of the event will be another node in the timeline. It
+    ///          may have children if it is not the inner most event, otherwise
+    ///          it will be a leaf in the structure of the timeline.
+    tick_t duration;
+
+    /// @brief   Gets when the event ended.
+    /// @returns The tick the event ended on.
+    tick_t
+    end() const noexcept {
+        return start + duration;
+    }
 
-    /// @brief   When the event ended.
-    /// @details This will be another node in the timeline. It may have children
-    ///          if it is not the inner most event, otherwise it will be a leaf
-    ///          in the structure of the timeline.
-    time_point_t end;
+    /// @brief   Gets when the event started as a time point.
+    /// @returns The time point the event started at.
+    time_point_t
+    start_time() const noexcept {
+        return to_time_point(start);
+    }
+
+    /// @brief   Gets when the event ended as a time point.
+    /// @returns The time point the event ended at.
+    time_point_t
+    end_time() const noexcept {
+        return to_time_point(end());
+    }
 
     /// @brief   Checks if this event contains the other event.
     /// @details This works by checking if the start time of the event is
@@ -46,40 +104,316 @@ struct timing_event final {
     bool
     contains(const timing_event& event) const noexcept {
         return event.start > start &&
-               event.end   < end;
+               event.end() < end();
     }
+
+    bool operator==(const timing_event&) const noexcept = default;
 };
 
+static_assert(std::is_trivially_copyable_v<timing_event>);
+static_assert(sizeof(timing_event) == 24);
 
-/// @brief   Compares two timing events to each other.
-/// @param   lhs The left hand timing event to compare.
-/// @param   rhs The right hand timing even to compare.
-/// @returns True if all of the name, thread id, start, and end fields of the
-///          timing events being compared, are equal; false otherwise.
-inline bool
-operator==(const timing_event& lhs, const timing_event& rhs) noexcept {
-    return lhs.name  == rhs.name  &&
-           lhs.tid   == rhs.tid   &&
-           lhs.start == rhs.start &&
-           lhs.end   == rhs.end;
-}
+/// @brief   Represents the value of a counter, or gauge, at a point in time.
+/// @details Counter events are recorded by a counter probe, for values like
+///          the depth of a queue or the number of bytes in flight. Exporters
+///          draw every counter event of the same name on one track, so the
+///          value can be lined up against the timing events around it.
+struct counter_event final {
+    /// @brief   The interned name of the counter.
+    name_id_t name;
+
+    /// @brief   The index of the thread that recorded the value.
+    thread_index_t tid;
+
+    /// @brief   Flags describing how the event was recorded.
+    std::uint16_t flags;
+
+    /// @brief   When the value was recorded, in ticks of `perf_clock_t`.
+    tick_t when;
+
+    /// @brief   The value of the counter.
+    double value;
+
+    /// @brief   Gets when the value was recorded as a time point.
+    /// @returns The time point the value was recorded at.
+    time_point_t
+    time() const noexcept {
+        return to_time_point(when);
+    }
+
+    bool operator==(const counter_event&) const noexcept = default;
+};
+
+static_assert(std::is_trivially_copyable_v<counter_event>);
+static_assert(sizeof(counter_event) == 24);
+
+/// @brief   Represents something that happened at a single point in time.
+/// @details Instant events are recorded by an instant probe, and are used as
+///          markers, like the start of a frame or a cache being flushed.
+struct instant_event final {
+    /// @brief   The interned name of the marker.
+    name_id_t name;
+
+    /// @brief   The index of the thread that recorded the marker.
+    thread_index_t tid;
+
+    /// @brief   Flags describing how the event was recorded.
+    std::uint16_t flags;
+
+    /// @brief   When the marker was recorded, in ticks of `perf_clock_t`.
+    tick_t when;
+
+    /// @brief   Gets when the marker was recorded as a time point.
+    /// @returns The time point the marker was recorded at.
+    time_point_t
+    time() const noexcept {
+        return to_time_point(when);
+    }
+
+    bool operator==(const instant_event&) const noexcept = default;
+};
+
+static_assert(std::is_trivially_copyable_v<instant_event>);
+static_assert(sizeof(instant_event) == 16);
+
+/// @brief   Where a flow event falls within its flow.
+enum class flow_phase : std::uint32_t {
+    /// @brief   The flow starts here, like a task being enqueued.
+    begin,
+
+    /// @brief   The flow passes through here, on the way to its end.
+    step,
+
+    /// @brief   The flow ends here, like a task being dequeued and run.
+    end
+};
+
+/// @brief   Represents one point of a flow of causality between threads.
+/// @details Flow events with the same identifier are linked together in the
+///          order of their phases, so exporters can draw an arrow from where
+///          a piece of work was handed off to where it was picked up, even
+///          when that is on another thread.
+struct flow_event final {
+    /// @brief   The interned name of the flow.
+    name_id_t name;
+
+    /// @brief   The index of the thread that the point took place on.
+    thread_index_t tid;
+
+    /// @brief   Flags describing how the event was recorded.
+    std::uint16_t flags;
+
+    /// @brief   When the point took place, in ticks of `perf_clock_t`.
+    tick_t when;
+
+    /// @brief   The identifier linking the points of the same flow.
+    std::uint32_t id;
+
+    /// @brief   Where the point falls within the flow.
+    flow_phase phase;
+
+    /// @brief   Gets when the point took place as a time point.
+    /// @returns The time point the point took place at.
+    time_point_t
+    time() const noexcept {
+        return to_time_point(when);
+    }
 
-/// @brief   Compares two timing events to each other.
-/// @param   lhs The left hand timing event to compare.
-/// @param   rhs The right hand timing even to compare.
-/// @returns True if one of the name, thread id, start, and end fields of the
-///          timing events being compared, are *not* equal; false otherwise.
-inline bool
-operator!=(const timing_event& lhs, const timing_event& rhs) noexcept {
-    return !operator==(lhs, rhs);
+    bool operator==(const flow_event&) const noexcept = default;
+};
+
+static_assert(std::is_trivially_copyable_v<flow_event>);
+static_assert(sizeof(flow_event) == 24);
+
+/// @brief   The hardware performance counters a PMU probe reads.
+enum class pmu_counter : std::uint32_t {
+    /// @brief   The number of CPU cycles spent in the scope.
+    cycles,
+
+    /// @brief   The number of instructions retired in the scope.
+    instructions,
+
+    /// @brief   The number of last level cache misses in the scope.
+    cache_misses,
+
+    /// @brief   The number of mispredicted branches in the scope.
+    branch_misses
+};
+
+/// @brief   The number of counters in `pmu_counter`.
+inline constexpr std::size_t k_pmu_counters = 4;
+
+/// @brief   Gets the name of the given hardware counter.
+/// @param   counter The counter to get the name of.
+/// @returns The name of the counter, in snake case.
+inline constexpr std::string_view
+pmu_counter_name(pmu_counter counter) noexcept {
+    constexpr std::string_view k_names[k_pmu_counters] = {
+        "cycles", "instructions", "cache_misses", "branch_misses"
+    };
+
+    auto index = static_cast<std::size_t>(counter);
+    return index < k_pmu_counters ? k_names[index] : "unknown";
 }
 
+/// @brief   Represents the value of one hardware performance counter over the
+///          scope of a timing event.
+/// @details PMU probes record one of these per counter next to the timing event
+///          of the scope, which shares its name, thread, and start. Keeping a
+///          single counter per event keeps it as small as the other events.
+struct pmu_event final {
+    /// @brief   The interned name of the scope that was measured.
+    name_id_t name;
+
+    /// @brief   The index of the thread that the scope ran on.
+    thread_index_t tid;
+
+    /// @brief   Flags describing how the event was recorded.
+    std::uint16_t flags;
+
+    /// @brief   When the scope started, in ticks of `perf_clock_t`.
+    /// @details This is the same as the start of the timing event of the scope.
+    tick_t when;
+
+    /// @brief   Which counter was read.
+    pmu_counter counter;
+
+    /// @brief   How much the counter went up over the scope.
+    /// @details Saturates at the largest 32-bit value, which is over a second
+    ///          of cycles on any current processor, and flags the event with
+    ///          `event_flags::saturated` when it does.
+    std::uint32_t value;
+
+    /// @brief   Gets when the scope started as a time point.
+    /// @returns The time point the scope started at.
+    time_point_t
+    time() const noexcept {
+        return to_time_point(when);
+    }
+
+    bool operator==(const pmu_event&) const noexcept = default;
+};
+
+static_assert(std::is_trivially_copyable_v<pmu_event>);
+static_assert(sizeof(pmu_event) == 24);
+
+/// @brief   Represents the heap allocations made within the scope of a timing
+///          event.
+/// @details Recorded by timing probes when allocation tracking is enabled, for
+///          every scope that allocated at all. The allocations are attributed
+///          to the innermost scope that was live when they were made, so the
+///          allocations of nested scopes are not counted again by the scopes
+///          around them.
+struct allocation_event final {
+    /// @brief   The interned name of the scope that allocated.
+    name_id_t name;
+
+    /// @brief   The index of the thread that the scope ran on.
+    thread_index_t tid;
+
+    /// @brief   Flags describing how the event was recorded.
+    std::uint16_t flags;
+
+    /// @brief   When the scope started, in ticks of `perf_clock_t`.
+    /// @details This is the same as the start of the timing event of the scope.
+    tick_t when;
+
+    /// @brief   The number of allocations made by the scope.
+    /// @details Saturates at the largest 32-bit value, like `bytes`.
+    std::uint32_t count;
+
+    /// @brief   The number of bytes the scope asked to allocate.
+    /// @details Saturates at the largest 32-bit value, and flags the event with
+    ///          `event_flags::saturated` when either of them does.
+    std::uint32_t bytes;
+
+    /// @brief   Gets when the scope started as a time point.
+    /// @returns The time point the scope started at.
+    time_point_t
+    time() const noexcept {
+        return to_time_point(when);
+    }
+
+    bool operator==(const allocation_event&) const noexcept = default;
+};
+
+static_assert(std::is_trivially_copyable_v<allocation_event>);
+static_assert(sizeof(allocation_event) == 24);
+
 
 /// @brief   A type definition around a variant which can store any type of
 ///          event that this profiler can receive.
-/// @remarks At the time of writing this, it only supports one, but it's
-///          here in case more are added or you decide to extend it
-///          yourself.
-using event_variant_t = std::variant<timing_event>;
+/// @remarks New types of events should be appended, since the binary capture
+///          format identifies the type of each block by its index. Every type
+///          should stay trivially copyable and no larger than a timing event,
+///          so the variant stays the same size.
+using event_variant_t = std::variant<
+    timing_event,
+    counter_event,
+    instant_event,
+    flow_event,
+    pmu_event,
+    allocation_event
+>;
+
+static_assert(std::is_trivially_copyable_v<event_variant_t>);
+static_assert(sizeof(event_variant_t) == 32);
+
+namespace detail {
+
+/// @brief   Finds the index of the given type within the given variant.
+/// @tparam  T The type to find.
+/// @tparam  Variant The variant the type is an alternative of.
+template<typename T, typename Variant>
+struct variant_index;
+
+template<typename T, typename... Types>
+struct variant_index<T, std::variant<Types...>> {
+    static constexpr std::size_t value = [] {
+        constexpr std::array<bool, sizeof...(Types)> matches{
+            std::is_same_v<T, Types>...
+        };
+
+        for (std::size_t i = 0; i < matches.size(); i++)
+            if (matches[i]) return i;
+        return matches.size();
+    }();
+
+    static_assert(value < sizeof...(Types),
+        "The type is not an alternative of the variant.");
+};
+
+/// @brief   The index of the given type within the given variant.
+template<typename T, typename Variant>
+inline constexpr std::size_t variant_index_v =
+    variant_index<T, Variant>::value;
+
+/// @brief   Gets the time the given event starts at.
+/// @param   e The event.
+/// @returns The start of a timing event, or when any other event happened.
+inline tick_t
+event_start(const event_variant_t& e) noexcept {
+    return std::visit([](const auto& arg) {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, timing_event>)
+            return arg.start;
+        else return arg.when;
+    }, e);
+}
+
+/// @brief   Gets the time the given event ends at.
+/// @param   e The event.
+/// @returns The end of a timing event, or when any other event happened.
+inline tick_t
+event_end(const event_variant_t& e) noexcept {
+    return std::visit([](const auto& arg) {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, timing_event>)
+            return arg.end();
+        else return arg.when;
+    }, e);
+}
+
+} // namespace malunal::tooling::detail
 
 } // namespace malunal::tooling
@@ -0,0 +1,560 @@
+/// @file   index.hpp
+/// @brief  Contains the index which answers time window queries over a
+///         timeline without scanning it.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+
+/// @brief   A window of time, including both of its ends.
+struct time_range final {
+    /// @brief   The first tick of the window.
+    tick_t begin;
+
+    /// @brief   The last tick of the window.
+    tick_t end;
+};
+
+namespace detail {
+
+/// @brief   Collects every event of a timeline it visits.
+struct index_collector final {
+    void
+    visit(const event_variant_t& e) noexcept {
+        events.push_back(e);
+    }
+
+    std::vector<event_variant_t> events;
+};
+
+/// @brief   Defines a type constraint that assures the given type is a
+///          timeline which can be indexed, such as `timeline`.
+/// @tparam  Source The type of the timeline.
+template<typename Source>
+concept IndexableTimeline = requires(
+    const Source& source,
+    index_collector& collector
+) {
+    { source.accept(collector) } noexcept;
+};
+
+/// @brief   A tree over a run of items sorted by start time, which keeps the
+///          latest time any item below each node ends at.
+/// @details The items are grouped into leaves of a fixed size, and the tree
+///          is stored the way a heap is, with the leaves at the bottom.
+struct overlap_tree final {
+    /// @brief   Builds the tree over the given items.
+    /// @param   count The number of items.
+    /// @param   leaf_items The number of items in each leaf.
+    /// @param   start_of Gets the start of the item at an index.
+    /// @param   end_of Gets the end of the item at an index.
+    template<typename StartOf, typename EndOf>
+    void
+    build(
+        std::size_t count,
+        std::size_t leaf_items,
+        StartOf&& start_of,
+        EndOf&& end_of
+    ) noexcept {
+        items = leaf_items;
+        starts.resize(count);
+        for (std::size_t i = 0; i < count; i++)
+            starts[i] = start_of(i);
+
+        auto blocks = (count + items - 1) / items;
+        leaves = std::bit_ceil(std::max<std::size_t>(blocks, 1));
+        latest.assign(leaves * 2, std::numeric_limits<tick_t>::min());
+        for (std::size_t i = 0; i < count; i++) {
+            auto& leaf = latest[leaves + i / items];
+            leaf = std::max(leaf, end_of(i));
+        }
+
+        for (auto node = leaves - 1; node > 0; node--)
+            latest[node] = std::max(latest[node * 2], latest[node * 2 + 1]);
+    }
+
+    /// @brief   Gives the items of every leaf that may overlap the given
+    ///          window to the given consumer.
+    /// @details Only items starting no later than the end of the window are
+    ///          given, but they still have to be checked against its
+    ///          beginning.
+    /// @param   range The window of time.
+    /// @param   consumer Called with the first and last index of the items of
+    ///          each leaf, in ascending order.
+    template<typename Consumer>
+    void
+    search(time_range range, Consumer& consumer) const noexcept {
+        auto count = static_cast<std::size_t>(
+            std::upper_bound(starts.begin(), starts.end(), range.end) -
+            starts.begin());
+        if (count > 0)
+            descend(1, 0, leaves, count, range, consumer);
+    }
+
+    std::vector<tick_t> starts;
+    std::vector<tick_t> latest;
+    std::size_t leaves{ 0 };
+    std::size_t items{ 1 };
+
+private:
+    template<typename Consumer>
+    void
+    descend(
+        std::size_t node,
+        std::size_t first,
+        std::size_t last,
+        std::size_t count,
+        time_range range,
+        Consumer& consumer
+    ) const noexcept {
+        // Skip the nodes past the last candidate, or where everything below
+        // ended before the window began.
+        if (first * items >= count || latest[node] < range.begin)
+            return;
+
+        if (last - first > 1) {
+            auto middle = first + (last - first) / 2;
+            descend(node * 2, first, middle, count, range, consumer);
+            descend(node * 2 + 1, middle, last, count, range, consumer);
+            return;
+        }
+
+        consumer(first * items, std::min(count, (first + 1) * items));
+    }
+};
+
+inline thread_index_t
+index_thread_of(const event_variant_t& e) noexcept {
+    return std::visit([](const auto& arg) { return arg.tid; }, e);
+}
+
+inline name_id_t
+index_name_of(const event_variant_t& e) noexcept {
+    return std::visit([](const auto& arg) { return arg.name; }, e);
+}
+
+// Outer events first among those starting at the same time.
+inline bool
+index_before(const event_variant_t& lhs, const event_variant_t& rhs) noexcept {
+    auto ls = event_start(lhs), rs = event_start(rhs);
+    if (ls != rs)
+        return ls < rs;
+    return event_end(lhs) > event_end(rhs);
+}
+
+} // namespace malunal::tooling::detail
+
+
+/// @brief   An index of the events of a timeline, by thread and time, for
+///          finding the events that overlap a window of time.
+/// @details The events of each thread are copied into a run sorted by start
+///          time, outermost first. The run is split into blocks, and a tree
+///          over the blocks keeps the latest time any event below each node
+///          ends at. A query finds the last event starting before the end of
+///          the window with a binary search, then only descends into the
+///          nodes holding an event that ends after the window begins, so
+///          finding a few events in an hour long capture touches a handful of
+///          blocks rather than every event.
+/// @remarks The index holds its own copy of the events, so it outlives the
+///          timeline it was built from, and the timeline can be cleared once
+///          the index is built. A `mapped_timeline` is indexed by
+///          `mapped_timeline_index` instead, which leaves the events in the
+///          mapping.
+struct timeline_index final {
+    /// @brief   The number of events in each block of a thread run.
+    static constexpr std::size_t k_block_events = 64;
+
+    /// @brief   Creates an empty index.
+    timeline_index() noexcept = default;
+
+    /// @brief   Indexes every event of the given timeline.
+    /// @tparam  Source The type of the timeline.
+    /// @param   source The timeline that should be indexed.
+    /// @param   workers The number of threads to sort the runs with, or zero
+    ///          for one per hardware thread.
+    template<detail::IndexableTimeline Source>
+    explicit timeline_index(
+        const Source& source,
+        std::size_t workers = 0
+    ) noexcept {
+        detail::index_collector collector;
+        source.accept(collector);
+        build(std::move(collector.events), workers);
+    }
+
+    /// @brief   A mapped timeline is indexed by `mapped_timeline_index`, so
+    ///          its events aren't all copied out of the mapping.
+    explicit timeline_index(const mapped_timeline&, std::size_t = 0) = delete;
+
+    /// @brief   Gets the number of events in the index.
+    /// @returns The number of events indexed.
+    std::size_t
+    size() const noexcept {
+        return size_;
+    }
+
+    /// @brief   Checks if the index has events.
+    /// @returns True if no events were indexed; false otherwise.
+    bool
+    empty() const noexcept {
+        return size_ == 0;
+    }
+
+    /// @brief   Gets the threads which have events in the index.
+    /// @returns The threads, in ascending order.
+    std::vector<thread_index_t>
+    threads() const noexcept {
+        std::vector<thread_index_t> result;
+        result.reserve(runs_.size());
+        for (const auto& run : runs_)
+            result.push_back(run.thread);
+        return result;
+    }
+
+    /// @brief   Gets the events of the given thread.
+    /// @param   thread The thread.
+    /// @returns The events of the thread, sorted by start time with outer
+    ///          events first, or nothing if the thread has no events.
+    std::span<const event_variant_t>
+    thread_events(thread_index_t thread) const noexcept {
+        auto run = find(thread);
+        return run == nullptr ? std::span<const event_variant_t>{ }
+                              : std::span<const event_variant_t>(run->events);
+    }
+
+    /// @brief   Gives every event overlapping the given window to the given
+    ///          consumer.
+    /// @details An event overlaps the window if it starts no later than the
+    ///          end of the window and ends no earlier than its beginning.
+    ///          Events are given thread by thread, in ascending order of the
+    ///          threads, and by start time within each thread.
+    /// @tparam  Consumer The type of the callable receiving each event.
+    /// @param   range The window of time.
+    /// @param   thread The thread whose events should be found, or nothing
+    ///          for every thread.
+    /// @param   name The name the events should have, or nothing for any
+    ///          name.
+    /// @param   consumer Called with each event that overlaps the window.
+    template<typename Consumer>
+    void
+    for_each(
+        time_range range,
+        std::optional<thread_index_t> thread,
+        std::optional<name_id_t> name,
+        Consumer&& consumer
+    ) const noexcept {
+        if (range.end < range.begin)
+            return;
+
+        if (thread) {
+            if (auto run = find(*thread))
+                search(*run, range, name, consumer);
+            return;
+        }
+
+        for (const auto& run : runs_)
+            search(run, range, name, consumer);
+    }
+
+    /// @brief   Finds every event overlapping the given window.
+    /// @param   range The window of time.
+    /// @param   thread The thread whose events should be found, or nothing
+    ///          for every thread.
+    /// @param   name The name the events should have, or nothing for any
+    ///          name.
+    /// @returns The events, in the order given by `for_each`. They point into
+    ///          the index, and stay valid for as long as it does.
+    std::vector<const event_variant_t*>
+    query(
+        time_range range,
+        std::optional<thread_index_t> thread = std::nullopt,
+        std::optional<name_id_t> name = std::nullopt
+    ) const noexcept {
+        std::vector<const event_variant_t*> result;
+        for_each(range, thread, name, [&result](const event_variant_t& e) {
+            result.push_back(&e);
+        });
+        return result;
+    }
+
+private:
+    struct thread_run final {
+        thread_index_t thread;
+        std::vector<event_variant_t> events;
+        detail::overlap_tree tree;
+    };
+
+    void
+    build(std::vector<event_variant_t> events, std::size_t workers) noexcept {
+        size_ = events.size();
+        std::unordered_map<thread_index_t, std::size_t> lookup;
+        for (const auto& e : events) {
+            auto thread = detail::index_thread_of(e);
+            auto [it, inserted] = lookup.try_emplace(thread, runs_.size());
+            if (inserted)
+                runs_.emplace_back().thread = thread;
+            runs_[it->second].events.push_back(e);
+        }
+
+        std::vector<event_variant_t>{ }.swap(events);
+        std::sort(runs_.begin(), runs_.end(),
+            [](const thread_run& lhs, const thread_run& rhs) {
+                return lhs.thread < rhs.thread;
+            });
+
+        workers = std::min(detail::resolve_workers(workers, size_),
+            std::max<std::size_t>(runs_.size(), 1));
+        detail::parallel_for(runs_.size(), workers,
+            [this](std::size_t, std::size_t first, std::size_t last) {
+                for (auto i = first; i < last; i++)
+                    build_run(runs_[i]);
+            });
+    }
+
+    static void
+    build_run(thread_run& run) noexcept {
+        std::stable_sort(run.events.begin(), run.events.end(), detail::index_before);
+        run.tree.build(run.events.size(), k_block_events,
+            [&run](std::size_t i) { return detail::event_start(run.events[i]); },
+            [&run](std::size_t i) { return detail::event_end(run.events[i]); });
+    }
+
+    const thread_run*
+    find(thread_index_t thread) const noexcept {
+        auto it = std::lower_bound(runs_.begin(), runs_.end(), thread,
+            [](const thread_run& run, thread_index_t value) {
+                return run.thread < value;
+            });
+        return it != runs_.end() && it->thread == thread ? &*it : nullptr;
+    }
+
+    template<typename Consumer>
+    static void
+    search(
+        const thread_run& run,
+        time_range range,
+        std::optional<name_id_t> name,
+        Consumer& consumer
+    ) noexcept {
+        auto leaf = [&](std::size_t first, std::size_t last) {
+            for (auto i = first; i < last; i++) {
+                const auto& e = run.events[i];
+                if (detail::event_end(e) >= range.begin &&
+                    (!name || detail::index_name_of(e) == *name))
+                    consumer(e);
+            }
+        };
+
+        run.tree.search(range, leaf);
+    }
+
+    std::vector<thread_run> runs_;
+    std::size_t size_{ 0 };
+};
+
+/// @brief   An index of the events of a mapped timeline, by thread and time,
+///          which leaves the events in the mapping.
+/// @details The events of the capture are split into chunks of consecutive
+///          events, and for each thread with events in a chunk the index only
+///          keeps where the chunk is, the earliest time those events start
+///          and the latest time they end. The summaries of each thread are
+///          sorted by their start, under the same tree of the latest end time
+///          as `timeline_index`. A query reads the chunks whose summaries
+///          overlap the window, and loads the events that overlap it out of
+///          the mapping. Building the index reads the capture once, but never
+///          holds on to more than a single event of it.
+/// @remarks The index reads the events from the mapped timeline it was built
+///          from, which has to outlive it.
+struct mapped_timeline_index final {
+    /// @brief   The number of consecutive events of the capture in each chunk.
+    static constexpr std::size_t k_chunk_events = 64;
+
+    /// @brief   Creates an empty index.
+    mapped_timeline_index() noexcept = default;
+
+    /// @brief   Indexes every event of the given mapped timeline.
+    /// @param   source The mapped timeline that should be indexed.
+    explicit mapped_timeline_index(const mapped_timeline& source) noexcept
+        : source_{ &source }
+    {
+        std::unordered_map<thread_index_t, std::size_t> lookup;
+        std::size_t index = 0;
+        for (auto it = source.begin(); it != source.end(); ++it, index++) {
+            auto e = *it;
+            auto thread = detail::index_thread_of(e);
+            auto [found, inserted] = lookup.try_emplace(thread, runs_.size());
+            if (inserted)
+                runs_.emplace_back().thread = thread;
+
+            auto& chunks = runs_[found->second].chunks;
+            auto first = index - index % k_chunk_events;
+            auto start = detail::event_start(e), end = detail::event_end(e);
+            if (chunks.empty() || chunks.back().first != first) {
+                chunks.push_back({ .first = first, .start = start, .end = end });
+                continue;
+            }
+
+            chunks.back().start = std::min(chunks.back().start, start);
+            chunks.back().end   = std::max(chunks.back().end, end);
+        }
+
+        size_ = index;
+        std::sort(runs_.begin(), runs_.end(),
+            [](const thread_run& lhs, const thread_run& rhs) {
+                return lhs.thread < rhs.thread;
+            });
+
+        for (auto& run : runs_) {
+            std::sort(run.chunks.begin(), run.chunks.end(),
+                [](const chunk_summary& lhs, const chunk_summary& rhs) {
+                    return lhs.start < rhs.start;
+                });
+
+            run.tree.build(run.chunks.size(), 1,
+                [&run](std::size_t i) { return run.chunks[i].start; },
+                [&run](std::size_t i) { return run.chunks[i].end; });
+        }
+    }
+
+    /// @brief   Gets the number of events in the index.
+    /// @returns The number of events indexed.
+    std::size_t
+    size() const noexcept {
+        return size_;
+    }
+
+    /// @brief   Checks if the index has events.
+    /// @returns True if no events were indexed; false otherwise.
+    bool
+    empty() const noexcept {
+        return size_ == 0;
+    }
+
+    /// @brief   Gets the threads which have events in the index.
+    /// @returns The threads, in ascending order.
+    std::vector<thread_index_t>
+    threads() const noexcept {
+        std::vector<thread_index_t> result;
+        result.reserve(runs_.size());
+        for (const auto& run : runs_)
+            result.push_back(run.thread);
+        return result;
+    }
+
+    /// @brief   Loads the events of the given thread.
+    /// @param   thread The thread.
+    /// @returns The events of the thread, sorted by start time with outer
+    ///          events first, or nothing if the thread has no events.
+    std::vector<event_variant_t>
+    thread_events(thread_index_t thread) const noexcept {
+        return query({
+            std::numeric_limits<tick_t>::min(),
+            std::numeric_limits<tick_t>::max()
+        }, thread);
+    }
+
+    /// @brief   Gives every event overlapping the given window to the given
+    ///          consumer.
+    /// @details An event overlaps the window if it starts no later than the
+    ///          end of the window and ends no earlier than its beginning.
+    ///          Events are given thread by thread, in ascending order of the
+    ///          threads, and by start time within each thread, with outer
+    ///          events first. The events of each thread are loaded before any
+    ///          of them are given.
+    /// @tparam  Consumer The type of the callable receiving each event.
+    /// @param   range The window of time.
+    /// @param   thread The thread whose events should be found, or nothing
+    ///          for every thread.
+    /// @param   name The name the events should have, or nothing for any
+    ///          name.
+    /// @param   consumer Called with each event that overlaps the window.
+    template<typename Consumer>
+    void
+    for_each(
+        time_range range,
+        std::optional<thread_index_t> thread,
+        std::optional<name_id_t> name,
+        Consumer&& consumer
+    ) const noexcept {
+        if (range.end < range.begin)
+            return;
+
+        std::vector<event_variant_t> events;
+        for (const auto& run : runs_) {
+            if (thread && run.thread != *thread)
+                continue;
+
+            events.clear();
+            load(run, range, name, events);
+            std::stable_sort(events.begin(), events.end(), detail::index_before);
+            for (const auto& e : events)
+                consumer(e);
+        }
+    }
+
+    /// @brief   Finds every event overlapping the given window.
+    /// @param   range The window of time.
+    /// @param   thread The thread whose events should be found, or nothing
+    ///          for every thread.
+    /// @param   name The name the events should have, or nothing for any
+    ///          name.
+    /// @returns Copies of the events, in the order given by `for_each`.
+    std::vector<event_variant_t>
+    query(
+        time_range range,
+        std::optional<thread_index_t> thread = std::nullopt,
+        std::optional<name_id_t> name = std::nullopt
+    ) const noexcept {
+        std::vector<event_variant_t> result;
+        for_each(range, thread, name, [&result](const event_variant_t& e) {
+            result.push_back(e);
+        });
+        return result;
+    }
+
+private:
+    struct chunk_summary final {
+        std::size_t first;
+        tick_t start;
+        tick_t end;
+    };
+
+    struct thread_run final {
+        thread_index_t thread;
+        std::vector<chunk_summary> chunks;
+        detail::overlap_tree tree;
+    };
+
+    void
+    load(
+        const thread_run& run,
+        time_range range,
+        std::optional<name_id_t> name,
+        std::vector<event_variant_t>& events
+    ) const noexcept {
+        auto leaf = [&](std::size_t first, std::size_t last) {
+            for (auto c = first; c < last; c++) {
+                auto from = run.chunks[c].first;
+                auto to   = std::min(from + k_chunk_events, size_);
+                for (auto i = from; i < to; i++) {
+                    auto e = (*source_)[i];
+                    if (detail::index_thread_of(e) == run.thread &&
+                        detail::event_start(e) <= range.end &&
+                        detail::event_end(e) >= range.begin &&
+                        (!name || detail::index_name_of(e) == *name))
+                        events.push_back(e);
+                }
+            }
+        };
+
+        run.tree.search(range, leaf);
+    }
+
+    const mapped_timeline* source_{ nullptr };
+    std::vector<thread_run> runs_;
+    std::size_t size_{ 0 };
+};
+
+} // namespace malunal::tooling
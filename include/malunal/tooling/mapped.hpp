@@ -0,0 +1,468 @@
+/// @file   mapped.hpp
+/// @brief  Contains the read only timeline which maps a binary capture into
+///         memory instead of loading it.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+namespace detail {
+
+/// @brief   A file mapped read only into memory.
+/// @details Where memory mapping isn't available, the file is read into
+///          memory instead, so everything built on it still works, just
+///          without the paging.
+struct mapped_file final {
+    /// @brief   Maps the file at the given path.
+    /// @param   path The path of the file that should be mapped.
+    explicit mapped_file(const std::string& path) noexcept {
+#ifdef MALUNAL_TOOLING_HAS_MMAP
+        auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        struct stat info{ };
+        if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+            auto size = static_cast<std::size_t>(info.st_size);
+            auto data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                // Most analyses read the whole capture front to back.
+                ::madvise(data, size, MADV_SEQUENTIAL);
+                data_ = static_cast<const char*>(data);
+                size_ = size;
+            }
+        }
+
+        ::close(fd);
+#else
+        auto file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr)
+            return;
+
+        std::array<char, 1 << 16> chunk;
+        std::size_t read = 0;
+        while ((read = std::fread(chunk.data(), 1, chunk.size(), file)) > 0)
+            buffer_.insert(buffer_.end(), chunk.data(), chunk.data() + read);
+        std::fclose(file);
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+#endif
+    }
+
+    ~mapped_file() noexcept {
+#ifdef MALUNAL_TOOLING_HAS_MMAP
+        if (data_ != nullptr)
+            ::munmap(const_cast<char*>(data_), size_);
+#endif
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    /// @brief   Gets the contents of the file.
+    /// @returns The first byte of the file, or null if it couldn't be mapped.
+    const char*
+    data() const noexcept {
+        return data_;
+    }
+
+    /// @brief   Gets the size of the file.
+    /// @returns The number of bytes mapped.
+    std::size_t
+    size() const noexcept {
+        return size_;
+    }
+
+private:
+#ifndef MALUNAL_TOOLING_HAS_MMAP
+    std::vector<char> buffer_;
+#endif
+    const char* data_{ nullptr };
+    std::size_t size_{ 0 };
+};
+
+/// @brief   A block of events in a mapped binary capture.
+struct mapped_block final {
+    /// @brief   The index of the type of the events in `event_variant_t`.
+    std::uint32_t type;
+
+    /// @brief   The number of events in the block.
+    std::uint32_t count;
+
+    /// @brief   The first record of the block, in the mapping.
+    const char* records;
+};
+
+} // namespace malunal::tooling::detail
+
+
+/// @brief   A read only timeline of the events in a binary capture, which maps
+///          the capture into memory rather than loading it.
+/// @details Opening the capture only walks the headers of its blocks and
+///          interns the names it holds, so even a huge capture opens in no
+///          time. The events stay where they are in the file, and are paged
+///          in by the operating system as they are visited; each one is just
+///          copied out of its record, and given the identifier its name was
+///          interned as, when it is visited. This gives the same iteration and
+///          visiting as `timeline`, over captures that wouldn't fit in memory.
+/// @remarks A capture cut short by a crash can still be mapped, and holds
+///          every complete block that was written.
+struct mapped_timeline final {
+    /// @brief   Iterates the events of a mapped timeline, in the order they
+    ///          are stored in the capture.
+    struct iterator final {
+        using iterator_category = std::input_iterator_tag;
+        using value_type        = event_variant_t;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = void;
+        using reference         = event_variant_t;
+
+        iterator() noexcept = default;
+
+        event_variant_t
+        operator*() const noexcept {
+            return owner_->load(owner_->blocks_[block_], record_);
+        }
+
+        iterator&
+        operator++() noexcept {
+            if (++record_ == owner_->blocks_[block_].count) {
+                block_++;
+                record_ = 0;
+            }
+
+            return *this;
+        }
+
+        iterator
+        operator++(int) noexcept {
+            auto result = *this;
+            ++*this;
+            return result;
+        }
+
+        bool
+        operator==(const iterator& other) const noexcept {
+            return block_ == other.block_ && record_ == other.record_;
+        }
+
+    private:
+        friend struct mapped_timeline;
+
+        iterator(
+            const mapped_timeline* owner,
+            std::size_t block,
+            std::size_t record
+        ) noexcept
+            : owner_{ owner }, block_{ block }, record_{ record }
+        { }
+
+        const mapped_timeline* owner_{ nullptr };
+        std::size_t block_{ 0 };
+        std::size_t record_{ 0 };
+    };
+
+    /// @brief   Maps the capture at the given path, checks its header and
+    ///          finds its blocks.
+    /// @param   path The path of the capture that should be mapped.
+    explicit mapped_timeline(const std::string& path) noexcept
+        : file_{ path }
+    {
+        detail::capture_header header{ };
+        if (file_.data() == nullptr || file_.size() < sizeof(header))
+            return;
+
+        std::memcpy(&header, file_.data(), sizeof(header));
+        good_ = header.magic      == detail::k_capture_magic &&
+                header.version    == detail::k_capture_version &&
+                header.byte_order == detail::k_capture_byte_order &&
+                scan_blocks(sizeof(header));
+    }
+
+    mapped_timeline(const mapped_timeline&) = delete;
+    mapped_timeline& operator=(const mapped_timeline&) = delete;
+
+    /// @brief   Checks if the capture was mapped, has a valid header, and none
+    ///          of its names blocks are corrupt.
+    /// @returns True if the timeline can be read; false otherwise.
+    bool
+    good() const noexcept {
+        return good_;
+    }
+
+    /// @brief   Checks if the timeline has events.
+    /// @returns True if the timeline has no events; false otherwise.
+    bool
+    empty() const noexcept {
+        return size_ == 0;
+    }
+
+    /// @brief   Gets the number of events in the timeline.
+    /// @returns The number of events in every complete block of the capture.
+    std::size_t
+    size() const noexcept {
+        return size_;
+    }
+
+    /// @brief   Gets the event at the given index.
+    /// @param   index The index of the event, in the order of the capture.
+    /// @returns A copy of the event.
+    event_variant_t
+    operator[](std::size_t index) const noexcept {
+        auto block = block_of(index);
+        return load(blocks_[block], index - offsets_[block]);
+    }
+
+    /// @brief   Gets an iterator to the first event of the timeline.
+    /// @returns The iterator.
+    iterator
+    begin() const noexcept {
+        return iterator{ this, 0, 0 };
+    }
+
+    /// @brief   Gets an iterator past the last event of the timeline.
+    /// @returns The iterator.
+    iterator
+    end() const noexcept {
+        return iterator{ this, blocks_.size(), 0 };
+    }
+
+    /// @brief   Visits every event of the timeline, in the order of the
+    ///          capture.
+    /// @tparam  Visitor The type of the visitor.
+    /// @param   visitor The visitor that should visit each event.
+    template<detail::TimelineVisitor Visitor>
+    void
+    accept(Visitor& visitor) const noexcept {
+        auto consumer = [&visitor](const event_variant_t& e) {
+            visitor.visit(e);
+        };
+
+        for_each_in(0, size_, consumer);
+    }
+
+    /// @brief   Visits the events of this timeline across several threads.
+    /// @details The events are split into contiguous parts, one per worker,
+    ///          and each worker visits its part with a visitor of its own,
+    ///          reading its part of the mapping. Once every worker is done,
+    ///          their visitors are merged into the given one, in the order of
+    ///          the parts.
+    /// @tparam  Visitor The type of the visitor.
+    /// @param   visitor The visitor that should receive the merged results.
+    /// @param   workers The number of threads to use, or zero for one per
+    ///          hardware thread.
+    template<detail::ReducibleTimelineVisitor Visitor>
+    void
+    parallel_accept(Visitor& visitor, std::size_t workers = 0) const noexcept {
+        workers = detail::resolve_workers(workers, size_);
+        if (workers <= 1) {
+            accept(visitor);
+            return;
+        }
+
+        std::vector<Visitor> partial(workers);
+        detail::parallel_for(size_, workers,
+            [this, &partial](std::size_t w, std::size_t first, std::size_t last) {
+                auto& local   = partial[w];
+                auto consumer = [&local](const event_variant_t& e) {
+                    local.visit(e);
+                };
+
+                for_each_in(first, last, consumer);
+            });
+
+        for (auto& local : partial)
+            visitor.merge(std::move(local));
+    }
+
+    /// @brief   Copies every timing event of this timeline.
+    /// @details The records of each block of timing events are copied out
+    ///          all at once, without going through a variant.
+    /// @returns The timing events, in the order they are stored.
+    std::vector<timing_event>
+    timing_events() const noexcept {
+        constexpr auto k_timing = detail::variant_index_v<timing_event, event_variant_t>;
+        std::vector<timing_event> result;
+        for (const auto& block : blocks_) {
+            if (block.type != k_timing)
+                continue;
+
+            auto first = result.size();
+            result.resize(first + block.count);
+            std::memcpy(result.data() + first, block.records,
+                block.count * sizeof(timing_event));
+            for (auto i = first; i < result.size(); i++)
+                result[i].name = remap(result[i].name);
+        }
+
+        return result;
+    }
+
+    /// @brief   Copies every timing event of this timeline, sorted by thread
+    ///          and start time across several threads.
+    /// @param   workers The number of threads to use, or zero for one per
+    ///          hardware thread.
+    /// @returns The sorted timing events, which `thread_runs` can split into
+    ///          the events of each thread.
+    std::vector<timing_event>
+    sorted_timing_events(std::size_t workers = 0) const noexcept {
+        auto result = timing_events();
+        parallel_sort(result, workers);
+        return result;
+    }
+
+private:
+    bool
+    scan_blocks(std::size_t offset) noexcept {
+        using detail::capture_block;
+        constexpr auto k_names  = static_cast<std::uint32_t>(capture_block::names);
+        constexpr auto k_events = static_cast<std::uint32_t>(capture_block::events);
+        constexpr auto k_types  = std::variant_size_v<event_variant_t>;
+
+        detail::capture_block_header header{ };
+        while (file_.size() - offset >= sizeof(header)) {
+            std::memcpy(&header, file_.data() + offset, sizeof(header));
+            offset += sizeof(header);
+            if (header.size > file_.size() - offset)
+                break; // The rest of the capture was cut short.
+
+            auto payload = file_.data() + offset;
+            offset += header.size;
+            if (header.kind == k_names) {
+                if (!read_names(payload, header))
+                    return false;
+            } else if (header.kind >= k_events && header.kind - k_events < k_types &&
+                       header.count > 0) {
+                auto type = header.kind - k_events;
+                if (header.count * record_size(type) > header.size)
+                    return false;
+
+                offsets_.push_back(size_);
+                blocks_.push_back(detail::mapped_block {
+                    .type    = type,
+                    .count   = header.count,
+                    .records = payload
+                });
+                size_ += header.count;
+            }
+        }
+
+        return true;
+    }
+
+    bool
+    read_names(
+        const char* payload,
+        const detail::capture_block_header& header
+    ) noexcept {
+        // The sink numbers names consecutively, so an identifier past the
+        // ones this block adds can only come from a corrupt capture.
+        std::array<std::uint32_t, 2> fields;
+        if (header.count > header.size / sizeof(fields))
+            return false;
+
+        auto limit = names_.size() + header.count;
+        std::size_t offset = 0;
+        for (std::uint32_t i = 0; i < header.count; i++) {
+            if (offset + sizeof(fields) > header.size)
+                return false;
+
+            std::memcpy(fields.data(), payload + offset, sizeof(fields));
+            offset += sizeof(fields);
+            if (offset + fields[1] > header.size)
+                return false;
+
+            auto name = std::string_view(payload + offset, fields[1]);
+            offset += fields[1];
+            if (fields[0] >= limit)
+                return false;
+            if (fields[0] >= names_.size())
+                names_.resize(fields[0] + 1, 0);
+            names_[fields[0]] = name_registry::intern(name);
+        }
+
+        return true;
+    }
+
+    static std::size_t
+    record_size(std::uint32_t type) noexcept {
+        return [type]<std::size_t... Index>(std::index_sequence<Index...>) {
+            std::size_t size = 0;
+            static_cast<void>(((type == Index && (size = sizeof(
+                std::variant_alternative_t<Index, event_variant_t>), true)) || ...));
+            return size;
+        }(std::make_index_sequence<std::variant_size_v<event_variant_t>>{});
+    }
+
+    name_id_t
+    remap(name_id_t name) const noexcept {
+        return name < names_.size() ? names_[name] : 0;
+    }
+
+    std::size_t
+    block_of(std::size_t index) const noexcept {
+        auto it = std::upper_bound(offsets_.begin(), offsets_.end(), index);
+        return static_cast<std::size_t>(it - offsets_.begin()) - 1;
+    }
+
+    template<std::size_t Index>
+    event_variant_t
+    load(const detail::mapped_block& block, std::size_t record) const noexcept {
+        using T = std::variant_alternative_t<Index, event_variant_t>;
+        T result;
+        std::memcpy(&result, block.records + record * sizeof(T), sizeof(T));
+        result.name = remap(result.name);
+        return event_variant_t{ std::in_place_index<Index>, result };
+    }
+
+    event_variant_t
+    load(const detail::mapped_block& block, std::size_t record) const noexcept {
+        return [&]<std::size_t... Index>(std::index_sequence<Index...>) {
+            event_variant_t result;
+            static_cast<void>(((block.type == Index &&
+                (result = load<Index>(block, record), true)) || ...));
+            return result;
+        }(std::make_index_sequence<std::variant_size_v<event_variant_t>>{});
+    }
+
+    template<typename Consumer>
+    void
+    for_each_in(std::size_t first, std::size_t last, Consumer& consumer) const noexcept {
+        if (first >= last)
+            return;
+
+        for (auto b = block_of(first); b < blocks_.size() && offsets_[b] < last; b++) {
+            auto from = std::max(first, offsets_[b]) - offsets_[b];
+            auto to   = std::min<std::size_t>(last - offsets_[b], blocks_[b].count);
+            [&]<std::size_t... Index>(std::index_sequence<Index...>) {
+                static_cast<void>(((blocks_[b].type == Index &&
+                    (visit_records<Index>(blocks_[b], from, to, consumer), true)) || ...));
+            }(std::make_index_sequence<std::variant_size_v<event_variant_t>>{});
+        }
+    }
+
+    template<std::size_t Index, typename Consumer>
+    void
+    visit_records(
+        const detail::mapped_block& block,
+        std::size_t from,
+        std::size_t to,
+        Consumer& consumer
+    ) const noexcept {
+        for (auto i = from; i < to; i++) {
+            auto e = load<Index>(block, i);
+            consumer(std::as_const(e));
+        }
+    }
+
+private:
+    detail::mapped_file file_;
+    std::vector<detail::mapped_block> blocks_;
+    std::vector<std::size_t> offsets_;
+    std::vector<name_id_t> names_;
+    std::size_t size_{ 0 };
+    bool good_{ false };
+};
+
+} // namespace malunal::tooling
@@ -0,0 +1,282 @@
+/// @file   names.hpp
+/// @brief  Contains the name interning used by the performance tooling.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+
+/// @brief   The identifier of a name that was interned by the name registry.
+/// @details Events and probes carry this instead of the name itself, so that
+///          recording an event never has to allocate or copy a string. The
+///          name is only resolved back into a string when it's needed, which
+///          is generally when a visitor runs.
+using name_id_t = std::uint32_t;
+
+/// @brief   A process wide table of every name used by probes and events.
+/// @details Names are interned once and given a dense identifier which never
+///          changes for the lifetime of the process. Looking up a name that
+///          was already interned only takes a shared lock and never
+///          allocates. The identifier `0` is always the empty name.
+struct name_registry final {
+    /// @brief   Gets the singleton instance of this registry.
+    /// @returns The singleton instance of this registry.
+    static name_registry&
+    instance() noexcept {
+        static name_registry k_instance;
+        return k_instance;
+    }
+
+    /// @brief   Interns the given name, if it hasn't been already.
+    /// @param   name The name that should be interned.
+    /// @returns The identifier of the interned name.
+    static name_id_t
+    intern(std::string_view name) noexcept {
+        auto& inst = instance();
+        {
+            std::shared_lock<std::shared_mutex> lock(inst.mutex_);
+            auto it = inst.ids_.find(name);
+            if (it != inst.ids_.end())
+                return it->second;
+        }
+
+        // Check again in case another thread interned it in the meantime.
+        std::unique_lock<std::shared_mutex> lock(inst.mutex_);
+        auto it = inst.ids_.find(name);
+        if (it != inst.ids_.end())
+            return it->second;
+        return inst.insert(name);
+    }
+
+    /// @brief   Resolves the given identifier back into its name.
+    /// @param   id The identifier of an interned name.
+    /// @returns The name that was interned, or an empty name if the
+    ///          identifier is unknown. The returned view is valid for the
+    ///          lifetime of the process.
+    static std::string_view
+    resolve(name_id_t id) noexcept {
+        auto& inst = instance();
+        std::shared_lock<std::shared_mutex> lock(inst.mutex_);
+        if (id >= inst.names_.size())
+            return { };
+        return inst.names_[id];
+    }
+
+    /// @brief   Gets the number of names that have been interned.
+    /// @returns The number of interned names, including the empty name.
+    static std::size_t
+    size() noexcept {
+        auto& inst = instance();
+        std::shared_lock<std::shared_mutex> lock(inst.mutex_);
+        return inst.names_.size();
+    }
+
+private:
+    name_registry() noexcept {
+        insert({ });
+    }
+
+    name_id_t
+    insert(std::string_view name) noexcept {
+        auto id = static_cast<name_id_t>(names_.size());
+        const auto& stored = names_.emplace_back(name);
+        ids_.emplace(stored, id);
+        return id;
+    }
+
+private:
+    // The deque never moves its elements, so the map can view into it.
+    std::unordered_map<std::string_view, name_id_t> ids_;
+    std::deque<std::string> names_;
+    std::shared_mutex mutex_;
+};
+
+
+/// @brief   The interned name of each named thread, keyed by its index.
+using thread_name_map = std::unordered_map<thread_index_t, name_id_t>;
+
+/// @brief   Keeps the names given to threads, by their dense thread index.
+/// @details Threads are named through `profiler::name_thread`, and exporters
+///          use the names in place of the bare index wherever they can. The
+///          names are interned in the `name_registry`. Since the index of a
+///          thread which has exited is given to a new thread once nothing
+///          holds its events anymore, the profiler copies the names into each
+///          timeline it hands out.
+struct thread_registry final {
+    /// @brief   Gets the singleton instance of this registry.
+    /// @returns The singleton instance of this registry.
+    static thread_registry&
+    instance() noexcept {
+        static thread_registry k_instance;
+        return k_instance;
+    }
+
+    /// @brief   Names the thread with the given index, replacing any name it
+    ///          had before.
+    /// @param   tid The index of the thread.
+    /// @param   name The name of the thread.
+    static void
+    name(thread_index_t tid, std::string_view name) noexcept {
+        auto id = name_registry::intern(name);
+        auto& inst = instance();
+        std::unique_lock<std::shared_mutex> lock(inst.mutex_);
+        if (tid >= inst.names_.size())
+            inst.names_.resize(tid + 1, 0);
+        inst.names_[tid] = id;
+    }
+
+    /// @brief   Gets the interned name of the thread with the given index.
+    /// @param   tid The index of the thread.
+    /// @returns The identifier of the name of the thread, or zero if it
+    ///          hasn't been named.
+    static name_id_t
+    name_of(thread_index_t tid) noexcept {
+        auto& inst = instance();
+        std::shared_lock<std::shared_mutex> lock(inst.mutex_);
+        if (tid >= inst.names_.size())
+            return 0;
+        return inst.names_[tid];
+    }
+
+    /// @brief   Resolves the name of the thread with the given index.
+    /// @param   tid The index of the thread.
+    /// @returns The name of the thread, or an empty name if it hasn't been
+    ///          named. The returned view is valid for the lifetime of the
+    ///          process.
+    static std::string_view
+    resolve(thread_index_t tid) noexcept {
+        return name_registry::resolve(name_of(tid));
+    }
+
+    /// @brief   Copies the names of every thread that has been named.
+    /// @returns The identifier of the name of each named thread.
+    static thread_name_map
+    snapshot() noexcept {
+        auto& inst = instance();
+        std::shared_lock<std::shared_mutex> lock(inst.mutex_);
+        thread_name_map result;
+        for (std::size_t tid = 0; tid < inst.names_.size(); tid++) {
+            if (inst.names_[tid] != 0)
+                result.emplace(static_cast<thread_index_t>(tid), inst.names_[tid]);
+        }
+
+        return result;
+    }
+
+private:
+    thread_registry() noexcept = default;
+
+    std::vector<name_id_t> names_;
+    std::shared_mutex mutex_;
+};
+
+
+namespace detail {
+
+/// @brief   A table of values indexed by name identifier, which can be read
+///          and written without a lock.
+/// @details Values are allocated in blocks the first time a name in the block
+///          is looked up for writing. Blocks are never moved or freed until
+///          the table is destroyed, so a pointer to a value stays valid, and
+///          looking up a value is just two array indexing operations.
+/// @tparam  T The type of the values, which must be default constructible.
+/// @tparam  BlockSize The number of values in each block.
+/// @tparam  MaxBlocks The number of blocks the table can hold.
+template<typename T, std::size_t BlockSize = 64, std::size_t MaxBlocks = 4096>
+struct atomic_name_table final {
+    using block_t = std::array<T, BlockSize>;
+
+    atomic_name_table() noexcept = default;
+    atomic_name_table(const atomic_name_table&) = delete;
+    atomic_name_table& operator=(const atomic_name_table&) = delete;
+
+    ~atomic_name_table() noexcept {
+        for (auto& block : blocks_)
+            delete block.load(std::memory_order_relaxed);
+    }
+
+    /// @brief   Finds the value of the given name, allocating its block if it
+    ///          doesn't exist yet.
+    /// @param   name The identifier of the name.
+    /// @returns The value, or null if the name is out of the range of the
+    ///          table or its block could not be allocated.
+    T*
+    get(name_id_t name) noexcept {
+        auto index = name / BlockSize;
+        if (index >= MaxBlocks)
+            return nullptr;
+
+        auto block = blocks_[index].load(std::memory_order_acquire);
+        if (block != nullptr)
+            return &(*block)[name % BlockSize];
+
+        auto created = new (std::nothrow) block_t{ };
+        if (created == nullptr)
+            return nullptr;
+
+        // Another thread may have beaten us to it.
+        if (!blocks_[index].compare_exchange_strong(block, created,
+                std::memory_order_acq_rel, std::memory_order_acquire)) {
+            delete created;
+            return &(*block)[name % BlockSize];
+        }
+
+        return &(*created)[name % BlockSize];
+    }
+
+    /// @brief   Finds the value of the given name, without allocating.
+    /// @param   name The identifier of the name.
+    /// @returns The value, or null if its block doesn't exist.
+    const T*
+    find(name_id_t name) const noexcept {
+        auto index = name / BlockSize;
+        if (index >= MaxBlocks)
+            return nullptr;
+
+        auto block = blocks_[index].load(std::memory_order_acquire);
+        if (block == nullptr)
+            return nullptr;
+        return &(*block)[name % BlockSize];
+    }
+
+    /// @brief   Calls the given function with every value that has been
+    ///          allocated, along with its name.
+    /// @tparam  Function The type of the function.
+    /// @param   fn Called with the identifier of each name and its value.
+    template<typename Function>
+    void
+    for_each(Function&& fn) const noexcept {
+        for (std::size_t b = 0; b < MaxBlocks; b++) {
+            auto block = blocks_[b].load(std::memory_order_acquire);
+            if (block == nullptr)
+                continue;
+
+            for (std::size_t i = 0; i < BlockSize; i++)
+                fn(static_cast<name_id_t>(b * BlockSize + i), (*block)[i]);
+        }
+    }
+
+    /// @brief   Calls the given function with every value that has been
+    ///          allocated, along with its name.
+    /// @tparam  Function The type of the function.
+    /// @param   fn Called with the identifier of each name and its value.
+    template<typename Function>
+    void
+    for_each(Function&& fn) noexcept {
+        for (std::size_t b = 0; b < MaxBlocks; b++) {
+            auto block = blocks_[b].load(std::memory_order_acquire);
+            if (block == nullptr)
+                continue;
+
+            for (std::size_t i = 0; i < BlockSize; i++)
+                fn(static_cast<name_id_t>(b * BlockSize + i), (*block)[i]);
+        }
+    }
+
+private:
+    std::array<std::atomic<block_t*>, MaxBlocks> blocks_{ };
+};
+
+} // namespace malunal::tooling::detail
+} // namespace malunal::tooling
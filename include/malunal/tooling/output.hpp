@@ -0,0 +1,280 @@
+/// @file   output.hpp
+/// @brief  Contains the buffered output used by the visitors of the
+///         performance tooling.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+namespace detail {
+
+/// @brief   A growable character buffer that visitors format their output into.
+/// @details Without a destination, the buffer simply keeps everything written
+///          to it so it can be dumped as a string. With a destination, which
+///          may be a `std::FILE*`, a `std::ostream`, or a file descriptor, the
+///          buffer writes itself out in large chunks whenever it fills up, so
+///          serializing a huge timeline never needs to hold all of it. Once a
+///          write fails, nothing more is written out, and the buffer keeps
+///          everything that wasn't, the way it does without a destination.
+struct output_buffer final {
+    /// @brief   The size the buffer is flushed at when it has a destination.
+    static constexpr std::size_t k_default_capacity = 1 << 20;
+
+    /// @brief   Creates a buffer which keeps everything written to it.
+    output_buffer() noexcept = default;
+
+    /// @brief   Creates a buffer which writes itself to the given file.
+    /// @param   file The file that should be written to.
+    /// @param   capacity The size the buffer is flushed at.
+    explicit output_buffer(
+        std::FILE* file,
+        std::size_t capacity = k_default_capacity
+    ) noexcept
+        : target_{ file }
+        , capacity_{ capacity }
+    { data_.reserve(capacity); }
+
+    /// @brief   Creates a buffer which writes itself to the given stream.
+    /// @param   stream The stream that should be written to.
+    /// @param   capacity The size the buffer is flushed at.
+    explicit output_buffer(
+        std::ostream& stream,
+        std::size_t capacity = k_default_capacity
+    ) noexcept
+        : target_{ &stream }
+        , capacity_{ capacity }
+    { data_.reserve(capacity); }
+
+#if __has_include(<unistd.h>)
+    /// @brief   Creates a buffer which writes itself to the given descriptor.
+    /// @param   fd The file descriptor that should be written to.
+    /// @param   capacity The size the buffer is flushed at.
+    explicit output_buffer(
+        int fd,
+        std::size_t capacity = k_default_capacity
+    ) noexcept
+        : target_{ fd }
+        , capacity_{ capacity }
+    { data_.reserve(capacity); }
+#endif
+
+    output_buffer(output_buffer&&) noexcept = default;
+    output_buffer& operator=(output_buffer&&) noexcept = default;
+
+    ~output_buffer() noexcept {
+        flush();
+    }
+
+    /// @brief   Appends the given characters.
+    /// @param   text The characters that should be appended.
+    void
+    append(std::string_view text) noexcept {
+        data_.append(text);
+        flush_if_full();
+    }
+
+    /// @brief   Appends the given character.
+    /// @param   c The character that should be appended.
+    void
+    append(char c) noexcept {
+        data_.push_back(c);
+        flush_if_full();
+    }
+
+    /// @brief   Appends the decimal representation of the given integer.
+    /// @tparam  T The type of the integer.
+    /// @param   value The integer that should be appended.
+    template<std::integral T>
+    void
+    append_integer(T value) noexcept {
+        std::array<char, 24> digits;
+        auto result = std::to_chars(
+            digits.data(), digits.data() + digits.size(), value);
+        data_.append(digits.data(), result.ptr);
+        flush_if_full();
+    }
+
+    /// @brief   Appends the given floating point value with a fixed number of
+    ///          decimal places.
+    /// @param   value The value that should be appended.
+    /// @param   precision The number of decimal places.
+    void
+    append_fixed(double value, int precision = 3) noexcept {
+        std::array<char, 64> digits;
+        auto result = std::to_chars(digits.data(), digits.data() + digits.size(),
+            value, std::chars_format::fixed, precision);
+        if (result.ec != std::errc{ })
+            return;
+
+        data_.append(digits.data(), result.ptr);
+        flush_if_full();
+    }
+
+    /// @brief   Appends the shortest representation of the given floating
+    ///          point value which reads back as the same value.
+    /// @details Values that aren't finite are written as zero, so the output
+    ///          stays valid JSON.
+    /// @param   value The value that should be appended.
+    void
+    append_number(double value) noexcept {
+        if (!std::isfinite(value))
+            value = 0.0;
+
+        std::array<char, 32> digits;
+        auto result = std::to_chars(
+            digits.data(), digits.data() + digits.size(), value);
+        data_.append(digits.data(), result.ptr);
+        flush_if_full();
+    }
+
+    /// @brief   Appends the given integer divided by a thousand, with exactly
+    ///          three decimal places.
+    /// @details Used to write nanoseconds as microseconds without ever going
+    ///          through floating point.
+    /// @param   value The integer that should be appended.
+    void
+    append_thousandths(std::int64_t value) noexcept {
+        if (value < 0) {
+            data_.push_back('-');
+            value = -value;
+        }
+
+        append_integer(value / 1000);
+        auto fraction = value % 1000;
+        data_.push_back('.');
+        data_.push_back(static_cast<char>('0' + fraction / 100));
+        data_.push_back(static_cast<char>('0' + fraction / 10 % 10));
+        data_.push_back(static_cast<char>('0' + fraction % 10));
+        flush_if_full();
+    }
+
+    /// @brief   Appends the given text, escaped so that it can be placed
+    ///          between the quotes of a JSON or YAML string.
+    /// @param   text The text that should be appended.
+    void
+    append_escaped(std::string_view text) noexcept {
+        static constexpr char k_hex[] = "0123456789abcdef";
+        for (auto c : text) {
+            auto u = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\') {
+                data_.push_back('\\');
+                data_.push_back(c);
+            } else if (u < 0x20) {
+                data_.append("\\u00");
+                data_.push_back(k_hex[u >> 4]);
+                data_.push_back(k_hex[u & 0xf]);
+            } else {
+                data_.push_back(c);
+            }
+        }
+
+        flush_if_full();
+    }
+
+    /// @brief   Appends the given raw bytes.
+    /// @param   bytes The bytes that should be appended.
+    void
+    append_bytes(std::span<const std::uint8_t> bytes) noexcept {
+        data_.append(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        flush_if_full();
+    }
+
+    /// @brief   Writes out and clears the buffer, if it has a destination.
+    /// @details If the write fails, only what was written out is cleared, and
+    ///          the buffer is no longer good.
+    void
+    flush() noexcept {
+        if (data_.empty() || !good_)
+            return;
+
+        std::visit([this](auto target) {
+            using T = std::decay_t<decltype(target)>;
+            std::size_t written = data_.size();
+            if constexpr (std::is_same_v<T, std::FILE*>) {
+                // What the file buffered but failed to flush can't be told
+                // apart from what reached it, so all of it is kept.
+                written = std::fwrite(data_.data(), 1, data_.size(), target);
+                good_ = written == data_.size() && std::fflush(target) == 0;
+                written = good_ ? written : 0;
+            } else if constexpr (std::is_same_v<T, std::ostream*>) {
+                target->write(data_.data(), data_.size());
+                target->flush();
+                good_ = static_cast<bool>(*target);
+                written = good_ ? data_.size() : 0;
+            } else if constexpr (std::is_same_v<T, int>) {
+                written = write_descriptor(target);
+                good_ = written == data_.size();
+            } else {
+                return; // No destination, keep everything.
+            }
+
+            data_.erase(0, written);
+        }, target_);
+    }
+
+    /// @brief   Checks if every write to the destination succeeded.
+    /// @returns True if nothing failed to be written; false otherwise.
+    bool
+    good() const noexcept {
+        return good_;
+    }
+
+    /// @brief   Writes everything in the buffer to the given stream, without
+    ///          clearing it.
+    /// @param   stream The stream that should be written to.
+    void
+    write_to(std::ostream& stream) const noexcept {
+        stream.write(data_.data(), data_.size());
+    }
+
+    /// @brief   Writes everything in the buffer to the given file, without
+    ///          clearing it.
+    /// @param   file The file that should be written to.
+    void
+    write_to(std::FILE* file) const noexcept {
+        std::fwrite(data_.data(), 1, data_.size(), file);
+    }
+
+    /// @brief   Gets everything in the buffer that hasn't been written out.
+    /// @returns A view of the buffered characters.
+    std::string_view
+    view() const noexcept {
+        return data_;
+    }
+
+private:
+    void
+    flush_if_full() noexcept {
+        if (data_.size() >= capacity_)
+            flush();
+    }
+
+    // Gets how much of the buffer was written before a write failed, which is
+    // all of it if none did.
+    std::size_t
+    write_descriptor([[maybe_unused]] int fd) noexcept {
+        std::size_t written = 0;
+#if __has_include(<unistd.h>)
+        while (written < data_.size()) {
+            auto result = ::write(
+                fd, data_.data() + written, data_.size() - written);
+            if (result < 0 && errno == EINTR)
+                continue;
+            if (result <= 0)
+                break;
+            written += static_cast<std::size_t>(result);
+        }
+#endif
+        return written;
+    }
+
+private:
+    std::variant<std::monostate, std::FILE*, std::ostream*, int> target_;
+    std::size_t capacity_{ SIZE_MAX };
+    std::string data_;
+    bool good_{ true };
+};
+
+} // namespace malunal::tooling::detail
+} // namespace malunal::tooling
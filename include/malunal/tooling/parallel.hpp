@@ -0,0 +1,192 @@
+/// @file   parallel.hpp
+/// @brief  Contains the parallel algorithms used to analyze timelines.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+namespace detail {
+
+/// @brief   The fewest elements worth handing to a worker thread of its own.
+/// @details Below this, starting the thread costs more than it saves.
+inline constexpr std::size_t k_min_parallel_items = 16384;
+
+/// @brief   Works out how many workers should split the given amount of work.
+/// @param   requested The number of workers asked for, or zero for one per
+///          hardware thread.
+/// @param   items The number of elements that will be split between them.
+/// @returns The number of workers, at least one.
+inline std::size_t
+resolve_workers(std::size_t requested, std::size_t items) noexcept {
+    if (requested == 0)
+        requested = std::max(1u, std::thread::hardware_concurrency());
+    auto useful = std::max<std::size_t>(items / k_min_parallel_items, 1);
+    return std::min(requested, useful);
+}
+
+/// @brief   Splits a range into contiguous pieces and runs the given function
+///          on each of them, one thread per piece.
+/// @details The calling thread runs the first piece itself, and only returns
+///          once every piece is done.
+/// @tparam  Function The type of the function.
+/// @param   count The number of elements in the range.
+/// @param   workers The number of pieces, which should already be resolved.
+/// @param   fn Called with the index of the piece and the first and one past
+///          the last element of it.
+template<typename Function>
+void
+parallel_for(std::size_t count, std::size_t workers, Function&& fn) noexcept {
+    workers = std::clamp<std::size_t>(workers, 1, std::max<std::size_t>(count, 1));
+    auto piece = [count, workers](std::size_t index) {
+        return count * index / workers;
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+    for (std::size_t w = 1; w < workers; w++)
+        threads.emplace_back([&fn, w, first = piece(w), last = piece(w + 1)] {
+            fn(w, first, last);
+        });
+
+    fn(std::size_t{ 0 }, piece(0), piece(1));
+    for (auto& thread : threads)
+        thread.join();
+}
+
+/// @brief   Orders timing events by thread, then by start time, with outer
+///          events before the events they contain.
+struct thread_order final {
+    bool
+    operator()(const timing_event& lhs, const timing_event& rhs) const noexcept {
+        if (lhs.tid != rhs.tid)
+            return lhs.tid < rhs.tid;
+        if (lhs.start != rhs.start)
+            return lhs.start < rhs.start;
+        return lhs.duration > rhs.duration;
+    }
+};
+
+} // namespace malunal::tooling::detail
+
+/// @brief   Sorts the given timing events by thread and start time, across
+///          several threads.
+/// @details Each worker sorts its own piece of the events, then the pieces are
+///          merged in pairs, each round of merges running in parallel, until
+///          one run is left. Events that start at the same time on the same
+///          thread are ordered outermost first, which is the order the call
+///          tree expects.
+/// @param   events The events that should be sorted, in place.
+/// @param   workers The number of threads to use, or zero for one per
+///          hardware thread.
+inline void
+parallel_sort(std::span<timing_event> events, std::size_t workers = 0) noexcept {
+    workers = detail::resolve_workers(workers, events.size());
+    if (workers <= 1) {
+        std::sort(events.begin(), events.end(), detail::thread_order{ });
+        return;
+    }
+
+    std::vector<std::size_t> bounds;
+    for (std::size_t w = 0; w <= workers; w++)
+        bounds.push_back(events.size() * w / workers);
+    detail::parallel_for(workers, workers,
+        [&](std::size_t, std::size_t first, std::size_t last) {
+            for (auto w = first; w < last; w++)
+                std::sort(events.begin() + bounds[w],
+                    events.begin() + bounds[w + 1], detail::thread_order{ });
+        });
+
+    // Merge neighbouring runs back and forth between the events and a
+    // scratch buffer until a single run is left.
+    std::vector<timing_event> scratch(events.size());
+    std::span<timing_event> from = events;
+    std::span<timing_event> to = scratch;
+    while (bounds.size() > 2) {
+        auto runs  = bounds.size() - 1;
+        auto pairs = (runs + 1) / 2;
+        detail::parallel_for(pairs, pairs,
+            [&](std::size_t, std::size_t first, std::size_t last) {
+                for (auto p = first; p < last; p++) {
+                    auto lo  = bounds[p * 2];
+                    auto mid = bounds[std::min(p * 2 + 1, runs)];
+                    auto hi  = bounds[std::min(p * 2 + 2, runs)];
+                    std::merge(from.begin() + lo, from.begin() + mid,
+                        from.begin() + mid, from.begin() + hi,
+                        to.begin() + lo, detail::thread_order{ });
+                }
+            });
+
+        std::vector<std::size_t> merged;
+        for (std::size_t i = 0; i < bounds.size(); i += 2)
+            merged.push_back(bounds[i]);
+        if (merged.back() != bounds.back())
+            merged.push_back(bounds.back());
+        bounds = std::move(merged);
+        std::swap(from, to);
+    }
+
+    if (from.data() != events.data())
+        std::copy(from.begin(), from.end(), events.begin());
+}
+
+/// @brief   Splits timing events sorted by thread into one run per thread.
+/// @param   events The events, sorted by `parallel_sort` or in the same order.
+/// @returns The events of each thread, in the order of the threads.
+inline std::vector<std::span<const timing_event>>
+thread_runs(std::span<const timing_event> events) noexcept {
+    std::vector<std::span<const timing_event>> result;
+    std::size_t first = 0;
+    for (std::size_t i = 1; i <= events.size(); i++) {
+        if (i < events.size() && events[i].tid == events[first].tid)
+            continue;
+
+        result.push_back(events.subspan(first, i - first));
+        first = i;
+    }
+
+    return result;
+}
+
+/// @brief   Merges runs of timing events, each sorted by start time, into a
+///          single sequence sorted by start time.
+/// @details Keeps a heap with the next event of each run, so merging `n`
+///          events from `k` runs takes `O(n log k)`. Events that start at the
+///          same time come out in the order of their runs.
+/// @tparam  Consumer The type of the callable receiving each event.
+/// @param   runs The runs that should be merged, such as the ones produced by
+///          `thread_runs`.
+/// @param   consumer Called with each event, in order of start time.
+template<typename Consumer>
+void
+merge_runs(
+    std::span<const std::span<const timing_event>> runs,
+    Consumer&& consumer
+) noexcept {
+    using cursor = std::pair<std::size_t, std::size_t>;
+    auto later = [&runs](const cursor& lhs, const cursor& rhs) {
+        const auto& l = runs[lhs.first][lhs.second];
+        const auto& r = runs[rhs.first][rhs.second];
+        if (l.start != r.start)
+            return l.start > r.start;
+        return lhs.first > rhs.first;
+    };
+
+    std::vector<cursor> heap;
+    heap.reserve(runs.size());
+    for (std::size_t r = 0; r < runs.size(); r++)
+        if (!runs[r].empty())
+            heap.emplace_back(r, 0);
+    std::make_heap(heap.begin(), heap.end(), later);
+
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        auto& next = heap.back();
+        consumer(runs[next.first][next.second]);
+        if (++next.second < runs[next.first].size())
+            std::push_heap(heap.begin(), heap.end(), later);
+        else heap.pop_back();
+    }
+}
+
+} // namespace malunal::tooling
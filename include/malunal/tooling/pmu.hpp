@@ -0,0 +1,420 @@
+/// @file   pmu.hpp
+/// @brief  Contains the probes which read the hardware performance counters.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+namespace detail {
+
+/// @brief   The values of every counter in `pmu_counter`, in its order.
+using pmu_counts = std::array<std::uint64_t, k_pmu_counters>;
+
+/// @brief   The hardware counters of the calling thread, opened as one group so
+///          they are all counting over exactly the same instructions.
+/// @details On Linux this opens a `perf_event_open` group counting in user
+///          space only. Where the kernel allows it and the processor is x86,
+///          the counters are read with `rdpmc` through the page the kernel
+///          maps for each of them, which takes a few dozen cycles; otherwise
+///          the whole group is read with a single `read` call. Anywhere else,
+///          or when the counters can't be opened, the group is unavailable and
+///          reading it fails.
+class pmu_group final {
+public:
+    /// @brief   Gets the group of the calling thread, opening it the first
+    ///          time it is asked for.
+    /// @returns The group of the calling thread.
+    static pmu_group&
+    local() noexcept {
+        thread_local pmu_group group;
+        return group;
+    }
+
+    pmu_group(const pmu_group&) = delete;
+    pmu_group& operator=(const pmu_group&) = delete;
+
+    ~pmu_group() noexcept {
+#ifdef MALUNAL_TOOLING_HAS_PERF_EVENTS
+        close();
+#endif
+    }
+
+    /// @brief   Checks if the counters were opened.
+    /// @returns True if the counters can be read; false otherwise.
+    bool
+    available() const noexcept {
+#ifdef MALUNAL_TOOLING_HAS_PERF_EVENTS
+        return fds_[0] >= 0;
+#else
+        return false;
+#endif
+    }
+
+    /// @brief   Checks if the counters are read in user space with `rdpmc`.
+    /// @returns True if reading them doesn't enter the kernel; false otherwise.
+    bool
+    user_space() const noexcept {
+#ifdef MALUNAL_TOOLING_HAS_PERF_EVENTS
+        return rdpmc_;
+#else
+        return false;
+#endif
+    }
+
+    /// @brief   Reads the current value of every counter.
+    /// @param   counts Receives the values of the counters.
+    /// @returns True if the counters were read; false otherwise.
+    bool
+    read(pmu_counts& counts) noexcept {
+#ifdef MALUNAL_TOOLING_HAS_PERF_EVENTS
+        if (!available())
+            return false;
+        if (rdpmc_ && read_user_space(counts))
+            return true;
+        return read_group(counts);
+#else
+        static_cast<void>(counts);
+        return false;
+#endif
+    }
+
+private:
+    pmu_group() noexcept {
+#ifdef MALUNAL_TOOLING_HAS_PERF_EVENTS
+        open();
+#endif
+    }
+
+#ifdef MALUNAL_TOOLING_HAS_PERF_EVENTS
+    static constexpr std::array<std::uint64_t, k_pmu_counters> k_configs {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    void
+    open() noexcept {
+        for (std::size_t i = 0; i < k_pmu_counters; i++) {
+            perf_event_attr attr{ };
+            attr.type           = PERF_TYPE_HARDWARE;
+            attr.size           = sizeof(attr);
+            attr.config         = k_configs[i];
+            attr.read_format    = PERF_FORMAT_GROUP;
+            attr.disabled       = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+
+            auto fd = static_cast<int>(syscall(
+                SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds_[0], 0));
+            if (fd < 0) {
+                close();
+                return;
+            }
+
+            fds_[i] = fd;
+        }
+
+        ioctl(fds_[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+#if defined(__x86_64__) || defined(__i386__)
+        // Reading in user space needs the page of every counter, so only use
+        // it if the kernel lets us have all of them.
+        page_size_ = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        rdpmc_ = true;
+        for (std::size_t i = 0; i < k_pmu_counters; i++) {
+            auto page = mmap(nullptr, page_size_, PROT_READ, MAP_SHARED, fds_[i], 0);
+            if (page == MAP_FAILED) {
+                rdpmc_ = false;
+                break;
+            }
+
+            pages_[i] = static_cast<perf_event_mmap_page*>(page);
+            rdpmc_ = rdpmc_ && pages_[i]->cap_user_rdpmc;
+        }
+#endif
+    }
+
+    void
+    close() noexcept {
+        for (std::size_t i = 0; i < k_pmu_counters; i++) {
+            if (pages_[i] != nullptr)
+                munmap(pages_[i], page_size_);
+            if (fds_[i] >= 0)
+                ::close(fds_[i]);
+            pages_[i] = nullptr;
+            fds_[i]   = -1;
+        }
+
+        rdpmc_ = false;
+    }
+
+    bool
+    read_user_space(pmu_counts& counts) noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+        for (std::size_t i = 0; i < k_pmu_counters; i++) {
+            // The kernel updates the page under a sequence lock, so retry
+            // until the page didn't change while we read it.
+            volatile auto* page = pages_[i];
+            std::uint32_t sequence;
+            do {
+                sequence = page->lock;
+                std::atomic_signal_fence(std::memory_order_acquire);
+                auto index = page->index;
+                if (index == 0)
+                    return false; // The counter isn't scheduled right now.
+
+                auto width = page->pmc_width;
+                auto value = static_cast<std::int64_t>(__rdpmc(index - 1));
+                value <<= 64 - width;
+                value >>= 64 - width;
+                counts[i] = static_cast<std::uint64_t>(page->offset + value);
+                std::atomic_signal_fence(std::memory_order_acquire);
+            } while (page->lock != sequence);
+        }
+
+        return true;
+#else
+        static_cast<void>(counts);
+        return false;
+#endif
+    }
+
+    bool
+    read_group(pmu_counts& counts) noexcept {
+        struct {
+            std::uint64_t count;
+            std::array<std::uint64_t, k_pmu_counters> values;
+        } group;
+
+        auto size = ::read(fds_[0], &group, sizeof(group));
+        if (size != static_cast<ssize_t>(sizeof(group)) ||
+            group.count != k_pmu_counters)
+            return false;
+
+        counts = group.values;
+        return true;
+    }
+
+    std::array<int, k_pmu_counters> fds_{ -1, -1, -1, -1 };
+    std::array<perf_event_mmap_page*, k_pmu_counters> pages_{ };
+    std::size_t page_size_{ 0 };
+    bool rdpmc_{ false };
+#endif /* MALUNAL_TOOLING_HAS_PERF_EVENTS */
+};
+
+} // namespace malunal::tooling::detail
+
+/// @brief   Checks if the hardware counters can be read on the calling thread.
+/// @details PMU probes still record their timing events when they can't, they
+///          just don't record any counters with them.
+/// @returns True if the counters were opened; false otherwise.
+inline bool
+pmu_available() noexcept {
+    return detail::pmu_group::local().available();
+}
+
+/// @brief   A deferred timing probe which also records how much the hardware
+///          performance counters went up over its scope.
+/// @details Along with its timing event, the probe records a `pmu_event` for
+///          each of the cycles, instructions, cache misses, and branch misses
+///          of the scope. Where the counters can't be read, it behaves like a
+///          plain `deferred_timing_probe`.
+/// @tparam  Clock The clock source the probe reads time from.
+/// @remarks The counters are only counted while the thread runs in user space,
+///          and are shared by every PMU probe on the thread, so nested probes
+///          each count everything inside them. When more counters are in use
+///          than the processor has, the kernel multiplexes them and the counts
+///          only cover the time each one was scheduled.
+template<detail::ClockSource Clock = default_clock_source>
+struct pmu_timing_probe {
+    /// @brief   Creates a new instance of the probe and reads the counters and
+    ///          the start time for the probe.
+    /// @param   name The interned name of this timing probe.
+    /// @param   category The categories this probe is filed under; it only
+    ///          records if one of them is enabled when it is created.
+    pmu_timing_probe(
+        name_id_t name,
+        category_t category = categories::general
+    ) noexcept
+        : name_{ name }
+        , active_{ profiler::enabled(category) }
+    {
+        if (active_)
+            start();
+    }
+
+    /// @brief   Creates a new instance of the probe and reads the counters and
+    ///          the start time for the probe.
+    /// @param   name The name of this timing probe; it will be interned if it
+    ///          hasn't been already, and the probe is enabled.
+    /// @param   category The categories this probe is filed under; it only
+    ///          records if one of them is enabled when it is created.
+    pmu_timing_probe(
+        std::string_view name,
+        category_t category = categories::general
+    ) noexcept
+        : name_{ 0 }
+        , active_{ profiler::enabled(category) }
+    {
+        if (!active_)
+            return;
+
+        name_ = name_registry::intern(name);
+        start();
+    }
+
+    /// @brief   Reads the end time and the counters, and provides the events of
+    ///          the scope to the profiler.
+    ~pmu_timing_probe() noexcept {
+        if (!active_)
+            return;
+
+        // Pull the time first so reading the counters isn't part of it.
+        auto end = Clock::now();
+        detail::pmu_counts counts;
+        auto counted = counting_ && detail::pmu_group::local().read(counts);
+
+        auto& tool = profiler::instance();
+        auto tid = profiler::thread_index();
+        tool.record_event(timing_event {
+            .name     = name_,
+            .tid      = tid,
+            .flags    = Clock::k_flags,
+            .start    = start_,
+            .duration = end - start_
+        });
+
+        if (!counted)
+            return;
+
+        // A clamped counter would skew the ratios between the counters, so
+        // the whole scope is flagged rather than just the one counter.
+        constexpr std::uint64_t k_max = std::numeric_limits<std::uint32_t>::max();
+        std::uint16_t flags = Clock::k_flags;
+        for (std::size_t i = 0; i < k_pmu_counters; i++) {
+            if (counts[i] - counts_[i] > k_max)
+                flags |= event_flags::saturated;
+        }
+
+        for (std::size_t i = 0; i < k_pmu_counters; i++) {
+            auto delta = counts[i] - counts_[i];
+            tool.record_event(pmu_event {
+                .name    = name_,
+                .tid     = tid,
+                .flags   = flags,
+                .when    = start_,
+                .counter = static_cast<pmu_counter>(i),
+                .value   = static_cast<std::uint32_t>(std::min(delta, k_max))
+            });
+        }
+    }
+
+private:
+    void
+    start() noexcept {
+        // Read the counters before the time, so they also leave any reading
+        // of the clock out.
+        counting_ = detail::pmu_group::local().read(counts_);
+        start_ = Clock::now();
+    }
+
+    name_id_t name_;
+    bool active_;
+    bool counting_{ false };
+    tick_t start_{ 0 };
+    detail::pmu_counts counts_{ };
+};
+
+/// @brief   The hardware counters of every scope of the same name, added up.
+struct pmu_totals final {
+    /// @brief   The number of scopes that were added up.
+    std::uint64_t scopes{ 0 };
+
+    /// @brief   The number of scopes left out of the totals because one of
+    ///          their counters saturated.
+    std::uint64_t saturated{ 0 };
+
+    /// @brief   The total of each counter, in the order of `pmu_counter`.
+    std::array<std::uint64_t, k_pmu_counters> counts{ };
+
+    /// @brief   Gets the total of the given counter.
+    /// @param   counter The counter to get.
+    /// @returns The total of the counter over every scope.
+    std::uint64_t
+    total(pmu_counter counter) const noexcept {
+        return counts[static_cast<std::size_t>(counter)];
+    }
+
+    /// @brief   Gets the number of instructions retired for each cycle.
+    /// @returns The instructions per cycle, or zero if no cycles were counted.
+    double
+    instructions_per_cycle() const noexcept {
+        auto cycles = total(pmu_counter::cycles);
+        if (cycles == 0)
+            return 0.0;
+        return static_cast<double>(total(pmu_counter::instructions)) /
+            static_cast<double>(cycles);
+    }
+
+    /// @brief   Gets how often the given counter went up for every thousand
+    ///          instructions, such as the cache misses per kilo instruction.
+    /// @param   counter The counter to get the rate of.
+    /// @returns The rate of the counter, or zero if no instructions were
+    ///          counted.
+    double
+    per_kilo_instruction(pmu_counter counter) const noexcept {
+        auto instructions = total(pmu_counter::instructions);
+        if (instructions == 0)
+            return 0.0;
+        return static_cast<double>(total(counter)) * 1000.0 /
+            static_cast<double>(instructions);
+    }
+};
+
+/// @brief   A visitor which adds up the hardware counters of every scope, by
+///          name.
+struct pmu_statistics_visitor final {
+    /// @brief   The totals of the counters, keyed by the name of the scopes.
+    std::unordered_map<name_id_t, pmu_totals> totals;
+
+    /// @brief   Adds a visited PMU event to the totals of its name.
+    /// @param   timeline_event The event being visited.
+    void
+    visit(const event_variant_t& timeline_event) noexcept {
+        auto pmu = std::get_if<pmu_event>(&timeline_event);
+        if (pmu == nullptr)
+            return;
+
+        auto& entry = totals[pmu->name];
+        auto index = static_cast<std::size_t>(pmu->counter);
+        if (index >= k_pmu_counters)
+            return;
+        if (pmu->flags & event_flags::saturated) {
+            if (pmu->counter == pmu_counter::cycles)
+                entry.saturated++;
+            return;
+        }
+
+        if (pmu->counter == pmu_counter::cycles)
+            entry.scopes++;
+        entry.counts[index] += pmu->value;
+    }
+
+    /// @brief   Adds the totals of another visitor into this one.
+    /// @param   other The visitor which visited another part of the timeline.
+    void
+    merge(pmu_statistics_visitor&& other) noexcept {
+        for (const auto& [name, entry] : other.totals) {
+            auto& into = totals[name];
+            into.scopes    += entry.scopes;
+            into.saturated += entry.saturated;
+            for (std::size_t i = 0; i < k_pmu_counters; i++)
+                into.counts[i] += entry.counts[i];
+        }
+    }
+};
+
+} // namespace malunal::tooling
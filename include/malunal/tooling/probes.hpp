@@ -36,41 +36,85 @@ enum class probe_type {
 /// @tparam  Type Used in the specialization of the timing probe; determines
 ///          whether this probe specializes for deferred event delivery, or
 ///          or allows the creator to control the start and end of the probe.
-template<probe_type Type = probe_type::deferred>
+/// @tparam  Clock The clock source the probe reads time from.
+template<
+    probe_type Type = probe_type::deferred,
+    detail::ClockSource Clock = default_clock_source
+>
 struct timing_probe {
     /// @brief   Creates a new instance of the probe and grabs the start time
     ///          for the probe.
-    /// @param   name The name of this timing probe.
+    /// @param   name The interned name of this timing probe.
+    /// @param   category The categories this probe is filed under; it only
+    ///          records if one of them is enabled when it is created.
     /// @remarks Since this version is the default specialization, and it is
     ///          a deferring probe, we must grab the time now and when this
     ///          instance is destroyed.
-    timing_probe(const std::string& name) noexcept
+    timing_probe(
+        name_id_t name,
+        category_t category = categories::general
+    ) noexcept
         : name_{ name }
-        , start_{ perf_clock_t::now() }
-    { }
+        , active_{ profiler::enabled(category) }
+        , start_{ 0 }
+    {
+        if (!active_)
+            return;
+
+        allocations_.begin();
+        start_ = Clock::now();
+    }
+
+    /// @brief   Creates a new instance of the probe and grabs the start time
+    ///          for the probe.
+    /// @param   name The name of this timing probe; it will be interned if it
+    ///          hasn't been already, and the probe is enabled.
+    /// @param   category The categories this probe is filed under; it only
+    ///          records if one of them is enabled when it is created.
+    /// @remarks Prefer interning the name once and providing the identifier
+    ///          in hot paths, as this has to look the name up every time.
+    timing_probe(
+        std::string_view name,
+        category_t category = categories::general
+    ) noexcept
+        : name_{ 0 }
+        , active_{ profiler::enabled(category) }
+        , start_{ 0 }
+    {
+        if (!active_)
+            return;
+
+        name_ = name_registry::intern(name);
+        allocations_.begin();
+        start_ = Clock::now();
+    }
 
     /// @brief   Grabs the end time, provides the timing event to the profiler,
     ///          and destroys this instance.
     /// @remarks Since this version is the default specialization, and it is
     ///          a deferring probe, we must grab the time when an instance is
-    ///          created, and now when it's destroyed.
+    ///          created, and now when it's destroyed. When allocation tracking
+    ///          is enabled, this also records the allocations of the scope.
     ~timing_probe() noexcept {
-        using std::this_thread::get_id;
+        if (!active_)
+            return;
 
         // Pull this immediately to correctly represent timing.
-        auto end_ = perf_clock_t::now();
-        auto& tool = profiler::instance();
-        tool.record_event(timing_event {
-            .name  = name_,
-            .tid   = get_id(),
-            .start = start_,
-            .end   = end_
+        auto end_ = Clock::now();
+        allocations_.record(timing_event {
+            .name     = name_,
+            .tid      = profiler::thread_index(),
+            .flags    = Clock::k_flags,
+            .start    = start_,
+            .duration = end_ - start_
         });
     }
 
 private:
-    std::string name_;
-    time_point_t start_;
+    name_id_t name_;
+    bool active_;
+    tick_t start_;
+    [[no_unique_address]] detail::allocation_scope allocations_;
 };
 
 /// @brief   A timing probe is a profiling tool which records timing information
@@ -79,17 +123,46 @@ private:
 /// @details This specialization is a non-deferring probe. It allows the creator
 ///          to start and stop the timing at will. Each time the measurement is
 ///          stopped, a new timing event will be provided to the profiler.
-/// @tparam  Name The name for this timing probe; the name will be provided to
-///          the profiler when the event is pushed.
-template<>
-struct timing_probe<probe_type::classic> {
+/// @tparam  Clock The clock source the probe reads time from.
+template<detail::ClockSource Clock>
+struct timing_probe<probe_type::classic, Clock> {
     /// @brief   Sets the start time for the probe to `now`.
     /// @details This is the non-deferring timing probe, so this is provided to
     ///          allow the creator of the probe to measure multiple times.
+    /// @param   name The interned name of the measurement.
+    /// @param   category The categories the measurement is filed under; it is
+    ///          only recorded if one of them is enabled when it starts.
     void
-    start(const std::string& name) const noexcept {
+    start(
+        name_id_t name,
+        category_t category = categories::general
+    ) const noexcept {
+        active_ = profiler::enabled(category);
+        if (!active_)
+            return;
+
         name_ = name;
-        start_ = perf_clock_t::now();
+        start_ = Clock::now();
+    }
+
+    /// @brief   Sets the start time for the probe to `now`.
+    /// @details This is the non-deferring timing probe, so this is provided to
+    ///          allow the creator of the probe to measure multiple times.
+    /// @param   name The name of the measurement; it will be interned if it
+    ///          hasn't been already, and the measurement is enabled.
+    /// @param   category The categories the measurement is filed under; it is
+    ///          only recorded if one of them is enabled when it starts.
+    void
+    start(
+        std::string_view name,
+        category_t category = categories::general
+    ) const noexcept {
+        active_ = profiler::enabled(category);
+        if (!active_)
+            return;
+
+        name_ = name_registry::intern(name);
+        start_ = Clock::now();
     }
 
     /// @brief   Obtains the stop time for the probe, which is `now`, then
@@ -98,23 +171,26 @@ struct timing_probe<probe_type::classic> {
     ///          allow the creator of the probe to measure multiple times.
     void
     stop() const noexcept {
-        using std::this_thread::get_id;
+        if (!active_)
+            return;
 
         // Pull this immediately to correctly represent timing.
-        auto end_ = perf_clock_t::now();
+        auto end_ = Clock::now();
         auto& tool = profiler::instance();
         tool.record_event(timing_event {
-            .name  = name_,
-            .tid   = get_id(),
-            .start = start_,
-            .end   = end_
+            .name     = name_,
+            .tid      = profiler::thread_index(),
+            .flags    = Clock::k_flags,
+            .start    = start_,
+            .duration = end_ - start_
         });
     }
 
 private:
     // Don't look at me like that
-    mutable std::string name_;
-    mutable time_point_t start_;
+    mutable name_id_t name_{ 0 };
+    mutable bool active_{ false };
+    mutable tick_t start_{ 0 };
 };
 
 
@@ -128,4 +204,182 @@ using deferred_timing_probe = timing_probe<probe_type::deferred>;
 ///          specifying the `probe_type` template argument explicitly.
 using classic_timing_probe = timing_probe<probe_type::classic>;
 
+/// @brief   A counter probe records the value of a counter, or a gauge, each
+///          time it is asked to.
+/// @details Every recorded value becomes a counter event, which exporters
+///          show as the value of the counter over time.
+/// @tparam  Clock The clock source the probe reads time from.
+template<detail::ClockSource Clock = default_clock_source>
+struct counter_probe {
+    /// @brief   Creates a new counter probe.
+    /// @param   name The interned name of the counter.
+    /// @param   category The categories this counter is filed under; values are
+    ///          only recorded while one of them is enabled.
+    counter_probe(
+        name_id_t name,
+        category_t category = categories::general
+    ) noexcept
+        : name_{ name }
+        , category_{ category }
+    { }
+
+    /// @brief   Creates a new counter probe.
+    /// @param   name The name of the counter; it will be interned if it hasn't
+    ///          been already.
+    /// @param   category The categories this counter is filed under; values are
+    ///          only recorded while one of them is enabled.
+    counter_probe(
+        std::string_view name,
+        category_t category = categories::general
+    ) noexcept
+        : name_{ name_registry::intern(name) }
+        , category_{ category }
+    { }
+
+    /// @brief   Records the current value of the counter.
+    /// @param   value The value of the counter at this time.
+    void
+    record(double value) const noexcept {
+        if (!profiler::enabled(category_))
+            return;
+
+        profiler::instance().record_event(counter_event {
+            .name  = name_,
+            .tid   = profiler::thread_index(),
+            .flags = Clock::k_flags,
+            .when  = Clock::now(),
+            .value = value
+        });
+    }
+
+private:
+    name_id_t name_;
+    category_t category_;
+};
+
+/// @brief   An instant probe records that something happened at a single point
+///          in time, such as a frame boundary or a cache flush.
+/// @tparam  Clock The clock source the probe reads time from.
+template<detail::ClockSource Clock = default_clock_source>
+struct instant_probe {
+    /// @brief   Creates a new instant probe.
+    /// @param   name The interned name of the instant.
+    /// @param   category The categories this instant is filed under; it is only
+    ///          recorded while one of them is enabled.
+    instant_probe(
+        name_id_t name,
+        category_t category = categories::general
+    ) noexcept
+        : name_{ name }
+        , category_{ category }
+    { }
+
+    /// @brief   Creates a new instant probe.
+    /// @param   name The name of the instant; it will be interned if it hasn't
+    ///          been already.
+    /// @param   category The categories this instant is filed under; it is only
+    ///          recorded while one of them is enabled.
+    instant_probe(
+        std::string_view name,
+        category_t category = categories::general
+    ) noexcept
+        : name_{ name_registry::intern(name) }
+        , category_{ category }
+    { }
+
+    /// @brief   Records that the instant happened now.
+    void
+    record() const noexcept {
+        if (!profiler::enabled(category_))
+            return;
+
+        profiler::instance().record_event(instant_event {
+            .name  = name_,
+            .tid   = profiler::thread_index(),
+            .flags = Clock::k_flags,
+            .when  = Clock::now()
+        });
+    }
+
+private:
+    name_id_t name_;
+    category_t category_;
+};
+
+/// @brief   A flow probe records the steps of a piece of work that moves
+///          between threads, such as a request or a job.
+/// @details Every step of the same piece of work shares an identifier, which
+///          exporters use to draw arrows between the steps.
+/// @tparam  Clock The clock source the probe reads time from.
+template<detail::ClockSource Clock = default_clock_source>
+struct flow_probe {
+    /// @brief   Creates a new flow probe.
+    /// @param   name The interned name of the flow.
+    /// @param   category The categories this flow is filed under; its steps are
+    ///          only recorded while one of them is enabled.
+    flow_probe(
+        name_id_t name,
+        category_t category = categories::general
+    ) noexcept
+        : name_{ name }
+        , category_{ category }
+    { }
+
+    /// @brief   Creates a new flow probe.
+    /// @param   name The name of the flow; it will be interned if it hasn't
+    ///          been already.
+    /// @param   category The categories this flow is filed under; its steps are
+    ///          only recorded while one of them is enabled.
+    flow_probe(
+        std::string_view name,
+        category_t category = categories::general
+    ) noexcept
+        : name_{ name_registry::intern(name) }
+        , category_{ category }
+    { }
+
+    /// @brief   Records that the piece of work with the given identifier has
+    ///          started on this thread.
+    /// @param   id The identifier of the piece of work.
+    void
+    begin(std::uint32_t id) const noexcept {
+        record(id, flow_phase::begin);
+    }
+
+    /// @brief   Records that the piece of work with the given identifier has
+    ///          reached this thread.
+    /// @param   id The identifier of the piece of work.
+    void
+    step(std::uint32_t id) const noexcept {
+        record(id, flow_phase::step);
+    }
+
+    /// @brief   Records that the piece of work with the given identifier has
+    ///          finished on this thread.
+    /// @param   id The identifier of the piece of work.
+    void
+    end(std::uint32_t id) const noexcept {
+        record(id, flow_phase::end);
+    }
+
+private:
+    void
+    record(std::uint32_t id, flow_phase phase) const noexcept {
+        if (!profiler::enabled(category_))
+            return;
+
+        profiler::instance().record_event(flow_event {
+            .name  = name_,
+            .tid   = profiler::thread_index(),
+            .flags = Clock::k_flags,
+            .when  = Clock::now(),
+            .id    = id,
+            .phase = phase
+        });
+    }
+
+    name_id_t name_;
+    category_t category_;
+};
+
 } // namespace malunal::perf
@@ -7,21 +7,152 @@
 
 namespace malunal::tooling {
 
+/// @brief   A set of categories, one per bit, that probes are filed under.
+/// @details Applications are free to give the bits their own meanings, such as
+///          one per subsystem, or use some of them as levels of detail.
+using category_t = std::uint64_t;
+
+/// @brief   Contains the categories predefined by the tooling.
+namespace categories {
+
+/// @brief   The category of probes which weren't given one.
+inline constexpr category_t general = 1ull << 0;
+
+/// @brief   A category for probes too detailed to be enabled by default.
+inline constexpr category_t verbose = 1ull << 63;
+
+/// @brief   Every category.
+inline constexpr category_t all = ~category_t{ 0 };
+
+/// @brief   The categories that are enabled unless told otherwise.
+inline constexpr category_t defaults = all & ~verbose;
+
+} // namespace malunal::tooling::categories
+
+/// @brief   Determines what a profiling session captures from its probes.
+enum class capture_mode : std::uint8_t {
+    /// @brief   Every event is captured, to be kept in the timeline or given to
+    ///          the sink of the session.
+    events = 1 << 0,
+
+    /// @brief   Only the statistics of each name are captured.
+    /// @details Probes update statistics kept by their own thread, instead of
+    ///          recording an event, so the memory used by the session only
+    ///          grows with the number of distinct names. This is cheap enough
+    ///          to leave running in production.
+    statistics = 1 << 1,
+
+    /// @brief   Both the events and the statistics of each name are captured.
+    events_and_statistics = events | statistics
+};
+
+/// @brief   What a thread does with an event when its buffer is full.
+/// @details When sessions which overlap ask for different policies, the one
+///          listed first wins, so no session loses more than it asked to.
+enum class overflow_policy : std::uint8_t {
+    /// @brief   The thread wakes the profiling thread and yields until there
+    ///          is room, so nothing is lost but the thread may be held up.
+    block,
+
+    /// @brief   The event is pushed into a queue of its own which grows, up to
+    ///          the spill limit, until the profiling thread catches up.
+    ///          Events beyond the limit, or which can't be allocated room, are
+    ///          dropped.
+    spill,
+
+    /// @brief   The oldest event in the buffer is dropped to make room, so the
+    ///          most recent ones are kept.
+    drop_oldest,
+
+    /// @brief   The event is dropped, keeping the ones already in the buffer.
+    drop_newest
+};
+
+/// @brief   Options that control how a profiling session records its events.
+struct session_options final {
+    /// @brief   How the timeline of the session stores timing events.
+    /// @details Columnar storage is more compact and faster to stream through
+    ///          for long captures.
+    storage_mode storage{ storage_mode::events };
+
+    /// @brief   A sink which receives every batch of events as it is drained.
+    /// @details Use `binary_capture_sink` to stream the session to a file while
+    ///          it runs. The sink is flushed and released when the session
+    ///          stops.
+    std::shared_ptr<event_sink> sink{ };
+
+    /// @brief   Whether the events should also be kept in the timeline.
+    /// @details Turn this off when streaming to a sink to keep the memory used
+    ///          by the session bounded; the timeline returned when the session
+    ///          stops will then be empty.
+    bool retain_events{ true };
+
+    /// @brief   What the session captures from its probes.
+    /// @details When statistics are captured, they can be merged at any time
+    ///          with `profiler::statistics`, and are attached to the timeline
+    ///          returned when the session stops.
+    capture_mode capture{ capture_mode::events };
+
+    /// @brief   The number of recent events the flight recorder keeps for each
+    ///          thread, or zero to keep every event instead.
+    /// @details When set, the session runs as a flight recorder: the events of
+    ///          each thread are kept in a ring of this size, overwriting the
+    ///          oldest ones, so the session can run indefinitely in a fixed
+    ///          amount of memory. Use `profiler::snapshot` to look at the last
+    ///          moments of the session without stopping it. The timeline
+    ///          returned when the session stops holds whatever the rings held,
+    ///          and `retain_events` is ignored.
+    std::size_t flight_recorder_events{ 0 };
+
+    /// @brief   What a thread does with an event when its buffer is full.
+    /// @details Every policy but `block` never makes the recording thread
+    ///          wait, which is why `block` has to be asked for: the default
+    ///          spills, and only loses events once the spill queue is full.
+    ///          Events that are lost are counted, and the count is given by
+    ///          `profiler::dropped_events` and attached to the timeline.
+    overflow_policy overflow{ overflow_policy::spill };
+
+    /// @brief   The most events each thread may hold in its spill queue at
+    ///          once, under the spill policy.
+    std::size_t spill_events{ 1 << 20 };
+};
+
 /// @brief   Responsible for tracking all profiling data necessary for the
 ///          loading and graphing of that data in another application.
 /// @details The profiler is a non-invasive registrar of profiling data that
-///          runs on a separate thread and periodically clears an event queue
-///          of data that was registered by probes.
+///          runs on a separate thread and periodically drains the per-thread
+///          buffers of data that was registered by probes.
 struct profiler final {
+    /// @brief   The number of events each thread buffer can hold before the
+    ///          events recorded into it overflow, under the overflow policy
+    ///          of the session.
+    static constexpr std::size_t k_buffer_capacity = 16384;
+
     /// @brief   Whether this profiler should defer when events get drained from
     ///          the event queue during execution.
     /// @details If you application is extremely peformance critical, you may
     ///          want to enable this as context switches of the profiler may
     ///          have an impact on the performance of your application,
-    ///          especially in a multi-threaded environment.
+    ///          especially in a multi-threaded environment. When enabled, the
+    ///          profiling thread ignores the drain interval and threshold and
+    ///          only wakes when a thread buffer is close to full, or when the
+    ///          session is stopped.
     /// @remarks Be sure to benchmark your application with and without the
     ///          profiler running before making the decision to enable this!
-    bool defer_drain{false};
+    std::atomic<bool> defer_drain{false};
+
+    /// @brief   The number of events a thread buffer has to hold before the
+    ///          thread recording into it wakes the profiling thread.
+    /// @details Lower values keep the timeline closer to real time, higher
+    ///          values let events pile up into larger batches and wake the
+    ///          profiling thread less often.
+    std::atomic<std::size_t> drain_threshold{4096};
+
+    /// @brief   The longest the profiling thread will sleep before draining
+    ///          the thread buffers, even if no threshold was reached.
+    std::atomic<std::chrono::milliseconds> drain_interval{
+        std::chrono::milliseconds{ 10 }
+    };
 
     /// @brief   Gets the singleton instance of this profiler.
     /// @details The profiler is designed to be a single use object. If you need
@@ -33,98 +164,1218 @@ struct profiler final {
         return k_instance;
     }
 
-    /// @brief   Starts a profiling session by starting the profiling thread.
-    /// @details The profiling thread is responsible for draining the event
-    ///          queue periodically when new events are recorded.
+    ~profiler() noexcept {
+        for (auto buffer : buffers_)
+            delete buffer;
+    }
+
+    /// @brief   Starts a profiling session with the given name.
+    /// @details Sessions are independent of each other and may overlap, such
+    ///          as a long running session capturing statistics alongside a
+    ///          short one capturing every event. Probes record each event once,
+    ///          into the buffer of their thread, and the profiling thread hands
+    ///          every batch it drains to each running session. The profiling
+    ///          thread is started with the first session, which also calibrates
+    ///          the time stamp counter against `perf_clock_t` so events from
+    ///          `tsc_clock_source` probes can be placed on the same timeline as
+    ///          everything else.
     /// @param   name The name of the session that is being started.
-    static void
-    start_session(const std::string& name) noexcept {
+    /// @param   options The options controlling how the session records.
+    /// @returns True if the session was started; false if a session with the
+    ///          same name is already running.
+    /// @remarks The statistics and sampling weights are shared by the sessions
+    ///          which overlap, and are only reset when a session starts while no
+    ///          other is using them.
+    static bool
+    start_session(
+        const std::string& name,
+        const session_options& options = { }
+    ) noexcept {
+        auto& inst = instance();
+        std::lock_guard<std::mutex> control(inst.control_mutex_);
+        auto entry = std::make_shared<session>(name, options);
+        bool first = false;
+        {
+            std::lock_guard<std::mutex> lock(inst.buffers_mutex_);
+            if (inst.find_session(name) != nullptr)
+                return false;
+
+            constexpr auto statistics =
+                static_cast<std::uint8_t>(capture_mode::statistics);
+            first = inst.sessions_.empty();
+            if ((entry->capture & statistics) &&
+                !(inst.capture_.load(std::memory_order_relaxed) & statistics)) {
+                inst.generation_.fetch_add(1, std::memory_order_relaxed);
+                inst.retired_statistics_.clear();
+            }
+
+            entry->dropped_before = inst.total_dropped();
+            inst.sessions_.push_back(entry);
+            inst.update_capture();
+        }
+
+        if (first) {
+            inst.sampling_weights_.for_each(
+                [](name_id_t, weight_slot& weight) {
+                    weight.total.store(0.0, std::memory_order_relaxed);
+                    weight.events.store(0, std::memory_order_relaxed);
+                });
+            inst.coarse_ticks_.store(
+                to_ticks(perf_clock_t::now()), std::memory_order_relaxed);
+            inst.calibration_ = clock_calibration::anchor();
+            inst.tick_rate_ = inst.calibration_.rate();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(inst.mutex_);
+            inst.running_ = true;
+            active_categories_.store(
+                inst.enabled_categories_, std::memory_order_relaxed);
+        }
+
+        if (first)
+            inst.event_thread_ = std::thread(&profiler::profile, &inst);
+        return true;
+    }
+
+    /// @brief   Stops the profiling session with the given name, and produces
+    ///          its timeline.
+    /// @details Blocks the calling thread until the profiling thread has
+    ///          drained everything recorded before the call into the session.
+    ///          The other sessions keep running, and the profiling thread is
+    ///          only joined once the last of them stops.
+    /// @param   name The name of the session that should be stopped.
+    /// @returns The timeline that was recorded by the session, or an empty
+    ///          timeline if no session with that name is running.
+    static timeline
+    stop_session(std::string_view name) noexcept {
         auto& inst = instance();
-        inst.running_ = true;
-        inst.session_name_ = name;
-        inst.event_thread_ = std::thread(&profiler::profile, &inst);
+        std::lock_guard<std::mutex> control(inst.control_mutex_);
+        std::shared_ptr<session> entry;
+        {
+            std::lock_guard<std::mutex> lock(inst.buffers_mutex_);
+            entry = inst.find_session(name);
+        }
+
+        return inst.stop(std::move(entry));
     }
 
-    /// @brief   Stops a profiling session by notifying the profiling thread
-    ///          to join, and producing the timeline.
-    /// @details Will block the calling thread until the profiling thread has
-    ///          finished any tasks it has left. Mostly, the profiling thread
-    ///          will be draining the event queue and updating the timeline.
-    /// @returns The timeline that was recorded by this profiler.
+    /// @brief   Stops the profiling session that was started last, and
+    ///          produces its timeline.
+    /// @returns The timeline that was recorded by the session, or an empty
+    ///          timeline if no session is running.
     static timeline
     stop_session() noexcept {
         auto& inst = instance();
-        inst.running_ = false;
-        inst.check_events_.notify_all();
-        if (inst.event_thread_.joinable())
-            inst.event_thread_.join();
-        return std::move(inst.timeline_);
+        std::lock_guard<std::mutex> control(inst.control_mutex_);
+        std::shared_ptr<session> entry;
+        {
+            std::lock_guard<std::mutex> lock(inst.buffers_mutex_);
+            if (!inst.sessions_.empty())
+                entry = inst.sessions_.back();
+        }
+
+        return inst.stop(std::move(entry));
+    }
+
+    /// @brief   Freezes the last moments kept by the flight recorder of the
+    ///          given session into a timeline, without stopping it.
+    /// @details The profiling thread drains the thread buffers first, so the
+    ///          snapshot includes everything recorded before the call, then
+    ///          copies each event that ended within the window out of the
+    ///          rings. Recording carries on while it does. The timeline has the
+    ///          statistics and sampling weights of the session so far attached,
+    ///          like the one returned when the session stops. Blocks the
+    ///          calling thread until the snapshot is taken, so this can't be
+    ///          called from a signal handler, nor from a sink; use
+    ///          `request_snapshot` there instead.
+    /// @param   name The name of the session.
+    /// @param   window How far back from now the snapshot should reach.
+    /// @returns The events that ended within the window, or an empty timeline
+    ///          if no session with that name is running or the session isn't a
+    ///          flight recorder.
+    static timeline
+    snapshot(
+        std::string_view name,
+        std::chrono::nanoseconds window = std::chrono::nanoseconds::max()
+    ) noexcept {
+        auto& inst = instance();
+        std::shared_ptr<session> entry;
+        {
+            std::lock_guard<std::mutex> lock(inst.buffers_mutex_);
+            entry = inst.find_session(name);
+        }
+
+        if (entry == nullptr)
+            return timeline{ };
+
+        std::unique_lock<std::mutex> lock(inst.mutex_);
+        while (!entry->stopped) {
+            auto taken = entry->snapshots_taken;
+            entry->snapshot_window.store(
+                std::max<std::int64_t>(window.count(), 1),
+                std::memory_order_relaxed);
+            inst.drain_requested_.store(true, std::memory_order_relaxed);
+            inst.check_events_.notify_one();
+            inst.sessions_changed_.wait(lock, [&entry, taken]() {
+                return entry->snapshots_taken != taken || entry->stopped;
+            });
+
+            // Another caller may have taken the snapshot first.
+            if (entry->pending_snapshot.has_value()) {
+                auto result = std::move(*entry->pending_snapshot);
+                entry->pending_snapshot.reset();
+                return result;
+            }
+        }
+
+        return timeline{ };
+    }
+
+    /// @brief   Asks the profiling thread to take a snapshot of every running
+    ///          flight recorder, without waiting for it.
+    /// @details This only stores to a pair of lock free atomics, so it is safe
+    ///          to call from a signal handler, such as one installed for a
+    ///          latency watchdog. The profiling thread takes the snapshots the
+    ///          next time it wakes, which is within the drain interval unless
+    ///          draining is deferred, and holds on to them until `take_snapshot`
+    ///          is called. A later request replaces a snapshot nobody took.
+    /// @param   window How far back from the time the snapshots are taken they
+    ///          should reach.
+    static void
+    request_snapshot(
+        std::chrono::nanoseconds window = std::chrono::nanoseconds::max()
+    ) noexcept {
+        auto& inst = instance();
+        inst.snapshot_window_.store(
+            std::max<std::int64_t>(window.count(), 1),
+            std::memory_order_relaxed);
+        inst.drain_requested_.store(true, std::memory_order_relaxed);
+    }
+
+    /// @brief   Takes the snapshot of the given session that was asked for with
+    ///          `request_snapshot`.
+    /// @param   name The name of the session.
+    /// @returns The snapshot, or nothing if it wasn't taken yet.
+    static std::optional<timeline>
+    take_snapshot(std::string_view name) noexcept {
+        auto& inst = instance();
+        std::shared_ptr<session> entry;
+        {
+            std::lock_guard<std::mutex> lock(inst.buffers_mutex_);
+            entry = inst.find_session(name);
+        }
+
+        if (entry == nullptr)
+            return std::nullopt;
+
+        std::lock_guard<std::mutex> lock(inst.mutex_);
+        auto result = std::move(entry->pending_snapshot);
+        entry->pending_snapshot.reset();
+        return result;
     }
 
-    /// @brief   Provides access to the current session name.
-    /// @returns The session name that is currently set.
-    /// @remarks The session name changes every time a call to `start_session`
-    ///          is made, so make sure to grab it before starting a new one.
-    static std::string_view
+    /// @brief   Subscribes the given sink to a running session.
+    /// @details Like the sink of the session, a subscriber receives every batch
+    ///          of events drained into the session from then on, on the
+    ///          profiling thread, and is flushed and released when the session
+    ///          stops. Sessions which only capture statistics have no events
+    ///          to give it. Use `visitor_sink` to have a visitor analyze the session
+    ///          as it runs.
+    /// @param   name The name of the session.
+    /// @param   subscriber The sink which should receive the events.
+    /// @returns True if the sink was subscribed; false if no session with that
+    ///          name is running.
+    static bool
+    subscribe(
+        std::string_view name,
+        std::shared_ptr<event_sink> subscriber
+    ) noexcept {
+        auto& inst = instance();
+        std::lock_guard<std::mutex> lock(inst.buffers_mutex_);
+        auto entry = inst.find_session(name);
+        if (entry == nullptr || subscriber == nullptr)
+            return false;
+
+        entry->subscribers.push_back(std::move(subscriber));
+        return true;
+    }
+
+    /// @brief   Unsubscribes the given sink from a running session.
+    /// @details The sink receives no events once this returns. It isn't
+    ///          flushed, since that would happen outside the profiling thread.
+    /// @param   name The name of the session.
+    /// @param   subscriber The sink which was subscribed.
+    static void
+    unsubscribe(
+        std::string_view name,
+        const std::shared_ptr<event_sink>& subscriber
+    ) noexcept {
+        auto& inst = instance();
+        std::lock_guard<std::mutex> lock(inst.buffers_mutex_);
+        if (auto entry = inst.find_session(name))
+            std::erase(entry->subscribers, subscriber);
+    }
+
+    /// @brief   Gives the timeline of a running session to the given function,
+    ///          while no events are being added to it.
+    /// @details This is a consistent, read only view of everything drained into
+    ///          the session so far, which the function can iterate or visit.
+    ///          The function runs without holding any lock the recording
+    ///          threads or the profiling thread wait on; whatever is drained
+    ///          while it runs is set aside, and added to the timeline by the
+    ///          next drain after it returns. Don't inspect the same session
+    ///          from within the function. The timeline of a flight recorder is
+    ///          empty; use `snapshot` instead.
+    /// @param   name The name of the session.
+    /// @param   function Called with an immutable reference to the timeline.
+    /// @returns True if the function was called; false if no session with
+    ///          that name is running.
+    template<typename Function>
+    static bool
+    inspect(std::string_view name, Function&& function) noexcept {
+        auto& inst = instance();
+        std::shared_ptr<session> entry;
+        {
+            std::lock_guard<std::mutex> lock(inst.buffers_mutex_);
+            entry = inst.find_session(name);
+        }
+
+        if (entry == nullptr)
+            return false;
+
+        // The timeline of a flight recorder is only filled in as it stops.
+        if (entry->flight_recorder_events != 0) {
+            timeline empty{ entry->storage };
+            std::forward<Function>(function)(std::as_const(empty));
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(entry->events_mutex);
+        std::forward<Function>(function)(std::as_const(entry->events));
+        return true;
+    }
+
+    /// @brief   Gets the name of the session that was started last.
+    /// @returns The name of the last session started which is still running,
+    ///          or an empty string if none is.
+    static std::string
     session_name() noexcept {
         auto& inst = instance();
-        return inst.session_name_;
+        std::lock_guard<std::mutex> lock(inst.buffers_mutex_);
+        if (inst.sessions_.empty())
+            return { };
+        return inst.sessions_.back()->name;
     }
 
-    /// @brief   Records the provided event by pushing it into an event queue.
-    /// @details The recorded event will be drained when the profiler determines
-    ///          it is okay to do so. If the `defer_drain` variable was set on
-    ///          the profiler, it will wait until the session is over before
-    ///          doing so. Otherwise, it will process events as soon and quickly
-    ///          as possible and then block itself until it needs to process
-    ///          more events.
+    /// @brief   Checks whether a session with the given name is running.
+    /// @param   name The name of the session.
+    /// @returns True if the session is running; false otherwise.
+    static bool
+    session_running(std::string_view name) noexcept {
+        auto& inst = instance();
+        std::lock_guard<std::mutex> lock(inst.buffers_mutex_);
+        auto entry = inst.find_session(name);
+        return entry != nullptr && !entry->stopping;
+    }
+
+    /// @brief   Merges the statistics captured by every thread so far.
+    /// @details May be called at any time while a session that captures
+    ///          statistics is running, without disturbing the threads that
+    ///          are updating them, or after it stops and before another
+    ///          session starts.
+    /// @returns The statistics of each name.
+    static statistics_map
+    statistics() noexcept {
+        auto& inst = instance();
+        auto generation = inst.generation_.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(inst.buffers_mutex_);
+        auto result = inst.retired_statistics_;
+        for (auto buffer : inst.buffers_)
+            buffer->statistics.merge_into(generation, result);
+        return result;
+    }
+
+    /// @brief   Gets the index of the calling thread.
+    /// @details The index is assigned the first time the thread asks for it
+    ///          or records an event, and stays the same for the lifetime of
+    ///          the thread. Once the thread exits, and every session which
+    ///          was running by then has stopped, the index is given to the
+    ///          next new thread. Timelines keep the names threads had while
+    ///          they were recorded, so they don't take the names of the
+    ///          threads which get the index later.
+    /// @returns The dense index of the calling thread, or the largest index,
+    ///          shared by every such thread, if its buffer couldn't be
+    ///          allocated.
+    static thread_index_t
+    thread_index() noexcept {
+        auto buffer = local_buffer();
+        return buffer != nullptr ? buffer->index : k_shared_thread_index;
+    }
+
+    /// @brief   Names the calling thread, so exporters can show the name in
+    ///          place of its index.
+    /// @param   name The name of the thread, like `"io-worker-3"`.
+    static void
+    name_thread(std::string_view name) noexcept {
+        thread_registry::name(thread_index(), name);
+    }
+
+    /// @brief   Checks whether probes filed under any of the given categories
+    ///          should record.
+    /// @details This is a single relaxed load, and probes check it before they
+    ///          do anything else, so a disabled probe costs next to nothing. No
+    ///          category is enabled while no session is running.
+    /// @param   category The categories of the probe.
+    /// @returns True if a session is running and one of the categories is
+    ///          enabled; false otherwise.
+    static bool
+    enabled(category_t category) noexcept {
+        return (active_categories_.load(std::memory_order_relaxed) & category)
+            != 0;
+    }
+
+    /// @brief   Gets the categories that are enabled.
+    /// @returns The enabled categories, whether or not a session is running.
+    static category_t
+    enabled_categories() noexcept {
+        auto& inst = instance();
+        std::lock_guard<std::mutex> lock(inst.mutex_);
+        return inst.enabled_categories_;
+    }
+
+    /// @brief   Replaces the categories that are enabled.
+    /// @details Takes effect immediately if a session is running, and applies
+    ///          to every session started afterwards. Probes that already
+    ///          started when their category is disabled still record.
+    /// @param   category The categories that should be enabled.
+    static void
+    set_categories(category_t category) noexcept {
+        auto& inst = instance();
+        std::lock_guard<std::mutex> lock(inst.mutex_);
+        inst.enabled_categories_ = category;
+        if (inst.running_.load(std::memory_order_relaxed))
+            active_categories_.store(category, std::memory_order_relaxed);
+    }
+
+    /// @brief   Enables the given categories, on top of those already enabled.
+    /// @param   category The categories that should be enabled.
+    static void
+    enable_categories(category_t category) noexcept {
+        set_categories(enabled_categories() | category);
+    }
+
+    /// @brief   Disables the given categories, leaving the others as they are.
+    /// @param   category The categories that should be disabled.
+    static void
+    disable_categories(category_t category) noexcept {
+        set_categories(enabled_categories() & ~category);
+    }
+
+    /// @brief   Gets a coarse reading of `perf_clock_t`, without reading it.
+    /// @details The profiling thread refreshes the reading every time it
+    ///          wakes, so it lags behind by at most the drain interval, or more
+    ///          if draining is deferred. This is meant for decisions which need
+    ///          to know roughly what time it is on every call, like rate limits,
+    ///          where even reading the clock would cost too much.
+    /// @returns The ticks of `perf_clock_t` when the profiling thread last
+    ///          woke up.
+    static tick_t
+    coarse_now() noexcept {
+        return instance().coarse_ticks_.load(std::memory_order_relaxed);
+    }
+
+    /// @brief   Notes how many events a recorded event of the given name
+    ///          stands for.
+    /// @details Called by sampled probes every time they record an event. The
+    ///          weights of every event of a name are added up, so each counts
+    ///          by the weight it was recorded with, even when the rate of a
+    ///          sampler changes or several samplers share the name. The
+    ///          weights of a session are attached to the timeline when it
+    ///          stops, as the average for each name.
+    /// @param   name The name of the sampled event.
+    /// @param   weight The number of events the recorded one stands for.
+    static void
+    note_sampling_weight(name_id_t name, double weight) noexcept {
+        auto slot = instance().sampling_weights_.get(name);
+        if (slot == nullptr)
+            return;
+        slot->total.fetch_add(weight, std::memory_order_relaxed);
+        slot->events.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// @brief   Records the provided event by pushing it into the buffer of
+    ///          the calling thread.
+    /// @details Every thread that records events gets its own buffer the first
+    ///          time it does so. Pushing into that buffer takes no lock and
+    ///          makes no system call. The profiling thread collects the events
+    ///          in batches, either when the drain interval elapses or when a
+    ///          buffer reaches the drain threshold, and moves them into the
+    ///          timeline. If the `defer_drain` variable was set on the
+    ///          profiler, it will only do so when a buffer is close to full or
+    ///          the session is over. If the buffer is full while a session is
+    ///          running, the calling thread wakes the profiling thread and then
+    ///          follows the overflow policy of the sessions. If no session is
+    ///          running, the event is dropped. If the buffer of the thread
+    ///          can't be allocated, the event is dropped and counted, and the
+    ///          next event tries again.
     /// @param   e The event that should be recorded into the timeline.
     static void
     record_event(const event_variant_t& e) noexcept {
         auto& inst = instance();
-        inst.timeline_.push(e);
-        inst.check_events_.notify_all();
+        if (!inst.running_.load(std::memory_order_relaxed))
+            return;
+
+        auto capture = inst.capture_.load(std::memory_order_relaxed);
+        auto pointer = local_buffer();
+        if (pointer == nullptr) {
+            if (capture & static_cast<std::uint8_t>(capture_mode::events))
+                inst.unbuffered_dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        auto& buffer = *pointer;
+        if (capture & static_cast<std::uint8_t>(capture_mode::statistics))
+            inst.record_statistics(buffer, e);
+        if (!(capture & static_cast<std::uint8_t>(capture_mode::events)))
+            return;
+
+        auto overflow = static_cast<overflow_policy>(
+            inst.overflow_.load(std::memory_order_relaxed));
+        if (overflow == overflow_policy::block) {
+            while (!buffer.ring.try_push(e)) {
+                if (!inst.running_.load(std::memory_order_relaxed))
+                    return;
+                inst.request_drain();
+                std::this_thread::yield();
+            }
+        } else if (!push_event(inst, buffer, overflow, e)) {
+            return;
+        }
+
+        // Only look at the consumer side of the buffer every so often, the
+        // profiler doesn't need to be woken for every event.
+        auto threshold = inst.wake_threshold();
+        if (++buffer.unchecked < threshold)
+            return;
+
+        buffer.unchecked = 0;
+        if (buffer.ring.size() >= threshold)
+            inst.request_drain();
+    }
+
+    /// @brief   Gets the number of events that threads have dropped because
+    ///          their buffers were full, since the process started.
+    /// @returns The number of events dropped by every thread.
+    static std::uint64_t
+    dropped_events() noexcept {
+        auto& inst = instance();
+        std::lock_guard<std::mutex> lock(inst.buffers_mutex_);
+        return inst.total_dropped();
+    }
+
+    /// @brief   Gets the number of events that threads have dropped because
+    ///          their buffers were full, since the given session started.
+    /// @param   name The name of the session.
+    /// @returns The number of events dropped while the session ran, or zero
+    ///          if no session with that name is running.
+    static std::uint64_t
+    dropped_events(std::string_view name) noexcept {
+        auto& inst = instance();
+        std::lock_guard<std::mutex> lock(inst.buffers_mutex_);
+        auto entry = inst.find_session(name);
+        return entry == nullptr ? 0 : inst.total_dropped() - entry->dropped_before;
+    }
+
+    /// @brief   Counts the given timing event in the statistics of the calling
+    ///          thread, without recording it.
+    /// @details Used by probes which only ever contribute to the statistics.
+    ///          The event is dropped unless a running session captures
+    ///          statistics.
+    /// @param   timing The timing event that should be counted.
+    static void
+    record_statistics(const timing_event& timing) noexcept {
+        auto& inst = instance();
+        if (!inst.running_.load(std::memory_order_relaxed))
+            return;
+
+        auto capture = inst.capture_.load(std::memory_order_relaxed);
+        if (!(capture & static_cast<std::uint8_t>(capture_mode::statistics)))
+            return;
+        if (auto buffer = local_buffer())
+            inst.record_statistics(*buffer, timing);
     }
 
 private:
+    /// @brief   The weights noted for the recorded events of a sampled name,
+    ///          added up.
+    struct weight_slot final {
+        std::atomic<double> total{ 0.0 };
+        std::atomic<std::uint64_t> events{ 0 };
+    };
+
+    /// @brief   Holds the thread buffer registered with the profiler, and
+    ///          retires it on destruction.
+    /// @details One of these lives in the thread local storage of each thread
+    ///          that records events, so its lifetime matches that thread. The
+    ///          profiler owns the buffer, and frees it once it's retired and
+    ///          drained.
+    struct buffer_handle final {
+        ~buffer_handle() noexcept {
+            if (buffer != nullptr)
+                buffer->retired.store(true, std::memory_order_release);
+        }
+
+        detail::thread_buffer* buffer{ nullptr };
+    };
+
+    /// @brief   The state of a single profiling session.
+    /// @details The timeline, sink and flight recorder rings of a session are
+    ///          only touched by the profiling thread while it runs, and by the
+    ///          thread stopping it once it's done.
+    struct session final {
+        session(const std::string& name, const session_options& options)
+            : name{ name }
+            , events{ options.storage }
+            , sink{ options.sink }
+            , storage{ options.storage }
+            , flight_recorder_events{ options.flight_recorder_events }
+            , capture{ static_cast<std::uint8_t>(options.capture) }
+            , retain_events{ options.retain_events }
+            , started{ to_ticks(perf_clock_t::now()) }
+            , overflow{ static_cast<std::uint8_t>(options.overflow) }
+            , spill_events{ std::max<std::size_t>(options.spill_events, 1) }
+        { }
+
+        std::string name;
+        timeline events;
+        std::shared_ptr<event_sink> sink;
+        std::vector<std::shared_ptr<event_sink>> subscribers;
+        storage_mode storage;
+        std::size_t flight_recorder_events;
+        std::uint8_t capture;
+        bool retain_events;
+        tick_t started;
+        std::unordered_map<
+            thread_index_t,
+            detail::history_ring<event_variant_t>> histories;
+        detail::history_ring<event_variant_t> retired_history;
+        std::atomic<std::int64_t> snapshot_window{0};
+        std::atomic<bool> stopping{false};
+        std::uint8_t overflow;
+        std::size_t spill_events;
+        std::uint64_t dropped_before{ 0 };
+
+        // Guarded by the buffers mutex; set once a drain starts after the
+        // session was stopped, so it has everything recorded before then.
+        bool drained{ false };
+
+        // Guarded by the buffers mutex; the indices of the threads which
+        // exited while the session ran, held until it's retired, and the names
+        // of the threads as they were then.
+        std::vector<thread_index_t> exited_threads;
+        thread_name_map thread_names;
+
+        // Guards the timeline while it is being inspected. Events drained
+        // while it's held are kept aside by the profiling thread, which never
+        // waits on it.
+        std::mutex events_mutex;
+        std::vector<event_variant_t> deferred_events;
+
+        // Guarded by the mutex of the profiler.
+        std::optional<timeline> pending_snapshot;
+        std::uint64_t snapshots_taken{ 0 };
+        bool stopped{ false };
+    };
+
+    /// @brief   The index every thread without a buffer of its own shares.
+    static constexpr thread_index_t k_shared_thread_index =
+        std::numeric_limits<thread_index_t>::max();
+
+    static detail::thread_buffer*
+    local_buffer() noexcept {
+        thread_local buffer_handle handle;
+        if (handle.buffer == nullptr)
+            handle.buffer = instance().register_buffer();
+        return handle.buffer;
+    }
+
+    // Allocates a buffer for the calling thread without throwing, since this
+    // runs on the way out of a probe. Returns null if it couldn't be.
+    detail::thread_buffer*
+    register_buffer() noexcept {
+        auto buffer = new (std::nothrow) detail::thread_buffer(k_buffer_capacity, 0);
+        if (buffer == nullptr)
+            return nullptr;
+
+        std::unique_lock<std::mutex> lock(buffers_mutex_);
+        if (!buffer->ring.allocated() || !buffers_.push_back(buffer)) {
+            lock.unlock();
+            delete buffer;
+            return nullptr;
+        }
+
+        buffer->index = acquire_thread_index();
+        return buffer;
+    }
+
+    // Follows a policy which never waits on the profiling thread, returning
+    // false if the event had to be dropped.
+    static bool
+    push_event(
+        profiler& inst,
+        detail::thread_buffer& buffer,
+        overflow_policy overflow,
+        const event_variant_t& e
+    ) noexcept {
+        auto pushed = true;
+        switch (overflow) {
+        case overflow_policy::spill:
+            // Keep spilling until the queue is drained, so the events of the
+            // thread stay in order.
+            if (!buffer.spill.drained() || !buffer.ring.try_push(e)) {
+                inst.request_drain();
+                pushed = buffer.spill.try_push(
+                    e, inst.spill_limit_.load(std::memory_order_relaxed));
+            }
+            break;
+        case overflow_policy::drop_oldest:
+            if (buffer.ring.push_overwrite(e)) {
+                inst.request_drain();
+                count_dropped(buffer);
+            }
+            return true;
+        default:
+            if (!buffer.ring.try_push(e)) {
+                inst.request_drain();
+                pushed = false;
+            }
+            break;
+        }
+
+        if (!pushed)
+            count_dropped(buffer);
+        return pushed;
+    }
+
+    static void
+    count_dropped(detail::thread_buffer& buffer) noexcept {
+        buffer.dropped.store(
+            buffer.dropped.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+    }
+
+    // Hands out the index of a thread which no session can hold the events of
+    // anymore before making up a new one, so a process which keeps starting
+    // short lived threads never runs out of them. Should the indices still run
+    // out, such as under a flight recorder left running, the last one is
+    // shared rather than wrapping around onto a live thread. Expects the
+    // buffers mutex to be held.
+    thread_index_t
+    acquire_thread_index() noexcept {
+        if (!free_thread_indices_.empty()) {
+            auto index = free_thread_indices_.back();
+            free_thread_indices_.pop_back();
+
+            // The new thread starts out without the name of the last one.
+            thread_registry::name(index, { });
+            return index;
+        }
+
+        if (next_thread_index_ == k_shared_thread_index)
+            return next_thread_index_;
+        return next_thread_index_++;
+    }
+
+    // Holds the index of a thread which exited until every session that may
+    // have its events is retired. Expects the buffers mutex to be held.
+    void
+    release_thread_index(thread_index_t index) noexcept {
+        if (sessions_.empty()) {
+            free_thread_indices_.push_back(index);
+            return;
+        }
+
+        for (const auto& entry : sessions_)
+            entry->exited_threads.push_back(index);
+        held_thread_indices_[index] = sessions_.size();
+    }
+
+    // Expects the buffers mutex to be held.
+    std::uint64_t
+    total_dropped() const noexcept {
+        auto total = retired_dropped_ +
+            unbuffered_dropped_.load(std::memory_order_relaxed);
+        for (auto buffer : buffers_)
+            total += buffer->dropped.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    std::size_t
+    wake_threshold() const noexcept {
+        constexpr auto high_water = k_buffer_capacity / 4 * 3;
+        if (defer_drain.load(std::memory_order_relaxed))
+            return high_water;
+
+        auto threshold = drain_threshold.load(std::memory_order_relaxed);
+        return std::clamp<std::size_t>(threshold, 1, high_water);
+    }
+
+    void
+    request_drain() noexcept {
+        // Avoid making the system call if the profiler was already asked.
+        if (drain_requested_.exchange(true, std::memory_order_relaxed))
+            return;
+        check_events_.notify_one();
+    }
+
     bool
     should_drain_events() const noexcept {
-        auto deferred = running_ && defer_drain;
-        return !event_queue_.empty() || !deferred;
+        return !running_.load(std::memory_order_relaxed) ||
+               drain_requested_.load(std::memory_order_relaxed);
+    }
+
+    void
+    record_statistics(
+        detail::thread_buffer& buffer,
+        const event_variant_t& e
+    ) noexcept {
+        auto timing = std::get_if<timing_event>(&e);
+        if (timing == nullptr)
+            return;
+
+        auto duration = timing->duration;
+        if (timing->flags & event_flags::raw_ticks)
+            duration = static_cast<tick_t>(static_cast<double>(duration) *
+                tick_rate_.load(std::memory_order_relaxed));
+
+        buffer.statistics.record(
+            generation_.load(std::memory_order_relaxed),
+            timing->name,
+            static_cast<std::uint64_t>(
+                std::max<std::int64_t>(to_nanoseconds(duration), 0)));
+    }
+
+    void
+    normalize_event(event_variant_t& e) const noexcept {
+        std::visit([this](auto& arg) {
+            if (!(arg.flags & event_flags::raw_ticks))
+                return;
+
+            using T = std::decay_t<decltype(arg)>;
+            if constexpr (std::is_same_v<T, timing_event>) {
+                arg.start    = calibration_.time(arg.start);
+                arg.duration = calibration_.duration(arg.duration);
+            } else {
+                arg.when = calibration_.time(arg.when);
+            }
+
+            arg.flags &= ~event_flags::raw_ticks;
+        }, e);
     }
 
     void
     drain_event_queue() noexcept {
-        while (!event_queue_.empty()) {
-            auto e = event_queue_.front();
-            event_queue_.pop();
-            update_timeline(e);
+        coarse_ticks_.store(
+            to_ticks(perf_clock_t::now()), std::memory_order_relaxed);
+        calibration_.refine();
+        tick_rate_.store(calibration_.rate(), std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(buffers_mutex_);
+        for (const auto& entry : sessions_) {
+            if (entry->stopping.load(std::memory_order_relaxed))
+                entry->drained = true;
+            if (!entry->deferred_events.empty())
+                retain_events(*entry, { });
+        }
+
+        auto it = buffers_.begin();
+        while (it != buffers_.end()) {
+            auto& buffer = **it;
+            auto retired = buffer.retired.load(std::memory_order_acquire);
+            event_queue_.clear();
+            auto collect = [this](event_variant_t&& e) {
+                normalize_event(e);
+                event_queue_.push_back(std::move(e));
+            };
+
+            // Whatever spilled before the ring is popped is newer than all of
+            // it, and whatever spills after is left for the next drain.
+            auto spilled = buffer.spill.pushed();
+            buffer.ring.pop(collect);
+            buffer.spill.pop(collect, spilled - buffer.spill.popped());
+
+            if (!event_queue_.empty()) {
+                for (const auto& entry : sessions_)
+                    update_session(*entry, buffer.index, event_queue_);
+            }
+
+            // The owning thread is gone and will never push again.
+            if (!retired || !buffer.ring.empty() || !buffer.spill.empty()) {
+                ++it;
+                continue;
+            }
+
+            retired_dropped_ += buffer.dropped.load(std::memory_order_relaxed);
+
+            buffer.statistics.merge_into(
+                generation_.load(std::memory_order_relaxed),
+                retired_statistics_);
+            for (const auto& entry : sessions_)
+                retire_history(*entry, buffer.index);
+            release_thread_index(buffer.index);
+            delete *it;
+            it = buffers_.erase(it);
         }
-    }    
+    }
 
     void
     profile() noexcept {
-        while (running_) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            auto fn = std::mem_fn(&profiler::should_drain_events);
-            check_events_.wait(lock, std::bind(fn, this));
+        event_queue_.reserve(k_buffer_capacity);
+        while (running_.load(std::memory_order_relaxed)) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                auto fn = std::mem_fn(&profiler::should_drain_events);
+                if (defer_drain.load(std::memory_order_relaxed))
+                    check_events_.wait(lock, std::bind(fn, this));
+                else check_events_.wait_for(
+                    lock, drain_interval.load(std::memory_order_relaxed),
+                    std::bind(fn, this));
+                drain_requested_.store(false, std::memory_order_relaxed);
+            }
+
             drain_event_queue();
+            take_requested_snapshots();
+            retire_sessions();
+        }
+
+        // Collect whatever was recorded before the last session was stopped,
+        // and answer anyone still waiting on a snapshot.
+        drain_event_queue();
+        take_requested_snapshots();
+        retire_sessions();
+    }
+
+    // Expects the buffers mutex to be held.
+    std::shared_ptr<session>
+    find_session(std::string_view name) const noexcept {
+        for (const auto& entry : sessions_) {
+            if (entry->name == name)
+                return entry;
         }
+
+        return nullptr;
     }
 
+    // Expects the buffers mutex to be held.
     void
-    update_timeline(const event_variant_t& e) noexcept {
-        timeline_.push(e);
+    update_capture() noexcept {
+        std::uint8_t capture = 0;
+        auto overflow = static_cast<std::uint8_t>(overflow_policy::drop_newest);
+        std::size_t spill_limit = 0;
+        for (const auto& entry : sessions_) {
+            if (entry->stopping.load(std::memory_order_relaxed))
+                continue;
+
+            capture |= entry->capture;
+            overflow = std::min(overflow, entry->overflow);
+            if (entry->overflow == static_cast<std::uint8_t>(overflow_policy::spill))
+                spill_limit = std::max(spill_limit, entry->spill_events);
+        }
+
+        if (capture == 0)
+            overflow = static_cast<std::uint8_t>(overflow_policy::block);
+        capture_.store(capture, std::memory_order_relaxed);
+        overflow_.store(overflow, std::memory_order_relaxed);
+        spill_limit_.store(spill_limit, std::memory_order_relaxed);
+    }
+
+    // Expects the control mutex to be held.
+    timeline
+    stop(std::shared_ptr<session> entry) noexcept {
+        if (entry == nullptr)
+            return timeline{ };
+
+        bool last = false;
+        {
+            std::lock_guard<std::mutex> lock(buffers_mutex_);
+            entry->stopping.store(true, std::memory_order_relaxed);
+            update_capture();
+            last = sessions_.size() == 1;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (last) {
+                running_ = false;
+                active_categories_.store(0, std::memory_order_relaxed);
+            }
+            drain_requested_.store(true, std::memory_order_relaxed);
+        }
+
+        check_events_.notify_all();
+        if (last) {
+            if (event_thread_.joinable())
+                event_thread_.join();
+        } else {
+            std::unique_lock<std::mutex> lock(mutex_);
+            sessions_changed_.wait(lock, [&entry]() {
+                return entry->stopped;
+            });
+        }
+
+        // The profiling thread is done with the session, but an inspection
+        // of it may still be running.
+        std::lock_guard<std::mutex> lock(entry->events_mutex);
+        entry->events.push(std::span<const event_variant_t>(
+            entry->deferred_events));
+        complete_timeline(*entry, entry->events);
+        entry->events.set_thread_names(std::move(entry->thread_names));
+        return std::move(entry->events);
+    }
+
+    void
+    update_session(
+        session& entry,
+        thread_index_t thread,
+        std::span<const event_variant_t> events
+    ) noexcept {
+        if (!(entry.capture & static_cast<std::uint8_t>(capture_mode::events)))
+            return;
+
+        // Leave out what was still waiting in the buffer from before the
+        // session started.
+        auto first = std::find_if(events.begin(), events.end(),
+            [&entry](const event_variant_t& e) {
+                return detail::event_end(e) >= entry.started;
+            });
+        events = events.subspan(first - events.begin());
+        if (events.empty())
+            return;
+        if (entry.sink != nullptr)
+            entry.sink->consume(events);
+        for (const auto& subscriber : entry.subscribers)
+            subscriber->consume(events);
+        if (entry.flight_recorder_events != 0) {
+            auto& history = entry.histories[thread];
+            for (const auto& e : events)
+                keep_history(entry, history, e);
+        } else if (entry.retain_events) {
+            retain_events(entry, events);
+        }
+    }
+
+    void
+    retain_events(
+        session& entry,
+        std::span<const event_variant_t> events
+    ) noexcept {
+        std::unique_lock<std::mutex> lock(entry.events_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            entry.deferred_events.insert(
+                entry.deferred_events.end(), events.begin(), events.end());
+            return;
+        }
+
+        if (!entry.deferred_events.empty()) {
+            entry.events.push(std::span<const event_variant_t>(
+                entry.deferred_events));
+            entry.deferred_events.clear();
+        }
+
+        entry.events.push(events);
+    }
+
+    void
+    keep_history(
+        const session& entry,
+        detail::history_ring<event_variant_t>& history,
+        const event_variant_t& e
+    ) noexcept {
+        if (history.capacity() != entry.flight_recorder_events)
+            history.reset(entry.flight_recorder_events);
+        history.push(e);
+    }
+
+    void
+    retire_history(session& entry, thread_index_t thread) noexcept {
+        auto it = entry.histories.find(thread);
+        if (it == entry.histories.end())
+            return;
+
+        it->second.for_each([this, &entry](const event_variant_t& e) {
+            keep_history(entry, entry.retired_history, e);
+        });
+        entry.histories.erase(it);
+    }
+
+    // Expects the buffers mutex to be held.
+    timeline
+    collect_history(const session& entry, tick_t cutoff) noexcept {
+        timeline result(entry.storage);
+        auto collect = [this, &result, cutoff](
+            const detail::history_ring<event_variant_t>& history
+        ) {
+            event_queue_.clear();
+            history.for_each([this, cutoff](const event_variant_t& e) {
+                if (detail::event_end(e) >= cutoff)
+                    event_queue_.push_back(e);
+            });
+
+            if (!event_queue_.empty())
+                result.push(event_queue_);
+        };
+
+        collect(entry.retired_history);
+        for (const auto& [thread, history] : entry.histories)
+            collect(history);
+        return result;
+    }
+
+    void
+    complete_timeline(const session& entry, timeline& result) noexcept {
+        if (entry.capture & static_cast<std::uint8_t>(capture_mode::statistics))
+            result.set_statistics(statistics());
+
+        sampling_weight_map weights;
+        sampling_weights_.for_each(
+            [&weights](name_id_t name, const weight_slot& weight) {
+                auto events = weight.events.load(std::memory_order_relaxed);
+                if (events != 0)
+                    weights.emplace(name, weight.total.load(
+                        std::memory_order_relaxed) / static_cast<double>(events));
+            });
+        result.set_sampling_weights(std::move(weights));
+
+        std::lock_guard<std::mutex> lock(buffers_mutex_);
+        result.set_dropped_events(total_dropped() - entry.dropped_before);
+    }
+
+    void
+    take_requested_snapshots() noexcept {
+        auto requested = snapshot_window_.exchange(0, std::memory_order_relaxed);
+        auto now = to_ticks(perf_clock_t::now());
+        std::vector<std::pair<std::shared_ptr<session>, timeline>> taken;
+        {
+            std::lock_guard<std::mutex> lock(buffers_mutex_);
+            for (const auto& entry : sessions_) {
+                auto window = entry->snapshot_window.exchange(
+                    0, std::memory_order_relaxed);
+                if (window == 0 && entry->flight_recorder_events != 0)
+                    window = requested;
+                if (window == 0)
+                    continue;
+
+                auto span = std::chrono::duration_cast<perf_clock_t::duration>(
+                    std::chrono::nanoseconds{ window }).count();
+                auto cutoff = span >= now ? std::numeric_limits<tick_t>::min()
+                                          : now - span;
+                taken.emplace_back(entry, collect_history(*entry, cutoff));
+                taken.back().second.set_thread_names(thread_registry::snapshot());
+            }
+        }
+
+        if (taken.empty())
+            return;
+
+        for (auto& [entry, result] : taken)
+            complete_timeline(*entry, result);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& [entry, result] : taken) {
+                entry->pending_snapshot = std::move(result);
+                entry->snapshots_taken++;
+            }
+        }
+        sessions_changed_.notify_all();
+    }
+
+    void
+    retire_sessions() noexcept {
+        std::vector<std::shared_ptr<session>> retiring;
+        {
+            std::lock_guard<std::mutex> lock(buffers_mutex_);
+            auto it = sessions_.begin();
+            while (it != sessions_.end()) {
+                auto& entry = **it;
+                if (!entry.drained) {
+                    ++it;
+                    continue;
+                }
+
+                if (entry.flight_recorder_events != 0) {
+                    entry.events = collect_history(
+                        entry, std::numeric_limits<tick_t>::min());
+                    entry.histories.clear();
+                    entry.retired_history.reset(0);
+                }
+
+                // The names are copied before any of the indices can go to
+                // another thread.
+                entry.thread_names = thread_registry::snapshot();
+                for (auto index : entry.exited_threads) {
+                    auto held = held_thread_indices_.find(index);
+                    if (held == held_thread_indices_.end() || --held->second != 0)
+                        continue;
+                    held_thread_indices_.erase(held);
+                    free_thread_indices_.push_back(index);
+                }
+
+                retiring.push_back(std::move(*it));
+                it = sessions_.erase(it);
+            }
+        }
+
+        if (retiring.empty())
+            return;
+
+        for (const auto& entry : retiring) {
+            if (entry->sink != nullptr) {
+                entry->sink->flush();
+                entry->sink.reset();
+            }
+
+            for (const auto& subscriber : entry->subscribers)
+                subscriber->flush();
+            entry->subscribers.clear();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& entry : retiring)
+                entry->stopped = true;
+        }
+        sessions_changed_.notify_all();
     }
 
 private:
-    std::queue<event_variant_t> event_queue_;
+    std::vector<event_variant_t> event_queue_;
+    detail::nothrow_vector<detail::thread_buffer*> buffers_;
+    std::vector<std::shared_ptr<session>> sessions_;
+    std::mutex buffers_mutex_;
+    std::mutex control_mutex_;
     std::condition_variable check_events_;
-    timeline timeline_;
+    std::condition_variable sessions_changed_;
+    clock_calibration calibration_;
+    std::atomic<std::int64_t> snapshot_window_{0};
+    statistics_map retired_statistics_;
     std::mutex mutex_;
     std::thread event_thread_;
-    std::string session_name_;
     std::atomic<bool> running_{false};
+    std::atomic<bool> drain_requested_{false};
+    thread_index_t next_thread_index_{ 0 };
+    std::vector<thread_index_t> free_thread_indices_;
+    std::unordered_map<thread_index_t, std::size_t> held_thread_indices_;
+    std::atomic<std::uint8_t> capture_{1};
+    std::atomic<std::uint8_t> overflow_{0};
+    std::atomic<std::size_t> spill_limit_{0};
+    std::uint64_t retired_dropped_{0};
+    std::atomic<std::uint64_t> unbuffered_dropped_{0};
+    std::atomic<std::uint64_t> generation_{0};
+    std::atomic<double> tick_rate_{1.0};
+    std::atomic<tick_t> coarse_ticks_{0};
+    category_t enabled_categories_{ categories::defaults };
+    static inline std::atomic<category_t> active_categories_{0};
+    detail::atomic_name_table<weight_slot> sampling_weights_;
 };
 
 } // namespace malunal::perf
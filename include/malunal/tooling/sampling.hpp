@@ -0,0 +1,335 @@
+/// @file   sampling.hpp
+/// @brief  Contains the sampled probes and the samplers which decide for them.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+namespace detail {
+
+/// @brief   Describes an object which decides whether a probe should record.
+/// @details A sampler is asked before the probe reads any clock, so skipping
+///          an event costs no more than the decision itself. Its weight is how
+///          many events each recorded one stands for, which lets aggregates be
+///          scaled back up afterwards.
+template<typename Sampler>
+concept ProbeSampler = requires(Sampler& sampler, const Sampler& csampler) {
+    { sampler.sample() } noexcept -> std::same_as<bool>;
+    { csampler.weight() } noexcept -> std::same_as<double>;
+};
+
+/// @brief   A counter which is spread over several cache lines, so threads
+///          incrementing it at the same time rarely touch the same line.
+struct sharded_counter final {
+    /// @brief   Increments the shard of the calling thread.
+    void
+    increment() noexcept {
+        auto index = profiler::thread_index() % k_shard_count;
+        shards_[index].value.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// @brief   Adds up the shards.
+    /// @returns The number of increments, across every thread.
+    std::uint64_t
+    load() const noexcept {
+        std::uint64_t total = 0;
+        for (const auto& shard : shards_)
+            total += shard.value.load(std::memory_order_relaxed);
+        return total;
+    }
+
+private:
+    static constexpr std::size_t k_shard_count = 16;
+
+    struct alignas(k_cache_line_size) shard final {
+        std::atomic<std::uint64_t> value{ 0 };
+    };
+
+    std::array<shard, k_shard_count> shards_{ };
+};
+
+} // namespace malunal::tooling::detail
+
+/// @brief   A sampler which records every Nth event.
+/// @details The sampler keeps a plain countdown, so it must not be shared
+///          between threads; declare it `static thread_local` where it's used,
+///          as `MALUNAL_TOOLING_MEASURE_SCOPE_EVERY` does. Each thread then
+///          records exactly one in every N of its own events.
+struct every_nth_sampler final {
+    /// @brief   Creates a sampler recording one in every given number of
+    ///          events.
+    /// @param   n How many events each recorded one stands for; values below
+    ///          one are taken as one.
+    explicit every_nth_sampler(std::uint32_t n) noexcept
+        : n_{ std::max<std::uint32_t>(n, 1) }
+    { }
+
+    /// @brief   Decides whether the current event should be recorded.
+    /// @returns True for the last of every N calls; false otherwise.
+    bool
+    sample() noexcept {
+        if (++count_ < n_)
+            return false;
+        count_ = 0;
+        return true;
+    }
+
+    /// @brief   Gets how many events each recorded one stands for.
+    /// @returns The sampling interval.
+    double
+    weight() const noexcept {
+        return static_cast<double>(n_);
+    }
+
+private:
+    std::uint32_t n_;
+    std::uint32_t count_{ 0 };
+};
+
+/// @brief   A sampler which records each event with a fixed probability.
+/// @details The decision comes from a xorshift generator kept by each thread,
+///          so the sampler itself is never written to and can be shared
+///          between threads freely. Unlike `every_nth_sampler`, the recorded
+///          events can't line up with a periodic pattern in the workload.
+struct probability_sampler final {
+    /// @brief   Creates a sampler recording events with the given probability.
+    /// @param   probability The chance of each event being recorded, clamped
+    ///          between one in four billion and one.
+    explicit probability_sampler(double probability) noexcept
+        : probability_{ std::clamp(probability, 0x1p-32, 1.0) }
+        , threshold_{ static_cast<std::uint64_t>(
+              std::ldexp(probability_, 32)) }
+    { }
+
+    /// @brief   Decides whether the current event should be recorded.
+    /// @returns True with the probability of the sampler; false otherwise.
+    bool
+    sample() const noexcept {
+        return (next() >> 32) < threshold_;
+    }
+
+    /// @brief   Gets how many events each recorded one stands for.
+    /// @returns The inverse of the probability.
+    double
+    weight() const noexcept {
+        return 1.0 / probability_;
+    }
+
+private:
+    static std::uint64_t
+    next() noexcept {
+        // Seeded from the address of the state so each thread gets its own
+        // sequence; the state can never be zero since it's an address.
+        thread_local std::uint64_t state =
+            reinterpret_cast<std::uintptr_t>(&state) * 0x9e3779b97f4a7c15ull | 1;
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545f4914f6cdd1dull;
+    }
+
+private:
+    double probability_;
+    std::uint64_t threshold_;
+};
+
+/// @brief   A sampler which records at most a given number of events per
+///          second.
+/// @details Implements a token bucket shared by every thread using it, so
+///          declare it `static` where it's used, one per name. The bucket is
+///          refilled from `profiler::coarse_now`, instead of reading a clock,
+///          and once it is empty, every call costs a few relaxed loads. The
+///          number of calls and recorded events is counted to estimate the
+///          weight, on counters spread across cache lines to keep threads from
+///          contending on them. The weight is worked out again on every
+///          refill, so it follows the rate of calls as it changes, and each
+///          recorded event is noted with the weight of its own interval.
+/// @remarks The bucket is only refilled as often as the profiling thread
+///          wakes, so with a deferred drain the rate will lag behind.
+struct token_bucket_sampler final {
+    /// @brief   Creates a sampler recording up to the given rate of events.
+    /// @param   per_second The number of events that may be recorded each
+    ///          second, on average.
+    /// @param   burst The number of events that may be recorded at once after
+    ///          a quiet period; defaults to the rate, at least one.
+    explicit token_bucket_sampler(double per_second, double burst = 0.0) noexcept
+        : per_tick_{ std::max(per_second, 0.0) * k_unit *
+              static_cast<double>(perf_clock_t::period::num) /
+              static_cast<double>(perf_clock_t::period::den) }
+        , burst_{ static_cast<std::int64_t>(
+              std::max(burst > 0.0 ? burst : per_second, 1.0) * k_unit) }
+        , tokens_{ burst_ }
+    { }
+
+    /// @brief   Decides whether the current event should be recorded.
+    /// @returns True if the bucket had a token for the event; false otherwise.
+    bool
+    sample() noexcept {
+        attempts_.increment();
+        refill();
+        if (tokens_.load(std::memory_order_relaxed) < k_unit)
+            return false;
+        if (tokens_.fetch_sub(k_unit, std::memory_order_relaxed) < k_unit) {
+            tokens_.fetch_add(k_unit, std::memory_order_relaxed);
+            return false;
+        }
+
+        accepted_.increment();
+        return true;
+    }
+
+    /// @brief   Gets how many events each recorded one stands for, lately.
+    /// @returns The number of calls divided by the number of recorded events,
+    ///          between the last two refills that recorded any; one before
+    ///          then.
+    double
+    weight() const noexcept {
+        return weight_.load(std::memory_order_relaxed);
+    }
+
+private:
+    /// @brief The number of units in one token; fractions of a token are kept
+    ///        so slow rates still refill.
+    static constexpr std::int64_t k_unit = 1 << 20;
+
+    void
+    refill() noexcept {
+        auto now  = profiler::coarse_now();
+        auto last = last_.load(std::memory_order_relaxed);
+        if (now <= last)
+            return;
+
+        // Only the thread that moves the refill time forward adds the tokens.
+        if (!last_.compare_exchange_strong(last, now, std::memory_order_relaxed))
+            return;
+        if (last == 0)
+            return;
+
+        auto added = static_cast<std::int64_t>(
+            static_cast<double>(now - last) * per_tick_);
+        auto tokens = tokens_.load(std::memory_order_relaxed);
+        while (!tokens_.compare_exchange_weak(tokens,
+            std::min(tokens + added, burst_), std::memory_order_relaxed)) { }
+
+        // Intervals that recorded nothing are folded into the next one, so a
+        // slow rate doesn't swing the weight from one refill to the next. The
+        // shards aren't read at once, so a refill racing another may see the
+        // counters behind its marks.
+        auto accepted = accepted_.load();
+        auto mark = accepted_mark_.load(std::memory_order_relaxed);
+        if (accepted <= mark)
+            return;
+
+        auto attempts = attempts_.load();
+        auto previous = attempts_mark_.exchange(
+            attempts, std::memory_order_relaxed);
+        accepted_mark_.store(accepted, std::memory_order_relaxed);
+        auto calls = attempts > previous ? attempts - previous : 0;
+        weight_.store(std::max(static_cast<double>(calls) /
+            static_cast<double>(accepted - mark), 1.0),
+            std::memory_order_relaxed);
+    }
+
+private:
+    double per_tick_;
+    std::int64_t burst_;
+    alignas(detail::k_cache_line_size) std::atomic<std::int64_t> tokens_;
+    std::atomic<tick_t> last_{ 0 };
+    detail::sharded_counter attempts_;
+    detail::sharded_counter accepted_;
+    std::atomic<std::uint64_t> attempts_mark_{ 0 };
+    std::atomic<std::uint64_t> accepted_mark_{ 0 };
+    std::atomic<double> weight_{ 1.0 };
+};
+
+/// @brief   A deferred timing probe which only records the events its sampler
+///          chooses.
+/// @details The sampler is asked before the clock is read, so a skipped event
+///          costs only the decision. Recorded events are flagged as sampled,
+///          and the weight of the sampler is noted with the profiler, so the
+///          timeline can tell how many events each one stands for.
+/// @tparam  Sampler The type of the sampler deciding which events to record.
+/// @tparam  Clock The clock source the probe reads time from.
+template<
+    detail::ProbeSampler Sampler,
+    detail::ClockSource Clock = default_clock_source
+>
+struct sampled_timing_probe final {
+    /// @brief   Creates a new instance of the probe and, if the sampler chooses
+    ///          to record it, grabs the start time for the probe.
+    /// @param   sampler The sampler which decides whether to record.
+    /// @param   name The interned name of this timing probe.
+    /// @param   category The categories this probe is filed under; the sampler
+    ///          is only asked if one of them is enabled.
+    sampled_timing_probe(
+        Sampler& sampler,
+        name_id_t name,
+        category_t category = categories::general
+    ) noexcept
+        : sampler_{ choose(sampler, category) }
+        , name_{ name }
+        , start_{ sampler_ != nullptr ? Clock::now() : 0 }
+    { }
+
+    /// @brief   Creates a new instance of the probe and, if the sampler chooses
+    ///          to record it, grabs the start time for the probe.
+    /// @param   sampler The sampler which decides whether to record.
+    /// @param   name The name of this timing probe; it is only interned if the
+    ///          event is recorded.
+    /// @param   category The categories this probe is filed under; the sampler
+    ///          is only asked if one of them is enabled.
+    sampled_timing_probe(
+        Sampler& sampler,
+        std::string_view name,
+        category_t category = categories::general
+    ) noexcept
+        : sampler_{ choose(sampler, category) }
+        , name_{ sampler_ != nullptr ? name_registry::intern(name) : 0 }
+        , start_{ sampler_ != nullptr ? Clock::now() : 0 }
+    { }
+
+    sampled_timing_probe(const sampled_timing_probe&) = delete;
+    sampled_timing_probe& operator=(const sampled_timing_probe&) = delete;
+
+    /// @brief   Grabs the end time and provides the timing event to the
+    ///          profiler, if the event was chosen to be recorded.
+    ~sampled_timing_probe() noexcept {
+        if (sampler_ == nullptr)
+            return;
+
+        // Pull this immediately to correctly represent timing.
+        auto end_ = Clock::now();
+        profiler::note_sampling_weight(name_, sampler_->weight());
+        profiler::record_event(timing_event {
+            .name     = name_,
+            .tid      = profiler::thread_index(),
+            .flags    = static_cast<std::uint16_t>(
+                Clock::k_flags | event_flags::sampled),
+            .start    = start_,
+            .duration = end_ - start_
+        });
+    }
+
+    /// @brief   Checks whether this probe is recording its event.
+    /// @returns True if the sampler chose to record; false otherwise.
+    bool
+    sampled() const noexcept {
+        return sampler_ != nullptr;
+    }
+
+private:
+    static Sampler*
+    choose(Sampler& sampler, category_t category) noexcept {
+        if (!profiler::enabled(category) || !sampler.sample())
+            return nullptr;
+        return &sampler;
+    }
+
+private:
+    Sampler* sampler_;
+    name_id_t name_;
+    tick_t start_;
+};
+
+} // namespace malunal::tooling
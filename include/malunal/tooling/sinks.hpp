@@ -0,0 +1,93 @@
+/// @file   sinks.hpp
+/// @brief  Contains the interface for sinks that receive events while a
+///         session of the performance tooling is running.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+
+/// @brief   Receives batches of events from the profiling thread as they are
+///          drained from the thread buffers.
+/// @details A sink is given to the profiler as part of the `session_options`.
+///          It lets a session stream its events somewhere, such as a file,
+///          while the session is running, rather than holding all of them in
+///          the timeline until the session stops. Sinks are only ever called
+///          from the profiling thread, so they don't need to synchronize.
+struct event_sink {
+    virtual ~event_sink() noexcept = default;
+
+    /// @brief   Receives a batch of events.
+    /// @details The events have already been normalized, so their time stamps
+    ///          are all `perf_clock_t` ticks. The span is only valid for the
+    ///          duration of the call.
+    /// @param   events The batch of events drained from one thread buffer.
+    virtual void
+    consume(std::span<const event_variant_t> events) noexcept = 0;
+
+    /// @brief   Writes out anything the sink is still holding on to.
+    /// @details Called when the session stops. Sinks which batch up events
+    ///          before writing them should write them here.
+    virtual void
+    flush() noexcept { }
+};
+
+/// @brief   A sink which visits every event it receives, so a visitor can
+///          analyze a session while it is still running.
+/// @details Subscribe one to a running session with `profiler::subscribe`, or
+///          give it to the session as its sink. The visitor is fed batches of
+///          newly drained events on the profiling thread, under a lock which
+///          `read` and `take` also hold, so other threads can look at what it
+///          has found so far at any time. Keep the visitor cheap, since the
+///          profiling thread visits every event before draining the next
+///          batch.
+/// @tparam  Visitor The type of the visitor.
+template<detail::TimelineVisitor Visitor>
+struct visitor_sink final : event_sink {
+    /// @brief   Creates the sink and the visitor it feeds.
+    /// @param   args The arguments the visitor is constructed with.
+    template<typename... Args>
+    explicit visitor_sink(Args&&... args) noexcept
+        : visitor_(std::forward<Args>(args)...)
+    { }
+
+    /// @brief   Visits each of the given events.
+    /// @param   events The batch of events drained from one thread buffer.
+    void
+    consume(std::span<const event_variant_t> events) noexcept override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& e : events)
+            visitor_.visit(e);
+    }
+
+    /// @brief   Gives the visitor to the given function, while no events are
+    ///          being visited.
+    /// @tparam  Function The type of the function.
+    /// @param   function Called with an immutable reference to the visitor.
+    /// @returns Whatever the function returns.
+    template<typename Function>
+    decltype(auto)
+    read(Function&& function) const noexcept {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return std::forward<Function>(function)(visitor_);
+    }
+
+    /// @brief   Takes the visitor out of the sink, replacing it with a new one.
+    /// @details Taking the visitor on a fixed interval gives the results of
+    ///          each interval on its own, such as the latency percentiles of
+    ///          every scope over the last second.
+    /// @returns The visitor, holding everything visited since it was created
+    ///          or last taken.
+    Visitor
+    take() noexcept requires std::is_default_constructible_v<Visitor> {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return std::exchange(visitor_, Visitor{ });
+    }
+
+private:
+    mutable std::mutex mutex_;
+    Visitor visitor_;
+};
+
+} // namespace malunal::tooling
@@ -0,0 +1,190 @@
+/// @file   static_probes.hpp
+/// @brief  Contains the probes whose name and behavior are fixed at compile
+///         time.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+
+/// @brief   A string literal which can be given as a template argument.
+/// @tparam  N The size of the literal, including its terminator.
+template<std::size_t N>
+struct fixed_string final {
+    /// @brief   Copies the given string literal.
+    /// @param   literal The string literal.
+    consteval fixed_string(const char (&literal)[N]) noexcept {
+        std::copy_n(literal, N, data);
+    }
+
+    /// @brief   Gets the string, without its terminator.
+    /// @returns A view of the string.
+    constexpr std::string_view
+    view() const noexcept {
+        return std::string_view{ data, N - 1 };
+    }
+
+    /// @brief   The characters of the literal, including its terminator.
+    char data[N]{ };
+};
+
+/// @brief   Determines what a static probe does with its measurements.
+enum class probe_storage : std::uint8_t {
+    /// @brief   Each measurement is recorded as a timing event.
+    events,
+
+    /// @brief   Each measurement only updates the statistics of its name, and
+    ///          is never pushed into the thread buffer.
+    /// @details Nothing is kept unless a running session captures statistics.
+    statistics
+};
+
+/// @brief   A sampler which records every event, which static probes leave out
+///          entirely.
+struct unsampled final {
+    bool
+    sample() noexcept {
+        return true;
+    }
+
+    double
+    weight() const noexcept {
+        return 1.0;
+    }
+};
+
+/// @brief   A sampler recording every Nth event, whose interval is fixed at
+///          compile time so static probes can construct it themselves.
+/// @tparam  N How many events each recorded one stands for.
+template<std::uint32_t N>
+struct fixed_every_nth_sampler final {
+    bool
+    sample() noexcept {
+        return sampler_.sample();
+    }
+
+    double
+    weight() const noexcept {
+        return sampler_.weight();
+    }
+
+private:
+    every_nth_sampler sampler_{ N };
+};
+
+/// @brief   Chooses how a static probe stores, times, and samples its
+///          measurements, all at compile time.
+/// @tparam  Storage What the probe does with its measurements.
+/// @tparam  Clock The clock source the probe reads time from.
+/// @tparam  Sampler A default constructible sampler deciding which events to
+///          record; each thread gets its own for every probe.
+template<
+    probe_storage Storage = probe_storage::events,
+    detail::ClockSource Clock = default_clock_source,
+    detail::ProbeSampler Sampler = unsampled
+>
+struct probe_policy final {
+    static constexpr probe_storage k_storage = Storage;
+    using clock_type = Clock;
+    using sampler_type = Sampler;
+};
+
+namespace detail {
+
+/// @brief   Interns the given name before `main` is entered.
+/// @details Every probe of the same name shares the identifier, which is
+///          read like any other global once the program is running.
+/// @tparam  Name The name that should be interned.
+template<fixed_string Name>
+struct static_name final {
+    inline static const name_id_t k_id = name_registry::intern(Name.view());
+};
+
+} // namespace malunal::tooling::detail
+
+/// @brief   A deferred timing probe whose name and behavior are fixed at
+///          compile time.
+/// @details The name is interned before `main`, and the storage, clock and
+///          sampling are chosen by the policy, so an enabled probe which
+///          isn't sampled costs a category check, two clock reads and a single
+///          push into the thread buffer. Decisions the other probes make at
+///          run time are all compiled away.
+/// @tparam  Name The name of the probe, given as a string literal.
+/// @tparam  Policy The `probe_policy` of the probe.
+template<fixed_string Name, typename Policy = probe_policy<>>
+struct static_timing_probe final {
+    using clock_type = typename Policy::clock_type;
+    using sampler_type = typename Policy::sampler_type;
+
+    /// @brief   Creates a new instance of the probe and grabs the start time
+    ///          for the probe, if it records.
+    /// @param   category The categories this probe is filed under; it only
+    ///          records if one of them is enabled when it is created.
+    explicit static_timing_probe(
+        category_t category = categories::general
+    ) noexcept
+        : active_{ choose(category) }
+        , start_{ active_ ? clock_type::now() : 0 }
+    { }
+
+    static_timing_probe(const static_timing_probe&) = delete;
+    static_timing_probe& operator=(const static_timing_probe&) = delete;
+
+    /// @brief   Grabs the end time and records the measurement, if the probe
+    ///          records.
+    ~static_timing_probe() noexcept {
+        if (!active_)
+            return;
+
+        // Pull this immediately to correctly represent timing.
+        auto end_ = clock_type::now();
+        constexpr auto k_flags = static_cast<std::uint16_t>(
+            clock_type::k_flags | (k_sampled ? event_flags::sampled : 0));
+        timing_event timing {
+            .name     = detail::static_name<Name>::k_id,
+            .tid      = profiler::thread_index(),
+            .flags    = k_flags,
+            .start    = start_,
+            .duration = end_ - start_
+        };
+
+        if constexpr (k_sampled)
+            profiler::note_sampling_weight(timing.name, sampler().weight());
+        if constexpr (Policy::k_storage == probe_storage::statistics)
+            profiler::record_statistics(timing);
+        else profiler::record_event(timing);
+    }
+
+    /// @brief   Gets the identifier the name of this probe was interned as.
+    /// @returns The identifier of the name.
+    static name_id_t
+    name() noexcept {
+        return detail::static_name<Name>::k_id;
+    }
+
+private:
+    static constexpr bool k_sampled =
+        !std::is_same_v<sampler_type, unsampled>;
+
+    static sampler_type&
+    sampler() noexcept {
+        static thread_local sampler_type k_sampler{ };
+        return k_sampler;
+    }
+
+    static bool
+    choose(category_t category) noexcept {
+        if (!profiler::enabled(category))
+            return false;
+        if constexpr (k_sampled)
+            return sampler().sample();
+        return true;
+    }
+
+private:
+    bool active_;
+    tick_t start_;
+};
+
+} // namespace malunal::tooling
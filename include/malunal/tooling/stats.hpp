@@ -0,0 +1,344 @@
+/// @file   stats.hpp
+/// @brief  Contains the aggregated statistics of the performance tooling.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+
+/// @brief   A histogram of latencies with logarithmically sized buckets.
+/// @details Every power of two is split into eight linear buckets, so any
+///          recorded value can be recovered to within 12.5 percent, while the
+///          whole range from a nanosecond to more than a day only needs a few
+///          hundred buckets. Values are expected to be in nanoseconds.
+struct latency_histogram final {
+    /// @brief   The number of linear buckets each power of two is split into,
+    ///          as a power of two.
+    static constexpr std::uint32_t k_sub_bucket_bits = 3;
+
+    /// @brief   The number of linear buckets each power of two is split into.
+    static constexpr std::uint32_t k_sub_buckets = 1 << k_sub_bucket_bits;
+
+    /// @brief   The highest power of two that has its own buckets; larger
+    ///          values are counted in the last bucket.
+    static constexpr std::uint32_t k_max_exponent = 47;
+
+    /// @brief   The number of buckets in the histogram.
+    static constexpr std::uint32_t k_bucket_count =
+        (k_max_exponent - k_sub_bucket_bits + 2) * k_sub_buckets;
+
+    /// @brief   Gets the bucket the given value is counted in.
+    /// @param   value The value, in nanoseconds.
+    /// @returns The index of the bucket.
+    static constexpr std::uint32_t
+    bucket_of(std::uint64_t value) noexcept {
+        if (value < k_sub_buckets)
+            return static_cast<std::uint32_t>(value);
+
+        auto exponent = static_cast<std::uint32_t>(std::bit_width(value)) - 1;
+        if (exponent > k_max_exponent)
+            return k_bucket_count - 1;
+
+        auto shift = exponent - k_sub_bucket_bits;
+        auto mantissa = static_cast<std::uint32_t>(value >> shift) &
+                        (k_sub_buckets - 1);
+        return (shift + 1) * k_sub_buckets + mantissa;
+    }
+
+    /// @brief   Gets the smallest value counted in the given bucket.
+    /// @param   bucket The index of the bucket.
+    /// @returns The lower bound of the bucket, in nanoseconds.
+    static constexpr std::uint64_t
+    lower_bound(std::uint32_t bucket) noexcept {
+        if (bucket < k_sub_buckets)
+            return bucket;
+
+        auto shift = bucket / k_sub_buckets - 1;
+        auto mantissa = bucket % k_sub_buckets;
+        return std::uint64_t{ k_sub_buckets + mantissa } << shift;
+    }
+
+    /// @brief   Gets the largest value counted in the given bucket.
+    /// @param   bucket The index of the bucket.
+    /// @returns The upper bound of the bucket, in nanoseconds.
+    static constexpr std::uint64_t
+    upper_bound(std::uint32_t bucket) noexcept {
+        if (bucket + 1 >= k_bucket_count)
+            return std::numeric_limits<std::uint64_t>::max();
+        return lower_bound(bucket + 1) - 1;
+    }
+
+    /// @brief   Counts the given value.
+    /// @param   value The value, in nanoseconds.
+    /// @param   count How many times the value should be counted.
+    void
+    record(std::uint64_t value, std::uint64_t count = 1) noexcept {
+        buckets[bucket_of(value)] += count;
+        total += count;
+    }
+
+    /// @brief   Adds the counts of the other histogram to this one.
+    /// @param   other The histogram that should be merged in.
+    void
+    merge(const latency_histogram& other) noexcept {
+        for (std::uint32_t i = 0; i < k_bucket_count; i++)
+            buckets[i] += other.buckets[i];
+        total += other.total;
+    }
+
+    /// @brief   Estimates the value at the given percentile.
+    /// @details The estimate is the midpoint of the bucket the percentile
+    ///          falls into.
+    /// @param   percentile The percentile, between 0 and 100.
+    /// @returns The estimated value, in nanoseconds, or zero if nothing was
+    ///          counted.
+    std::uint64_t
+    percentile(double percentile) const noexcept {
+        if (total == 0)
+            return 0;
+
+        auto clamped = std::clamp(percentile, 0.0, 100.0) / 100.0;
+        auto rank = static_cast<std::uint64_t>(
+            std::ceil(clamped * static_cast<double>(total)));
+        rank = std::max<std::uint64_t>(rank, 1);
+
+        std::uint64_t seen = 0;
+        for (std::uint32_t i = 0; i < k_bucket_count; i++) {
+            seen += buckets[i];
+            if (seen < rank)
+                continue;
+
+            auto low  = lower_bound(i);
+            auto high = i + 1 < k_bucket_count ? upper_bound(i) : low;
+            return low + (high - low) / 2;
+        }
+
+        return lower_bound(k_bucket_count - 1);
+    }
+
+    /// @brief   The number of values counted in each bucket.
+    std::array<std::uint64_t, k_bucket_count> buckets{ };
+
+    /// @brief   The number of values counted in total.
+    std::uint64_t total{ 0 };
+};
+
+/// @brief   The aggregated statistics of every event with the same name.
+/// @details All of the times are in nanoseconds.
+struct name_statistics final {
+    std::uint64_t count{ 0 };
+    std::uint64_t sum{ 0 };
+    std::uint64_t min{ std::numeric_limits<std::uint64_t>::max() };
+    std::uint64_t max{ 0 };
+    double sum_squares{ 0.0 };
+    latency_histogram histogram;
+
+    /// @brief   Counts the given duration.
+    /// @param   duration How long the event took, in nanoseconds.
+    void
+    record(std::uint64_t duration) noexcept {
+        count++;
+        sum += duration;
+        min = std::min(min, duration);
+        max = std::max(max, duration);
+        sum_squares += static_cast<double>(duration) *
+                       static_cast<double>(duration);
+        histogram.record(duration);
+    }
+
+    /// @brief   Adds the other statistics to these ones.
+    /// @param   other The statistics that should be merged in.
+    void
+    merge(const name_statistics& other) noexcept {
+        count += other.count;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        sum_squares += other.sum_squares;
+        histogram.merge(other.histogram);
+    }
+
+    /// @brief   Gets the mean duration.
+    /// @returns The mean, or zero if nothing was counted.
+    double
+    mean() const noexcept {
+        if (count == 0)
+            return 0.0;
+        return static_cast<double>(sum) / static_cast<double>(count);
+    }
+
+    /// @brief   Gets the sample variance of the durations.
+    /// @returns The variance, or zero if fewer than two were counted.
+    double
+    variance() const noexcept {
+        if (count < 2)
+            return 0.0;
+
+        auto n = static_cast<double>(count);
+        auto m = mean();
+        return std::max(0.0, (sum_squares - n * m * m) / (n - 1.0));
+    }
+
+    /// @brief   Estimates the duration at the given percentile.
+    /// @param   percentile The percentile, between 0 and 100.
+    /// @returns The estimated duration, in nanoseconds.
+    std::uint64_t
+    percentile(double percentile) const noexcept {
+        return histogram.percentile(percentile);
+    }
+
+    /// @brief   Scales these statistics up to estimate the population they
+    ///          were sampled from.
+    /// @details Counts and sums are multiplied by the weight; the minimum,
+    ///          maximum, mean and percentiles stay as they were, since sampling
+    ///          doesn't change the shape of the distribution.
+    /// @param   weight How many events each counted event stands for, as given
+    ///          by `timeline::sampling_weight`.
+    /// @returns The scaled statistics.
+    name_statistics
+    scaled(double weight) const noexcept {
+        auto scale = [weight](std::uint64_t value) {
+            return static_cast<std::uint64_t>(
+                std::llround(static_cast<double>(value) * weight));
+        };
+
+        name_statistics result = *this;
+        result.count = scale(count);
+        result.sum = scale(sum);
+        result.sum_squares = sum_squares * weight;
+        result.histogram.total = 0;
+        for (auto& bucket : result.histogram.buckets) {
+            bucket = scale(bucket);
+            result.histogram.total += bucket;
+        }
+
+        return result;
+    }
+};
+
+/// @brief   The aggregated statistics of every name, keyed by its identifier.
+using statistics_map = std::unordered_map<name_id_t, name_statistics>;
+
+/// @brief   How many events each recorded event of a sampled name stands for,
+///          keyed by the identifier of the name.
+using sampling_weight_map = std::unordered_map<name_id_t, double>;
+
+
+namespace detail {
+
+/// @brief   The statistics of a single name, as updated by a single thread.
+/// @details Only the owning thread ever writes to these, so a relaxed load
+///          and store is enough to update them, without any read-modify-write
+///          operation. Other threads may read them at any time to merge them,
+///          and will see a recent, if not perfectly consistent, state.
+struct shard_entry final {
+    std::atomic<std::uint64_t> count{ 0 };
+    std::atomic<std::uint64_t> sum{ 0 };
+    std::atomic<std::uint64_t> min{ std::numeric_limits<std::uint64_t>::max() };
+    std::atomic<std::uint64_t> max{ 0 };
+    std::atomic<double> sum_squares{ 0.0 };
+    std::array<std::atomic<std::uint64_t>,
+        latency_histogram::k_bucket_count> buckets{ };
+};
+
+/// @brief   Adds the given value to an atomic only ever written by one thread.
+template<typename T>
+inline void
+owner_add(std::atomic<T>& target, T value) noexcept {
+    target.store(target.load(std::memory_order_relaxed) + value,
+        std::memory_order_relaxed);
+}
+
+/// @brief   The statistics of every name, as updated by a single thread.
+/// @details Entries are found by indexing with the name identifier, so
+///          updating them never has to hash or lock anything. The shard is
+///          tagged with the generation of the session it belongs to, and
+///          clears itself the first time it's updated by a new one.
+struct statistics_shard final {
+    /// @brief   Counts the given duration for the given name.
+    /// @details Must only be called from the owning thread.
+    /// @param   generation The generation of the current session.
+    /// @param   name The name of the event.
+    /// @param   duration How long the event took, in nanoseconds.
+    void
+    record(
+        std::uint64_t generation,
+        name_id_t name,
+        std::uint64_t duration
+    ) noexcept {
+        if (generation_.load(std::memory_order_relaxed) != generation)
+            reset(generation);
+
+        auto entry = entries_.get(name);
+        if (entry == nullptr)
+            return;
+
+        owner_add<std::uint64_t>(entry->count, 1);
+        owner_add(entry->sum, duration);
+        if (duration < entry->min.load(std::memory_order_relaxed))
+            entry->min.store(duration, std::memory_order_relaxed);
+        if (duration > entry->max.load(std::memory_order_relaxed))
+            entry->max.store(duration, std::memory_order_relaxed);
+        owner_add(entry->sum_squares,
+            static_cast<double>(duration) * static_cast<double>(duration));
+        owner_add<std::uint64_t>(
+            entry->buckets[latency_histogram::bucket_of(duration)], 1);
+    }
+
+    /// @brief   Merges the statistics of this shard into the given map.
+    /// @details May be called from any thread. Nothing is merged if the shard
+    ///          doesn't belong to the given generation.
+    /// @param   generation The generation of the current session.
+    /// @param   result The map the statistics should be merged into.
+    void
+    merge_into(std::uint64_t generation, statistics_map& result) const noexcept {
+        if (generation_.load(std::memory_order_acquire) != generation)
+            return;
+
+        entries_.for_each([&result](name_id_t name, const shard_entry& entry) {
+            auto count = entry.count.load(std::memory_order_relaxed);
+            if (count == 0)
+                return;
+
+            name_statistics stats;
+            stats.count = count;
+            stats.sum = entry.sum.load(std::memory_order_relaxed);
+            stats.min = entry.min.load(std::memory_order_relaxed);
+            stats.max = entry.max.load(std::memory_order_relaxed);
+            stats.sum_squares =
+                entry.sum_squares.load(std::memory_order_relaxed);
+            for (std::uint32_t k = 0; k < stats.histogram.buckets.size(); k++) {
+                auto n = entry.buckets[k].load(std::memory_order_relaxed);
+                stats.histogram.buckets[k] = n;
+                stats.histogram.total += n;
+            }
+
+            result[name].merge(stats);
+        });
+    }
+
+private:
+    void
+    reset(std::uint64_t generation) noexcept {
+        entries_.for_each([](name_id_t, shard_entry& entry) {
+            entry.count.store(0, std::memory_order_relaxed);
+            entry.sum.store(0, std::memory_order_relaxed);
+            entry.min.store(std::numeric_limits<std::uint64_t>::max(),
+                std::memory_order_relaxed);
+            entry.max.store(0, std::memory_order_relaxed);
+            entry.sum_squares.store(0.0, std::memory_order_relaxed);
+            for (auto& bucket : entry.buckets)
+                bucket.store(0, std::memory_order_relaxed);
+        });
+
+        generation_.store(generation, std::memory_order_release);
+    }
+
+private:
+    atomic_name_table<shard_entry> entries_;
+    std::atomic<std::uint64_t> generation_{ 0 };
+};
+
+} // namespace malunal::tooling::detail
+} // namespace malunal::tooling
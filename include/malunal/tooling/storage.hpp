@@ -0,0 +1,553 @@
+/// @file   storage.hpp
+/// @brief  Contains the pooled, segmented storage used by timelines.
+/// @author John Christman sorakatadzuma@gmail.com
+/// @copyright 2024 Malunal Studios, LLC.
+#pragma once
+
+
+namespace malunal::tooling {
+namespace detail {
+
+/// @brief   A growable array of trivially copyable elements which reports a
+///          failed allocation instead of throwing.
+/// @details The containers of the tooling grow on the profiling thread, or on
+///          the thread recording an event, where throwing would terminate the
+///          program. This keeps the bookkeeping of those containers to what
+///          can fail quietly.
+/// @tparam  T The type of the elements.
+template<typename T>
+struct nothrow_vector final {
+    static_assert(std::is_trivially_copyable_v<T>,
+        "Elements are moved with a plain copy of their bytes.");
+
+    nothrow_vector() noexcept = default;
+
+    nothrow_vector(const nothrow_vector&) = delete;
+    nothrow_vector& operator=(const nothrow_vector&) = delete;
+
+    nothrow_vector(nothrow_vector&& other) noexcept
+        : data_{ std::exchange(other.data_, nullptr) }
+        , size_{ std::exchange(other.size_, 0) }
+        , capacity_{ std::exchange(other.capacity_, 0) }
+    { }
+
+    nothrow_vector&
+    operator=(nothrow_vector&& other) noexcept {
+        if (this == &other)
+            return *this;
+
+        delete[] data_;
+        data_     = std::exchange(other.data_, nullptr);
+        size_     = std::exchange(other.size_, 0);
+        capacity_ = std::exchange(other.capacity_, 0);
+        return *this;
+    }
+
+    ~nothrow_vector() noexcept {
+        delete[] data_;
+    }
+
+    /// @brief   Appends the given element, growing the array if it's full.
+    /// @param   value The element that should be appended.
+    /// @returns True if the element was appended; false if the array was full
+    ///          and couldn't be grown.
+    bool
+    push_back(const T& value) noexcept {
+        if (size_ == capacity_ && !reserve(std::max<std::size_t>(capacity_ * 2, 16)))
+            return false;
+        data_[size_++] = value;
+        return true;
+    }
+
+    /// @brief   Makes room for at least the given number of elements.
+    /// @param   capacity The number of elements to make room for.
+    /// @returns True if the array can hold that many; false if it couldn't be
+    ///          grown.
+    bool
+    reserve(std::size_t capacity) noexcept {
+        if (capacity <= capacity_)
+            return true;
+
+        auto data = new (std::nothrow) T[capacity];
+        if (data == nullptr)
+            return false;
+
+        if (size_ != 0)
+            std::memcpy(static_cast<void*>(data), data_, size_ * sizeof(T));
+        delete[] data_;
+        data_ = data;
+        capacity_ = capacity;
+        return true;
+    }
+
+    /// @brief   Removes the element at the given position, keeping the order
+    ///          of the rest.
+    /// @param   position The element that should be removed.
+    /// @returns The position of the element which followed it.
+    T*
+    erase(T* position) noexcept {
+        std::memmove(static_cast<void*>(position), position + 1,
+            static_cast<std::size_t>(end() - position - 1) * sizeof(T));
+        --size_;
+        return position;
+    }
+
+    void pop_back() noexcept { --size_; }
+    void clear() noexcept    { size_ = 0; }
+
+    T&       operator[](std::size_t index) noexcept       { return data_[index]; }
+    const T& operator[](std::size_t index) const noexcept { return data_[index]; }
+    T&       back() noexcept       { return data_[size_ - 1]; }
+    const T& back() const noexcept { return data_[size_ - 1]; }
+
+    T*       begin() noexcept       { return data_; }
+    T*       end() noexcept         { return data_ + size_; }
+    const T* begin() const noexcept { return data_; }
+    const T* end() const noexcept   { return data_ + size_; }
+
+    bool        empty() const noexcept { return size_ == 0; }
+    std::size_t size() const noexcept  { return size_; }
+
+private:
+    T* data_{ nullptr };
+    std::size_t size_{ 0 };
+    std::size_t capacity_{ 0 };
+};
+
+/// @brief   A pool of fixed size blocks, shared by every container storing the
+///          same type of element.
+/// @details Blocks released to the pool are kept and handed out again, so once
+///          a session has grown its timeline, the next one can grow just as
+///          far without going back to the allocator. Blocks are not cleared
+///          when recycled; containers overwrite elements before reading them.
+/// @tparam  T The type of the elements stored in each block.
+/// @tparam  BlockSize The number of elements in each block.
+template<typename T, std::size_t BlockSize>
+struct block_pool final {
+    using block_t = std::array<T, BlockSize>;
+
+    /// @brief   Gets the pool of this type of block.
+    /// @details The pool is never destroyed, so containers that outlive the
+    ///          end of the program, like the timeline of the profiler, can
+    ///          still return their blocks to it.
+    /// @returns The pool shared by every container of this type.
+    static block_pool&
+    instance() noexcept {
+        static auto k_instance = new block_pool();
+        return *k_instance;
+    }
+
+    /// @brief   Takes a block out of the pool, or allocates one if the pool is
+    ///          empty.
+    /// @returns The block, or null if it could not be allocated.
+    block_t*
+    acquire() noexcept {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!free_.empty()) {
+                auto block = free_.back();
+                free_.pop_back();
+                return block;
+            }
+        }
+
+        return new (std::nothrow) block_t;
+    }
+
+    /// @brief   Returns the given blocks to the pool.
+    /// @details Blocks the pool has no room left to keep are freed instead.
+    /// @param   blocks The blocks that are no longer used.
+    void
+    release(std::span<block_t* const> blocks) noexcept {
+        if (blocks.empty())
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.reserve(free_.size() + blocks.size());
+        for (auto block : blocks) {
+            if (!free_.push_back(block))
+                delete block;
+        }
+    }
+
+    /// @brief   Frees the blocks held by the pool, beyond the given number.
+    /// @param   keep The number of blocks the pool should hold on to.
+    void
+    trim(std::size_t keep = 0) noexcept {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (free_.size() > keep) {
+            delete free_.back();
+            free_.pop_back();
+        }
+    }
+
+    /// @brief   Gets the number of blocks held by the pool.
+    /// @returns The number of blocks waiting to be reused.
+    std::size_t
+    size() const noexcept {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return free_.size();
+    }
+
+private:
+    block_pool() noexcept = default;
+
+    mutable std::mutex mutex_;
+    nothrow_vector<block_t*> free_;
+};
+
+/// @brief   A random access iterator over the elements of a segmented vector.
+/// @tparam  Container The type of the segmented vector, const if the iterator
+///          is immutable.
+template<typename Container>
+struct segmented_iterator final {
+    using iterator_category = std::random_access_iterator_tag;
+    using iterator_concept  = std::random_access_iterator_tag;
+    using value_type        = typename std::remove_const_t<Container>::value_type;
+    using difference_type   = std::ptrdiff_t;
+    using reference         = std::conditional_t<std::is_const_v<Container>,
+                                  const value_type&, value_type&>;
+    using pointer           = std::conditional_t<std::is_const_v<Container>,
+                                  const value_type*, value_type*>;
+
+    segmented_iterator() noexcept = default;
+
+    segmented_iterator(Container* container, std::size_t index) noexcept
+        : container_{ container }
+        , index_{ index }
+    { }
+
+    /// @brief Converts a mutable iterator into an immutable one.
+    template<typename Other>
+        requires std::is_same_v<const Other, Container>
+    segmented_iterator(const segmented_iterator<Other>& other) noexcept
+        : container_{ other.container() }
+        , index_{ other.index() }
+    { }
+
+    reference
+    operator*() const noexcept {
+        return (*container_)[index_];
+    }
+
+    pointer
+    operator->() const noexcept {
+        return &(*container_)[index_];
+    }
+
+    reference
+    operator[](difference_type offset) const noexcept {
+        return (*container_)[index_ + offset];
+    }
+
+    segmented_iterator&
+    operator++() noexcept {
+        ++index_;
+        return *this;
+    }
+
+    segmented_iterator
+    operator++(int) noexcept {
+        auto copy = *this;
+        ++index_;
+        return copy;
+    }
+
+    segmented_iterator&
+    operator--() noexcept {
+        --index_;
+        return *this;
+    }
+
+    segmented_iterator
+    operator--(int) noexcept {
+        auto copy = *this;
+        --index_;
+        return copy;
+    }
+
+    segmented_iterator&
+    operator+=(difference_type offset) noexcept {
+        index_ += offset;
+        return *this;
+    }
+
+    segmented_iterator&
+    operator-=(difference_type offset) noexcept {
+        index_ -= offset;
+        return *this;
+    }
+
+    friend segmented_iterator
+    operator+(segmented_iterator it, difference_type offset) noexcept {
+        return it += offset;
+    }
+
+    friend segmented_iterator
+    operator+(difference_type offset, segmented_iterator it) noexcept {
+        return it += offset;
+    }
+
+    friend segmented_iterator
+    operator-(segmented_iterator it, difference_type offset) noexcept {
+        return it -= offset;
+    }
+
+    friend difference_type
+    operator-(
+        const segmented_iterator& lhs,
+        const segmented_iterator& rhs
+    ) noexcept {
+        return static_cast<difference_type>(lhs.index_) -
+               static_cast<difference_type>(rhs.index_);
+    }
+
+    friend bool
+    operator==(
+        const segmented_iterator& lhs,
+        const segmented_iterator& rhs
+    ) noexcept {
+        return lhs.index_ == rhs.index_;
+    }
+
+    friend auto
+    operator<=>(
+        const segmented_iterator& lhs,
+        const segmented_iterator& rhs
+    ) noexcept {
+        return lhs.index_ <=> rhs.index_;
+    }
+
+    Container*
+    container() const noexcept {
+        return container_;
+    }
+
+    std::size_t
+    index() const noexcept {
+        return index_;
+    }
+
+private:
+    Container* container_{ nullptr };
+    std::size_t index_{ 0 };
+};
+
+} // namespace malunal::tooling::detail
+
+/// @brief   A sequence of elements stored in fixed size blocks.
+/// @details Appending never moves the elements already stored, it only takes
+///          another block from the pool when the last one is full, so there
+///          is no reallocation spike however large the sequence gets. Blocks
+///          are returned to the pool when the vector is cleared or destroyed,
+///          ready for the next one.
+/// @tparam  T The type of the elements, which must be trivially copyable.
+/// @tparam  BlockSize The number of elements in each block, a power of two.
+template<typename T, std::size_t BlockSize = 4096>
+struct segmented_vector final {
+    static_assert(std::has_single_bit(BlockSize),
+        "The block size must be a power of two.");
+    static_assert(std::is_trivially_copyable_v<T>,
+        "Pooled blocks are recycled without destroying their elements.");
+
+    using value_type      = T;
+    using size_type       = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference       = T&;
+    using const_reference = const T&;
+    using iterator        = detail::segmented_iterator<segmented_vector>;
+    using const_iterator  = detail::segmented_iterator<const segmented_vector>;
+    using reverse_iterator       = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+    using pool_t          = detail::block_pool<T, BlockSize>;
+    using block_t         = typename pool_t::block_t;
+
+    static constexpr std::size_t k_block_size = BlockSize;
+
+    segmented_vector() noexcept = default;
+
+    segmented_vector(const segmented_vector&) = delete;
+    segmented_vector& operator=(const segmented_vector&) = delete;
+
+    segmented_vector(segmented_vector&& other) noexcept
+        : blocks_{ std::move(other.blocks_) }
+        , size_{ std::exchange(other.size_, 0) }
+    {
+        other.blocks_.clear();
+    }
+
+    segmented_vector&
+    operator=(segmented_vector&& other) noexcept {
+        if (this == &other)
+            return *this;
+
+        release();
+        blocks_ = std::move(other.blocks_);
+        size_ = std::exchange(other.size_, 0);
+        other.blocks_.clear();
+        return *this;
+    }
+
+    ~segmented_vector() noexcept {
+        release();
+    }
+
+    /// @brief   Appends the given element.
+    /// @param   value The element that should be appended.
+    /// @remarks The element is dropped if no block could be allocated.
+    void
+    push_back(const T& value) noexcept {
+        if (size_ == capacity() && !grow())
+            return;
+        (*this)[size_++] = value;
+    }
+
+    /// @brief   Appends the given elements, a block at a time.
+    /// @param   values The elements that should be appended, in order.
+    void
+    append(std::span<const T> values) noexcept {
+        while (!values.empty()) {
+            if (size_ == capacity() && !grow())
+                return;
+
+            auto offset = size_ & (BlockSize - 1);
+            auto count  = std::min(values.size(), BlockSize - offset);
+            std::copy_n(values.begin(), count,
+                blocks_[size_ / BlockSize]->begin() + offset);
+            size_ += count;
+            values = values.subspan(count);
+        }
+    }
+
+    /// @brief   Removes the last element.
+    void
+    pop_back() noexcept {
+        --size_;
+    }
+
+    /// @brief   Removes every element and returns the blocks to the pool.
+    void
+    clear() noexcept {
+        release();
+    }
+
+    /// @brief   Takes enough blocks to hold the given number of elements.
+    /// @param   size The number of elements to make room for.
+    void
+    reserve(std::size_t size) noexcept {
+        while (capacity() < size && grow())
+            ;
+    }
+
+    /// @brief   Changes the number of elements, filling new ones with a
+    ///          default constructed element.
+    /// @param   size The new number of elements.
+    void
+    resize(std::size_t size) noexcept {
+        reserve(size);
+        size = std::min(size, capacity());
+        for (auto i = size_; i < size; i++)
+            (*this)[i] = T{ };
+        size_ = size;
+    }
+
+    reference
+    operator[](std::size_t index) noexcept {
+        return (*blocks_[index / BlockSize])[index & (BlockSize - 1)];
+    }
+
+    const_reference
+    operator[](std::size_t index) const noexcept {
+        return (*blocks_[index / BlockSize])[index & (BlockSize - 1)];
+    }
+
+    reference       front() noexcept       { return (*this)[0]; }
+    const_reference front() const noexcept { return (*this)[0]; }
+    reference       back() noexcept        { return (*this)[size_ - 1]; }
+    const_reference back() const noexcept  { return (*this)[size_ - 1]; }
+
+    /// @brief   Checks if the vector holds no elements.
+    /// @returns True if the vector is empty; false otherwise.
+    bool
+    empty() const noexcept {
+        return size_ == 0;
+    }
+
+    /// @brief   Gets the number of elements in the vector.
+    /// @returns The number of elements stored.
+    std::size_t
+    size() const noexcept {
+        return size_;
+    }
+
+    /// @brief   Gets the number of elements the blocks held can store.
+    /// @returns The capacity of the vector.
+    std::size_t
+    capacity() const noexcept {
+        return blocks_.size() * BlockSize;
+    }
+
+    /// @brief   Gets the elements of the block at the given index.
+    /// @details Lets callers walk the vector a contiguous block at a time.
+    /// @param   index The index of the block.
+    /// @returns The elements stored in the block.
+    std::span<const T>
+    block(std::size_t index) const noexcept {
+        auto first = index * BlockSize;
+        if (first >= size_)
+            return { };
+        return { blocks_[index]->data(), std::min(BlockSize, size_ - first) };
+    }
+
+    /// @brief   Gets the number of blocks holding elements.
+    /// @returns The number of blocks that `block` can be called with.
+    std::size_t
+    block_count() const noexcept {
+        return (size_ + BlockSize - 1) / BlockSize;
+    }
+
+    iterator       begin() noexcept        { return { this, 0 }; }
+    iterator       end() noexcept          { return { this, size_ }; }
+    const_iterator begin() const noexcept  { return { this, 0 }; }
+    const_iterator end() const noexcept    { return { this, size_ }; }
+    const_iterator cbegin() const noexcept { return { this, 0 }; }
+    const_iterator cend() const noexcept   { return { this, size_ }; }
+
+    reverse_iterator       rbegin() noexcept       { return reverse_iterator{ end() }; }
+    reverse_iterator       rend() noexcept         { return reverse_iterator{ begin() }; }
+    const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator{ end() }; }
+    const_reverse_iterator rend() const noexcept   { return const_reverse_iterator{ begin() }; }
+
+    /// @brief   Frees the blocks held by the pool of this type of vector.
+    /// @details Blocks in use by a vector are unaffected.
+    static void
+    trim_pool() noexcept {
+        pool_t::instance().trim();
+    }
+
+private:
+    bool
+    grow() noexcept {
+        auto block = pool_t::instance().acquire();
+        if (block == nullptr)
+            return false;
+        if (blocks_.push_back(block))
+            return true;
+
+        pool_t::instance().release({ &block, 1 });
+        return false;
+    }
+
+    void
+    release() noexcept {
+        pool_t::instance().release(blocks_);
+        blocks_.clear();
+        size_ = 0;
+    }
+
+private:
+    detail::nothrow_vector<block_t*> blocks_;
+    std::size_t size_{ 0 };
+};
+
+} // namespace malunal::tooling
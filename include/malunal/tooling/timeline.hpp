@@ -29,24 +29,180 @@ concept TimelineVisitor = requires {
 } // namespace malunal::tooling::detail
 
 
+/// @brief   Determines how a timeline stores the timing events pushed into it.
+enum class storage_mode {
+    /// @brief   Every event is stored as an `event_variant_t`, in the order it
+    ///          was pushed.
+    events,
+
+    /// @brief   Timing events are stored as a structure of arrays.
+    /// @details Each field of the timing events is stored in its own array,
+    ///          which avoids the overhead of the variant for long captures
+    ///          and lets visitors stream through a single field at a time.
+    ///          Events of any other type are still stored as variants.
+    columnar
+};
+
+/// @brief   A structure of arrays holding the fields of timing events.
+/// @details The element at the same index of each array belongs to the same
+///          timing event. Each array is a segmented vector, so growing them
+///          never moves the events already stored.
+struct timing_columns final {
+    segmented_vector<name_id_t> names;
+    segmented_vector<thread_index_t> tids;
+    segmented_vector<std::uint16_t> flags;
+    segmented_vector<tick_t> starts;
+    segmented_vector<tick_t> durations;
+
+    /// @brief   Appends the fields of the given event to each array.
+    /// @param   e The event that should be appended.
+    void
+    push(const timing_event& e) noexcept {
+        names.push_back(e.name);
+        tids.push_back(e.tid);
+        flags.push_back(e.flags);
+        starts.push_back(e.start);
+        durations.push_back(e.duration);
+    }
+
+    /// @brief   Reassembles the timing event at the given index.
+    /// @param   index The index of the event.
+    /// @returns The timing event stored at that index.
+    timing_event
+    operator[](size_t index) const noexcept {
+        return timing_event {
+            .name     = names[index],
+            .tid      = tids[index],
+            .flags    = flags[index],
+            .start    = starts[index],
+            .duration = durations[index]
+        };
+    }
+
+    /// @brief   Removes every event from each array.
+    void
+    clear() noexcept {
+        names.clear();
+        tids.clear();
+        flags.clear();
+        starts.clear();
+        durations.clear();
+    }
+
+    /// @brief   Reserves room for the given number of events in each array.
+    /// @param   size The number of events to reserve room for.
+    void
+    reserve(size_t size) noexcept {
+        names.reserve(size);
+        tids.reserve(size);
+        flags.reserve(size);
+        starts.reserve(size);
+        durations.reserve(size);
+    }
+
+    /// @brief   Checks if the arrays have events.
+    /// @returns True if the arrays have no events; false otherwise.
+    bool
+    empty() const noexcept {
+        return names.empty();
+    }
+
+    /// @brief   Frees the blocks pooled for the arrays of every timeline.
+    static void
+    trim_pools() noexcept {
+        decltype(names)::trim_pool();
+        decltype(tids)::trim_pool();
+        decltype(flags)::trim_pool();
+        decltype(starts)::trim_pool();
+        decltype(durations)::trim_pool();
+    }
+
+    /// @brief   Gets the number of events in the arrays.
+    /// @returns The number of events stored.
+    size_t
+    size() const noexcept {
+        return names.size();
+    }
+};
+
+
+namespace detail {
+
+/// @brief   Defines a type constraint that assures the given type can visit
+///          the timing events of a columnar timeline all at once.
+/// @tparam  Visitor The type of the visitor.
+template<typename Visitor>
+concept ColumnarTimelineVisitor = requires(
+    Visitor& visitor,
+    const timing_columns& columns
+) {
+    { visitor.visit_columns(columns) } noexcept;
+};
+
+/// @brief   Defines a type constraint that assures the given type can be given
+///          the names of the threads of a timeline before visiting it.
+/// @tparam  Visitor The type of the visitor.
+template<typename Visitor>
+concept ThreadNamingVisitor = requires(
+    Visitor& visitor,
+    const thread_name_map& names
+) {
+    { visitor.use_thread_names(names) } noexcept;
+};
+
+/// @brief   Defines a type constraint that assures the given type is a visitor
+///          whose results can be computed over parts of a timeline separately
+///          and then combined.
+/// @details Each worker of `timeline::parallel_accept` visits its part of the
+///          timeline with a default constructed visitor, and the results are
+///          merged back into the visitor that was given, in order.
+/// @tparam  Visitor The type of the visitor.
+template<typename Visitor>
+concept ReducibleTimelineVisitor =
+    TimelineVisitor<Visitor> &&
+    std::default_initializable<Visitor> &&
+    requires(Visitor& visitor, Visitor&& other) {
+        { visitor.merge(std::move(other)) } noexcept;
+    };
+
+} // namespace malunal::tooling::detail
+
+
 /// @brief   A structure for storing information about a timeline of events.
 /// @details More specifically, this timeline, which is for performance tooling
 ///          stores information about the measurement of events that took place
 ///          within
+/// @remarks Events are stored in fixed size blocks drawn from a pool shared
+///          by every timeline, so the timeline grows without ever moving the
+///          events it already holds. When a timeline is cleared or destroyed
+///          its blocks go back to the pool, and the next session reuses them.
 struct timeline final {
-    using iterator = std::vector<event_variant_t>::iterator;
-    using const_iterator = std::vector<event_variant_t>::const_iterator;
-    using reverse_iterator = std::vector<event_variant_t>::reverse_iterator;
-    using const_reverse_iterator = std::vector<event_variant_t>::const_reverse_iterator;
+    using storage_t = segmented_vector<event_variant_t>;
+    using iterator = storage_t::iterator;
+    using const_iterator = storage_t::const_iterator;
+    using reverse_iterator = storage_t::reverse_iterator;
+    using const_reverse_iterator = storage_t::const_reverse_iterator;
 
     timeline() noexcept = default;
     ~timeline() noexcept = default;
 
+    /// @brief Creates a timeline which stores its events as specified.
+    /// @param mode How the timeline should store timing events.
+    explicit timeline(storage_mode mode) noexcept
+        : mode_{ mode }
+    { }
+
     /// @brief Move constructor for transferring data efficiently.
     /// @param other The timeline that we will be moving data from.
     timeline(timeline&& other) noexcept
         : mutex_{ }
+        , mode_{ other.mode_ }
         , events_{ std::move(other.events_) }
+        , columns_{ std::move(other.columns_) }
+        , statistics_{ std::move(other.statistics_) }
+        , sampling_weights_{ std::move(other.sampling_weights_) }
+        , thread_names_{ std::move(other.thread_names_) }
+        , dropped_events_{ other.dropped_events_ }
     { }
 
     /// @brief   Move assignment operator for transferring data efficiently.
@@ -54,7 +210,13 @@ struct timeline final {
     /// @returns This timeline with the moved data.
     timeline&
     operator=(timeline&& other) noexcept {
-        events_ = std::move(other.events_);
+        mode_    = other.mode_;
+        events_  = std::move(other.events_);
+        columns_ = std::move(other.columns_);
+        statistics_ = std::move(other.statistics_);
+        sampling_weights_ = std::move(other.sampling_weights_);
+        thread_names_ = std::move(other.thread_names_);
+        dropped_events_ = other.dropped_events_;
         return *this;
     }
 
@@ -68,13 +230,33 @@ struct timeline final {
     void
     push(const event_variant_t& e) noexcept {
         std::lock_guard<std::mutex> lock(mutex_);
-        events_.push_back(e);
+        store(e);
     }
 
-    /// @brief   Pops the last event in this timeline.
+    /// @brief   Pushes the given batch of events into this timeline.
     /// @details Since this timeline method will modify the timeline, it
     ///          needs to be locked so other objects cannot modify it at
     ///          the same time and potentially corrupt it or bring it out
+    ///          of synch with observers. The lock is only taken once for the
+    ///          entire batch.
+    /// @param   events The events that should be inserted, in order.
+    void
+    push(std::span<const event_variant_t> events) noexcept {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (mode_ == storage_mode::events) {
+            events_.append(events);
+            return;
+        }
+
+        for (const auto& e : events)
+            store(e);
+    }
+
+    /// @brief   Pops the last event in this timeline.
+    /// @details Only events stored as variants can be popped.
+    ///           Since this timeline method will modify the timeline, it
+    ///          needs to be locked so other objects cannot modify it at
+    ///          the same time and potentially corrupt it or bring it out
     ///          of synch with observers.
     void
     pop() noexcept {
@@ -91,6 +273,7 @@ struct timeline final {
     clear() noexcept {
         std::lock_guard<std::mutex> lock(mutex_);
         events_.clear();
+        columns_.clear();
     }
 
     /// @brief   Gets the first element in the timeline.
@@ -125,33 +308,157 @@ struct timeline final {
     /// @returns True if the timeline has events; false otherwise.
     bool
     empty() const noexcept {
-        return events_.empty();
+        return events_.empty() && columns_.empty();
     }
 
     /// @brief   Gets the current size of the timeline.
     /// @returns The number of events contained within the timeline.
     size_t
     size() const noexcept {
-        return events_.size();
+        return events_.size() + columns_.size();
+    }
+
+    /// @brief   Gets how this timeline stores timing events.
+    /// @returns The storage mode of this timeline.
+    storage_mode
+    mode() const noexcept {
+        return mode_;
+    }
+
+    /// @brief   Immutably gets the timing events stored as columns.
+    /// @details This is only populated when the timeline was created with
+    ///          `storage_mode::columnar`. The iterators of this timeline do
+    ///          not cover these events.
+    /// @returns The columns of timing events.
+    const timing_columns&
+    columns() const noexcept {
+        return columns_;
+    }
+
+    /// @brief   Immutably gets the statistics aggregated for this timeline.
+    /// @details The profiler fills these in when a session that captures
+    ///          statistics is stopped; they summarize every timing event the
+    ///          session saw, whether or not the events were kept.
+    /// @returns The statistics of each name.
+    const statistics_map&
+    statistics() const noexcept {
+        return statistics_;
+    }
+
+    /// @brief   Replaces the statistics aggregated for this timeline.
+    /// @param   statistics The statistics of each name.
+    void
+    set_statistics(statistics_map statistics) noexcept {
+        statistics_ = std::move(statistics);
+    }
+
+    /// @brief   Immutably gets the sampling weights of this timeline.
+    /// @details The profiler fills these in when a session is stopped, with an
+    ///          entry for every name that was recorded by a sampled probe,
+    ///          holding the average weight of its recorded events.
+    /// @returns The sampling weight of each sampled name.
+    const sampling_weight_map&
+    sampling_weights() const noexcept {
+        return sampling_weights_;
+    }
+
+    /// @brief   Gets how many events each recorded event of the given name
+    ///          stands for.
+    /// @details Multiply counts and sums by this to estimate what they would
+    ///          have been had every event been recorded.
+    /// @param   name The identifier of the name.
+    /// @returns The sampling weight of the name, or one if it wasn't sampled.
+    double
+    sampling_weight(name_id_t name) const noexcept {
+        auto it = sampling_weights_.find(name);
+        return it == sampling_weights_.end() ? 1.0 : it->second;
+    }
+
+    /// @brief   Replaces the sampling weights of this timeline.
+    /// @param   weights The sampling weight of each sampled name.
+    void
+    set_sampling_weights(sampling_weight_map weights) noexcept {
+        sampling_weights_ = std::move(weights);
+    }
+
+    /// @brief   Immutably gets the names of the threads of this timeline.
+    /// @details The profiler fills these in when a session is stopped or a
+    ///          snapshot is taken, with the names the threads had then, so
+    ///          they stay right after the index of a thread that exited has
+    ///          been given to another.
+    /// @returns The identifier of the name of each named thread.
+    const thread_name_map&
+    thread_names() const noexcept {
+        return thread_names_;
+    }
+
+    /// @brief   Gets the name of the thread with the given index.
+    /// @param   tid The index of the thread.
+    /// @returns The name of the thread, or an empty name if it wasn't named.
+    std::string_view
+    thread_name(thread_index_t tid) const noexcept {
+        auto it = thread_names_.find(tid);
+        return it == thread_names_.end() ? std::string_view{ }
+                                         : name_registry::resolve(it->second);
+    }
+
+    /// @brief   Replaces the names of the threads of this timeline.
+    /// @param   names The identifier of the name of each named thread.
+    void
+    set_thread_names(thread_name_map names) noexcept {
+        thread_names_ = std::move(names);
+    }
+
+    /// @brief   Gets the number of events that were dropped while this
+    ///          timeline was recorded.
+    /// @details The profiler fills this in when a session is stopped, with the
+    ///          events threads dropped under the overflow policy because their
+    ///          buffers were full.
+    /// @returns The number of events that never made it into the timeline.
+    std::uint64_t
+    dropped_events() const noexcept {
+        return dropped_events_;
+    }
+
+    /// @brief   Replaces the number of events dropped while this timeline was
+    ///          recorded.
+    /// @param   dropped The number of events dropped.
+    void
+    set_dropped_events(std::uint64_t dropped) noexcept {
+        dropped_events_ = dropped;
+    }
+
+    /// @brief   Frees the blocks pooled for the storage of every timeline.
+    /// @details Call this once the memory of finished sessions is no longer
+    ///          expected to be reused. Timelines in use are unaffected.
+    static void
+    trim_pools() noexcept {
+        storage_t::trim_pool();
+        timing_columns::trim_pools();
     }
 
     /// @brief   Gets the current max size of the timeline.
-    /// @returns The number of events the timeline could contain.
+    /// @returns The number of events the timeline could contain without taking
+    ///          another block from the pool.
     size_t
     capacity() const noexcept {
         return events_.capacity();
     }
 
     /// @brief   Resizes the maximum capacity of the timeline.
-    /// @details Since this timeline method will modify the timeline, it
-    ///          needs to be locked so other objects cannot modify it at
-    ///          the same time and potentially corrupt it or bring it out
-    ///          of synch with observers.
+    /// @details Reserving is never needed to avoid moving events, but takes
+    ///          the blocks up front so pushing doesn't have to. Since this
+    ///          timeline method will modify the timeline, it needs to be
+    ///          locked so other objects cannot modify it at the same time and
+    ///          potentially corrupt it or bring it out of synch with
+    ///          observers.
     /// @param   size The new maximum timeline size.
     void
     reserve(size_t size) noexcept {
         std::lock_guard<std::mutex> lock(mutex_);
-        events_.reserve(size);
+        if (mode_ == storage_mode::columnar)
+            columns_.reserve(size);
+        else events_.reserve(size);
     }
 
     /// @brief   Resizes the current capacity of the timeline.
@@ -184,6 +491,24 @@ struct timeline final {
         return events_.end();
     }
 
+    /// @brief   Obtains an immutable iterator to the beginning of the underlying
+    ///          structure of this timeline.
+    /// @returns The beginning iterator for the events vector stored by this
+    ///          timeline.
+    const_iterator
+    begin() const noexcept {
+        return events_.cbegin();
+    }
+
+    /// @brief   Obtains an immutable iterator to the ending of the underlying
+    ///          structure of this timeline.
+    /// @returns The ending iterator for the events vector stored by this
+    ///          timeline.
+    const_iterator
+    end() const noexcept {
+        return events_.cend();
+    }
+
     /// @brief   Obtains an immutable iterator to the beginning of the underlying
     ///          structure of this timeline.
     /// @returns The beginning iterator for the events vector stored by this
@@ -226,7 +551,7 @@ struct timeline final {
     ///          this timeline.
     const_reverse_iterator
     crbegin() const noexcept {
-        return events_.rbegin();
+        return std::as_const(events_).rbegin();
     }
 
     /// @brief   Obtains an immutable reverse iterator to the ending of the
@@ -235,7 +560,7 @@ struct timeline final {
     ///          this timeline.
     const_reverse_iterator
     crend() const noexcept {
-        return events_.rend();
+        return std::as_const(events_).rend();
     }
 
     /// @brief   Iterates each thread timeline.
@@ -247,15 +572,119 @@ struct timeline final {
     /// @tparam  Visitor The type of the visitor.
     /// @param   visitor The visitor requesting to visit the nodes of this
     //           timeline and its children.
+    /// @remarks Timing events stored as columns are visited after the events
+    ///          stored as variants. If the visitor can visit columns, it is
+    ///          given all of them at once; otherwise each one is reassembled
+    ///          into a variant and visited in turn. Visitors which name
+    ///          threads are given the names kept by this timeline, if it has
+    ///          any.
     template<detail::TimelineVisitor Visitor>
     void accept(Visitor& visitor) const noexcept {
+        if constexpr (detail::ThreadNamingVisitor<Visitor>) {
+            if (!thread_names_.empty())
+                visitor.use_thread_names(thread_names_);
+        }
+
         for (const auto& evar : events_)
             visitor.visit(evar);
+
+        if (columns_.empty())
+            return;
+
+        if constexpr (detail::ColumnarTimelineVisitor<Visitor>) {
+            visitor.visit_columns(columns_);
+        } else {
+            for (size_t i = 0; i < columns_.size(); i++)
+                visitor.visit(event_variant_t{ columns_[i] });
+        }
+    }
+
+    /// @brief   Visits the events of this timeline across several threads.
+    /// @details The events are split into contiguous parts, one per worker,
+    ///          and each worker visits its part with a visitor of its own.
+    ///          Once every worker is done, their visitors are merged into the
+    ///          given one, in the order of the parts. Visitors only see the
+    ///          events of their part, so this suits visitors that aggregate,
+    ///          rather than ones that depend on the order of every event.
+    /// @tparam  Visitor The type of the visitor.
+    /// @param   visitor The visitor that should receive the merged results.
+    /// @param   workers The number of threads to use, or zero for one per
+    ///          hardware thread.
+    template<detail::ReducibleTimelineVisitor Visitor>
+    void
+    parallel_accept(Visitor& visitor, std::size_t workers = 0) const noexcept {
+        auto count = size();
+        workers = detail::resolve_workers(workers, count);
+        if (workers <= 1) {
+            accept(visitor);
+            return;
+        }
+
+        std::vector<Visitor> partial(workers);
+        detail::parallel_for(count, workers,
+            [this, &partial](std::size_t w, std::size_t first, std::size_t last) {
+                auto& local = partial[w];
+                auto split = std::min(last, events_.size());
+                for (auto i = first; i < split; i++)
+                    local.visit(events_[i]);
+                for (auto i = std::max(first, split); i < last; i++)
+                    local.visit(event_variant_t{ columns_[i - events_.size()] });
+            });
+
+        for (auto& local : partial)
+            visitor.merge(std::move(local));
+    }
+
+    /// @brief   Copies every timing event of this timeline, whether stored as
+    ///          variants or as columns.
+    /// @returns The timing events, in the order they are stored.
+    std::vector<timing_event>
+    timing_events() const noexcept {
+        std::vector<timing_event> result;
+        result.reserve(size());
+        for (const auto& evar : events_)
+            if (auto timing = std::get_if<timing_event>(&evar))
+                result.push_back(*timing);
+        for (size_t i = 0; i < columns_.size(); i++)
+            result.push_back(columns_[i]);
+        return result;
+    }
+
+    /// @brief   Copies every timing event of this timeline, sorted by thread
+    ///          and start time across several threads.
+    /// @param   workers The number of threads to use, or zero for one per
+    ///          hardware thread.
+    /// @returns The sorted timing events, which `thread_runs` can split into
+    ///          the events of each thread.
+    std::vector<timing_event>
+    sorted_timing_events(std::size_t workers = 0) const noexcept {
+        auto result = timing_events();
+        parallel_sort(result, workers);
+        return result;
+    }
+
+private:
+    void
+    store(const event_variant_t& e) noexcept {
+        if (mode_ == storage_mode::columnar) {
+            if (auto timing = std::get_if<timing_event>(&e)) {
+                columns_.push(*timing);
+                return;
+            }
+        }
+
+        events_.push_back(e);
     }
 
 private:
     std::mutex mutex_;
-    std::vector<event_variant_t> events_;
+    storage_mode mode_{ storage_mode::events };
+    storage_t events_;
+    timing_columns columns_;
+    statistics_map statistics_;
+    sampling_weight_map sampling_weights_;
+    thread_name_map thread_names_;
+    std::uint64_t dropped_events_{ 0 };
 };
 
 } // namespace malunal::tooling
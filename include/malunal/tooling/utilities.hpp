@@ -21,12 +21,69 @@ current_source_location(
     std::source_location location =
         std::source_location::current()
 ) noexcept {
-    static std::ostringstream oss;
-    oss.str(""); // Clear the output stream.
-    oss << location.file_name() << ":"
-        << location.line()      << " "
-        << location.function_name();
-    return oss.str();
+    std::string result{ location.file_name() };
+    result += ':';
+    result += std::to_string(location.line());
+    result += ' ';
+    result += location.function_name();
+    return result;
 }
 
+/// @brief   Obtains the current source location and interns the string made
+///          out of that location.
+/// @details This is what `MALUNAL_TOOLING_MEASURE_FUNCTION` uses to name the
+///          function it measures. The result is meant to be stored in a
+///          function local static, so the string is only built once per call
+///          site rather than once per call.
+/// @param   location The current source location.
+/// @returns The interned identifier of the source location string.
+inline name_id_t
+intern_source_location(
+    std::source_location location =
+        std::source_location::current()
+) noexcept {
+    return name_registry::intern(current_source_location(location));
+}
+
+namespace detail {
+
+/// @brief   Defines a type constraint that assures the given type is a
+///          reference to an array of constant characters, such as a string
+///          literal, whose contents can't change from one call to the next.
+/// @tparam  Name The type of the name, as given to a measuring macro.
+template<typename Name>
+concept LiteralName =
+    std::is_lvalue_reference_v<Name> &&
+    std::is_array_v<std::remove_reference_t<Name>> &&
+    std::is_same_v<std::remove_extent_t<std::remove_reference_t<Name>>, const char>;
+
+
+/// @brief   The name a call site was given as a string literal, interned the
+///          first time the call site runs.
+/// @details A literal has the same address every time its call site runs, so
+///          a different array given at the same call site, such as the other
+///          side of a conditional, is told apart by its address and interned
+///          on every call instead.
+struct literal_name final {
+    /// @brief   Interns the given literal.
+    /// @param   name The literal given to the call site.
+    explicit literal_name(std::string_view name) noexcept
+        : text{ name.data() }
+        , id{ name_registry::intern(name) }
+    { }
+
+    /// @brief   Gets the identifier of the given name.
+    /// @param   name The array given to the call site this time.
+    /// @returns The identifier of the literal, if that is what was given.
+    name_id_t
+    resolve(std::string_view name) const noexcept {
+        return name.data() == text ? id : name_registry::intern(name);
+    }
+
+    const char* text;
+    name_id_t id;
+};
+
+} // namespace malunal::tooling::detail
+
 } // namespace malunal::tooling